@@ -0,0 +1,160 @@
+/*
+ * admitbench.c - 요청 기록을 캐시에 다시 흘려 입장 필터의 효과를 잰다
+ *
+ * 입장 조건(-a 값)마다 자식 프로세스에서 빈 캐시로 같은 기록을 처음부터 재생하고,
+ * 적중률과 캐시가 드나든 양(저장/내보낸 세그먼트 수), 캐시에 넣으려고 복사한 바이트,
+ * 캐시 호출 안에서 보낸 시간(단일 쓰레드이므로 락을 쥔 시간)을 요청당으로 보여 준다.
+ *
+ * 기록 파일은 한 줄에 "url 크기"이며, 주지 않으면 인기 객체 5000개(Zipf)와
+ * 한 번만 요청되는 객체가 섞인 기록을 만들어 쓴다.
+ *
+ * usage: ./admitbench [-c cachebytes] [tracefile]
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "url.h"
+
+#define NPOPULAR 5000
+#define NREQUESTS 300000
+#define ONEHIT_PERCENT 40
+
+typedef struct {
+  char url[64];
+  size_t size;
+} req_t;
+
+static req_t *trace;
+static int ntrace;
+static char body[MAX_OBJECT_SIZE];
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t size_of(unsigned id)
+{
+  return 1024 + (id * 2654435761u) % (64 * 1024);
+}
+
+static void make_trace(void)
+{
+  static double cdf[NPOPULAR];
+  double sum = 0, r;
+  int i, lo, hi, onehit = 0;
+
+  for (i = 0; i < NPOPULAR; i++)
+    cdf[i] = (sum += 1.0 / pow(i + 1, 0.9));
+  srand(15213);
+  trace = Malloc(NREQUESTS * sizeof(req_t));
+  for (ntrace = 0; ntrace < NREQUESTS; ntrace++) {
+    if (rand() % 100 < ONEHIT_PERCENT) {
+      sprintf(trace[ntrace].url, "http://origin/once/%d", onehit);
+      trace[ntrace].size = size_of(NPOPULAR + onehit++);
+      continue;
+    }
+    r = (double)rand() / RAND_MAX * sum;
+    for (lo = 0, hi = NPOPULAR - 1; lo < hi; )
+      if (cdf[(lo + hi) / 2] < r)
+        lo = (lo + hi) / 2 + 1;
+      else
+        hi = (lo + hi) / 2;
+    sprintf(trace[ntrace].url, "http://origin/hot/%d", lo);
+    trace[ntrace].size = size_of(lo);
+  }
+}
+
+static void read_trace(char *file)
+{
+  FILE *fp;
+  char url[64];
+  size_t size;
+  int cap = 1024;
+
+  if (!(fp = fopen(file, "r")))
+    unix_error("fopen error");
+  trace = Malloc(cap * sizeof(req_t));
+  while (fscanf(fp, "%63s %zu", url, &size) == 2) {    // 긴 url은 앞 63바이트로 구분한다
+    if (ntrace == cap)
+      trace = Realloc(trace, (cap *= 2) * sizeof(req_t));
+    strcpy(trace[ntrace].url, url);
+    trace[ntrace++].size = size < MAX_OBJECT_SIZE ? size : MAX_OBJECT_SIZE;
+  }
+  fclose(fp);
+}
+
+static void replay(int admit)
+{
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  cache_stats_t st;
+  unsigned long hits = 0, copied = 0;
+  double t, held = 0;
+  int i;
+
+  cache_admit_hits = admit;
+  for (i = 0; i < ntrace; i++) {
+    t = now_ns();
+    if (cache_lookup(trace[i].url, url_hash(trace[i].url), &meta, &blob) != CACHE_MISS) {
+      held += now_ns() - t;
+      cache_blob_put(blob);
+      hits++;
+      continue;
+    }
+    held += now_ns() - t;
+    if (!cache_admit(trace[i].url))
+      continue;
+
+    // forward_response가 하듯 본문을 blob에 복사해 넣는다
+    memset(&meta, 0, sizeof(meta));
+    strcpy(meta.ctype, "text/html");
+    meta.expires = time(NULL) + 3600;
+    meta.size = trace[i].size;
+    blob = cache_blob_new(&meta, meta.size);
+    memcpy(blob->data + blob->hdrlen, body, meta.size);
+    copied += meta.size;
+    t = now_ns();
+    cache_insert(trace[i].url, &meta, blob);
+    held += now_ns() - t;
+    cache_blob_put(blob);
+  }
+  cache_get_stats(&st);
+  printf("%6d %8.1f%% %10lu %10lu %14.0f %12.0f\n", admit, 100.0 * hits / ntrace,
+         st.inserts, st.evictions, (double)copied / ntrace, held / ntrace);
+}
+
+int main(int argc, char **argv)
+{
+  static int admits[] = { 1, 2, 3 };
+  int opt, i;
+
+  cache_max_size = 16 * 1024 * 1024;
+  while ((opt = getopt(argc, argv, "c:")) != -1) {
+    if (opt != 'c') {
+      fprintf(stderr, "usage: %s [-c cachebytes] [tracefile]\n", argv[0]);
+      exit(1);
+    }
+    cache_max_size = atol(optarg);
+  }
+  if (optind < argc)
+    read_trace(argv[optind]);
+  else
+    make_trace();
+
+  printf("%d requests, cache %zu bytes\n", ntrace, cache_max_size);
+  printf("%6s %9s %10s %10s %14s %12s\n", "admit", "hit", "inserts", "evictions",
+         "copied B/req", "held ns/req");
+  fflush(stdout);
+  for (i = 0; i < sizeof(admits) / sizeof(admits[0]); i++) {
+    if (Fork() == 0) {                  // 조건마다 빈 캐시와 빈 필터에서 시작한다
+      cache_init();
+      replay(admits[i]);
+      exit(0);
+    }
+    Wait(NULL);
+  }
+  return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * evictbench.c - 넣는 쪽에서 내보낼 때와 회수 쓰레드가 내보낼 때의 캐시 넣기 지연 분포
+ *
+ * 쓰레드 여러 개가 가득 찬 캐시에 임의의 키로 객체를 계속 넣는다. 대부분은 작은 객체
+ * (0.5-4K)이고 일부는 큰 객체(64-100K)라, 넣는 쪽에서 내보내면 큰 객체 하나를 넣을 때마다
+ * 작은 객체 수십 개를 락을 쥔 채 지워야 한다. 슬랩을 쓰는 예산(SLAB_MIN_BUDGET 이상)에서는
+ * blob을 받을 때도 페이지를 비우느라 내보낼 수 있으므로, 넣는 요청이 치르는 cache_blob_new와
+ * cache_insert의 경과 시간을 더해 2의 거듭제곱 구간으로 모은다(본문을 채우는 시간은 뺀다).
+ * 기본 예산은 슬랩이 2MB 페이지를 쓰는 256MB이다. 넣기 사이에는 원 서버에서
+ * 받아 오는 시간 삼아 -g 마이크로초씩 쉰다(0이면 쉬지 않고 몰아 넣는다).
+ * inline은 cache_reclaim = 0, background는 회수 쓰레드를 켠 기본 설정이며 각각 자식
+ * 프로세스에서 빈 캐시로 시작한다.
+ *
+ * usage: ./evictbench [-c cachebytes] [-t threads] [-n inserts-per-thread] [-l large-percent]
+ *                    [-g gap-usecs]
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "slab.h"
+
+#define NBUCKETS 24             /* 구간 i는 [2^i, 2^(i+1)) ns, 마지막 구간은 그 이상 모두 */
+
+static int nthreads = 4, ninserts = 100000, large_pct = 10, gap_us = 20;
+
+typedef struct {
+  int id;
+  unsigned long hist[NBUCKETS];
+  double max;
+} worker_t;
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 작은 객체나 큰 객체 하나를 만들어 두고 그 키를 url에 쓴다. cache_blob_new에 걸린 시간은 *ns에 */
+static cache_blob_t *make_obj(unsigned *seed, char *url, cache_meta_t *meta, double *ns)
+{
+  cache_blob_t *blob;
+  size_t off;
+  double t;
+
+  memset(meta, 0, sizeof(*meta));
+  strcpy(meta->ctype, "application/octet-stream");
+  meta->expires = time(NULL) + 3600;
+  if (rand_r(seed) % 100 < large_pct)
+    meta->size = 64 * 1024 + rand_r(seed) % (MAX_OBJECT_SIZE - 64 * 1024 + 1);
+  else
+    meta->size = 512 + rand_r(seed) % (4096 - 512 + 1);
+  sprintf(url, "http://origin/%u", rand_r(seed));
+  t = now_ns();
+  blob = cache_blob_new(meta, meta->size);
+  *ns = now_ns() - t;
+  for (off = 0; off < meta->size; off += 4096)   // 페이지마다 한 바이트씩 써서 실제로 잡히게
+    blob->data[blob->hdrlen + off] = 'x';
+  return blob;
+}
+
+static void *worker(void *vargp)
+{
+  worker_t *w = vargp;
+  unsigned seed = 15213 + w->id;
+  char url[MAXLINE];
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  struct timespec gap = { 0, gap_us * 1000L };
+  double t, alloc;
+  int i, b;
+
+  for (i = 0; i < ninserts; i++) {
+    if (gap_us)
+      nanosleep(&gap, NULL);
+    blob = make_obj(&seed, url, &meta, &alloc);
+    t = now_ns();
+    cache_insert(url, &meta, blob);
+    t = now_ns() - t + alloc;
+    cache_blob_put(blob);
+    for (b = 0; b < NBUCKETS - 1 && t >= (double)(2UL << b); b++)
+      ;
+    w->hist[b]++;
+    if (t > w->max)
+      w->max = t;
+  }
+  return NULL;
+}
+
+/* 누적 비율이 q에 이르는 구간의 위쪽 경계(ns) */
+static double quantile(unsigned long *hist, unsigned long total, double q)
+{
+  unsigned long sum = 0;
+  int b;
+
+  for (b = 0; b < NBUCKETS - 1; b++)
+    if ((sum += hist[b]) >= q * total)
+      break;
+  return (double)(2UL << b);
+}
+
+static void run(int reclaim, int fd)
+{
+  worker_t *w = Calloc(nthreads, sizeof(worker_t));
+  pthread_t *tids = Malloc(nthreads * sizeof(pthread_t));
+  unsigned long hist[NBUCKETS] = { 0 };
+  unsigned seed = 1;
+  char url[MAXLINE];
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  cache_stats_t st;
+  double max = 0, alloc;
+  int i, b;
+
+  cache_reclaim = reclaim;
+  cache_init();
+  do {                                  // 가득 찬 상태에서 재기 시작한다
+    blob = make_obj(&seed, url, &meta, &alloc);
+    cache_insert(url, &meta, blob);
+    cache_blob_put(blob);
+    cache_get_stats(&st);
+  } while (st.evictions == 0);
+  for (i = 0; i < nthreads; i++) {
+    w[i].id = i;
+    Pthread_create(&tids[i], NULL, worker, &w[i]);
+  }
+  for (i = 0; i < nthreads; i++) {
+    Pthread_join(tids[i], NULL);
+    for (b = 0; b < NBUCKETS; b++)
+      hist[b] += w[i].hist[b];
+    if (w[i].max > max)
+      max = w[i].max;
+  }
+  cache_get_stats(&st);
+  rio_writen(fd, hist, sizeof(hist));
+  rio_writen(fd, &max, sizeof(max));
+  rio_writen(fd, &st, sizeof(st));
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long hist[2][NBUCKETS], total;
+  cache_stats_t st[2];
+  double max[2];
+  int opt, fds[2], m, b, lo, hi;
+  char *names[] = { "inline", "background" };
+
+  cache_max_size = 256 * 1024 * 1024;
+  cache_admit_hits = 1;
+  while ((opt = getopt(argc, argv, "c:t:n:l:g:")) != -1) {
+    switch (opt) {
+    case 'c':
+      cache_max_size = atol(optarg);
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'n':
+      ninserts = atoi(optarg);
+      break;
+    case 'l':
+      large_pct = atoi(optarg);
+      break;
+    case 'g':
+      gap_us = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c cachebytes] [-t threads] [-n inserts-per-thread] "
+              "[-l large-percent] [-g gap-usecs]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  for (m = 0; m < 2; m++) {
+    if (pipe(fds) < 0)
+      unix_error("pipe error");
+    if (Fork() == 0) {
+      Close(fds[0]);
+      run(m, fds[1]);
+      exit(0);
+    }
+    Close(fds[1]);
+    if (rio_readn(fds[0], hist[m], sizeof(hist[m])) != sizeof(hist[m]) ||
+        rio_readn(fds[0], &max[m], sizeof(max[m])) != sizeof(max[m]) ||
+        rio_readn(fds[0], &st[m], sizeof(st[m])) != sizeof(st[m]))
+      app_error("child failed");
+    Close(fds[0]);
+    Wait(NULL);
+  }
+
+  total = (unsigned long)nthreads * ninserts;
+  printf("cache budget %zu KB (%s), %d threads x %d inserts %d us apart, %d%% large (64-100K)\n",
+         cache_max_size >> 10, cache_max_size >= SLAB_MIN_BUDGET ? "slab" : "malloc",
+         nthreads, ninserts, gap_us, large_pct);
+  printf("%-14s %12s %12s\n", "insert ns", names[0], names[1]);
+  for (lo = 0; lo < NBUCKETS && !hist[0][lo] && !hist[1][lo]; lo++)
+    ;
+  for (hi = NBUCKETS - 1; hi > lo && !hist[0][hi] && !hist[1][hi]; hi--)
+    ;
+  for (b = lo; b <= hi; b++) {
+    char range[32];
+
+    if (b == NBUCKETS - 1)
+      sprintf(range, ">= %lu", 1UL << b);
+    else
+      sprintf(range, "< %lu", 2UL << b);
+    printf("%-14s %12lu %12lu\n", range, hist[0][b], hist[1][b]);
+  }
+  printf("%-14s %12.0f %12.0f\n", "p50 <=", quantile(hist[0], total, 0.5),
+         quantile(hist[1], total, 0.5));
+  printf("%-14s %12.0f %12.0f\n", "p99 <=", quantile(hist[0], total, 0.99),
+         quantile(hist[1], total, 0.99));
+  printf("%-14s %12.0f %12.0f\n", "p99.9 <=", quantile(hist[0], total, 0.999),
+         quantile(hist[1], total, 0.999));
+  printf("%-14s %12.0f %12.0f\n", "max", max[0], max[1]);
+  printf("%-14s %12lu %12lu\n", "evictions", st[0].evictions, st[1].evictions);
+  printf("%-14s %12lu %12lu\n", "  reclaimed", st[0].reclaimed, st[1].reclaimed);
+  printf("%-14s %12lu %12lu\n", "  inline", st[0].evictions - st[0].reclaimed,
+         st[1].evictions - st[1].reclaimed);
+  return 0;
+}
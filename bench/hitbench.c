@@ -0,0 +1,118 @@
+/*
+ * hitbench.c - 캐시 적중 한 번에 드는 CPU 시간을 잰다
+ *
+ * assemble: 예전 방식. 락을 잡고 본문을 호출자 버퍼로 복사한 뒤 메타데이터로
+ *           헤더를 sprintf로 다시 만들어 헤더와 본문을 따로 쓴다.
+ * blob:     cache_lookup으로 미리 직렬화된 blob의 참조만 받아 프록시의 send_all로 보낸다.
+ *
+ * 받는 쪽은 AF_UNIX 소켓 쌍의 반대편을 비우기만 하는 쓰레드이며, 보내는 쓰레드의
+ * CLOCK_THREAD_CPUTIME_ID로 측정하므로 받는 쪽 비용은 들어가지 않는다.
+ * (AF_UNIX는 MSG_ZEROCOPY를 지원하지 않으므로 큰 blob의 zerocopy 효과는 재지 않는다)
+ *
+ * usage: ./hitbench [iters]
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "url.h"
+#include "sendall.h"
+
+static char body[MAX_OBJECT_SIZE];
+static pthread_mutex_t old_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *drain(void *vargp)
+{
+  int fd = *(int *)vargp;
+  char buf[MAXBUF * 8];
+
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+  return NULL;
+}
+
+static double cpu_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 예전 serve_cached: 복사 + 헤더 조립 + 쓰기 두 번 */
+static void hit_assemble(int fd, cache_meta_t *stored, char *copy)
+{
+  char buf[MAXBUF];
+  cache_meta_t meta;
+  int n;
+
+  pthread_mutex_lock(&old_mutex);
+  meta = *stored;
+  memcpy(copy, body, meta.size);
+  pthread_mutex_unlock(&old_mutex);
+
+  n = cache_format_hdrs(buf, "200 OK", &meta, meta.size, meta.ctype);
+  n += sprintf(buf + n, "\r\n");
+  Rio_writen(fd, buf, n);
+  Rio_writen(fd, copy, meta.size);
+}
+
+/* 지금의 serve_cached: 참조만 받아 한 번에 */
+static void hit_blob(int fd, char *url)
+{
+  cache_meta_t meta;
+  cache_blob_t *blob;
+
+  if (!(cache_lookup(url, url_hash(url), &meta, &blob) & CACHE_FRESH) || !blob) {
+    fprintf(stderr, "hitbench: %s is not a fresh hit\n", url);
+    exit(1);
+  }
+  send_all(fd, blob->data, blob->len);
+  cache_blob_put(blob);
+}
+
+int main(int argc, char **argv)
+{
+  static size_t sizes[] = { 1024, 10240, MAX_OBJECT_SIZE };
+  int iters = (argc > 1) ? atoi(argv[1]) : 20000;
+  int sv[2], i, j;
+  char url[MAXLINE], *copy = Malloc(MAX_OBJECT_SIZE);
+  double t, t_assemble, t_blob;
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  pthread_t tid;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    unix_error("socketpair error");
+  Pthread_create(&tid, NULL, drain, &sv[1]);
+  cache_init();
+  memset(body, 'x', sizeof(body));
+
+  printf("%10s %16s %16s\n", "size", "assemble ns/hit", "blob ns/hit");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    memset(&meta, 0, sizeof(meta));
+    strcpy(meta.ctype, "text/html");
+    strcpy(meta.lastmod, "Mon, 19 Oct 2026 00:00:00 GMT");
+    strcpy(meta.etag, "\"1a2b-2800-5f3e\"");
+    meta.expires = time(NULL) + 3600;
+    meta.size = sizes[i];
+    sprintf(url, "http://localhost:15213/obj%zu", sizes[i]);
+    blob = cache_blob_new(&meta, meta.size);
+    memcpy(blob->data + blob->hdrlen, body, meta.size);
+    cache_insert(url, &meta, blob);
+    cache_blob_put(blob);
+
+    t = cpu_ns();
+    for (j = 0; j < iters; j++)
+      hit_assemble(sv[0], &meta, copy);
+    t_assemble = (cpu_ns() - t) / iters;
+
+    t = cpu_ns();
+    for (j = 0; j < iters; j++)
+      hit_blob(sv[0], url);
+    t_blob = (cpu_ns() - t) / iters;
+
+    printf("%10zu %16.0f %16.0f\n", sizes[i], t_assemble, t_blob);
+  }
+  Close(sv[0]);
+  Pthread_join(tid, NULL);
+  return 0;
+}
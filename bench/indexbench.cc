@@ -0,0 +1,141 @@
+/*
+ * indexbench.cc - 캐시의 URL 색인(hindex.c)과 std::unordered_map의 조회 속도 비교
+ *
+ * 항목 수마다 URL 키를 한 덩어리 메모리에 만들어 두고 두 표에 같은 키를 넣은 뒤, 있는
+ * 키(적중)와 없는 키(실패)를 임의 순서로 찾아 초당 조회 수를 잰다. 두 표 모두 키는
+ * 그 덩어리를 가리키고 cache.c와 같은 url_hash를 쓰므로, 차이는 표의 구조(슬롯 배열을
+ * 그룹 단위로 훑는가, 노드 체인을 따라가는가)에서만 나온다. 해시 계산도 조회 시간에 든다.
+ *
+ * usage: ./indexbench [-q lookups] [entries ...]   (기본 10000 1000000 10000000)
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+extern "C" {
+#include "hindex.h"
+#include "url.h"
+}
+
+/* 키는 모두 arena 안의 '\0'으로 끝나는 문자열이다 */
+struct key_hash {
+  size_t operator()(std::string_view s) const { return url_hash(s.data()); }
+};
+
+static int key_match(void *val, void *key)
+{
+  return !strcmp((char *)val, (char *)key);
+}
+
+static double now(void)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* n개 키를 arena에 만들고 각 키의 시작 위치를 돌려준다. miss면 표에 없는 키 */
+static std::vector<char *> make_keys(std::vector<char> &arena, size_t n, int miss)
+{
+  std::vector<char *> keys(n);
+  size_t off = 0, i;
+
+  arena.resize(n * 80);
+  for (i = 0; i < n; i++) {
+    keys[i] = &arena[off];
+    off += sprintf(keys[i], "http://origin%zu.example.com/static/%zu/obj-%08x.%s", i % 97, i / 97,
+                   (unsigned)(i * 2654435761u), miss ? "png" : "html") + 1;
+  }
+  return keys;
+}
+
+static void run(size_t n, size_t q)
+{
+  std::vector<char> arena, marena;
+  std::vector<char *> keys = make_keys(arena, n, 0), misses = make_keys(marena, n, 1);
+  std::vector<uint32_t> order(q);
+  std::mt19937 rng(15213);
+  double t, ins[2], hit[2], miss[2];
+  size_t i, found = 0;
+  hindex_t ix;
+
+  for (i = 0; i < q; i++)
+    order[i] = rng() % n;
+
+  // hindex: cache.c처럼 처음 크기에서 시작해 늘어나게 둔다
+  hindex_init(&ix, 1024);
+  t = now();
+  for (i = 0; i < n; i++)
+    hindex_insert(&ix, url_hash(keys[i]), keys[i]);
+  ins[0] = now() - t;
+  t = now();
+  for (i = 0; i < q; i++) {
+    char *k = keys[order[i]];
+    found += hindex_find(&ix, url_hash(k), key_match, k) != NULL;
+  }
+  hit[0] = now() - t;
+  t = now();
+  for (i = 0; i < q; i++) {
+    char *k = misses[order[i]];
+    found += hindex_find(&ix, url_hash(k), key_match, k) != NULL;
+  }
+  miss[0] = now() - t;
+  hindex_free(&ix);
+
+  {
+    std::unordered_map<std::string_view, void *, key_hash> map;
+
+    t = now();
+    for (i = 0; i < n; i++)
+      map.emplace(std::string_view(keys[i]), keys[i]);
+    ins[1] = now() - t;
+    t = now();
+    for (i = 0; i < q; i++)
+      found += map.find(std::string_view(keys[order[i]])) != map.end();
+    hit[1] = now() - t;
+    t = now();
+    for (i = 0; i < q; i++)
+      found += map.find(std::string_view(misses[order[i]])) != map.end();
+    miss[1] = now() - t;
+  }
+
+  if (found != 2 * q)
+    fprintf(stderr, "warning: found %zu of %zu hits\n", found, 2 * q);
+  printf("%10zu %-14s %12.0f %12.0f %12.0f\n", n, "hindex", n / ins[0], q / hit[0], q / miss[0]);
+  printf("%10zu %-14s %12.0f %12.0f %12.0f\n", n, "unordered_map", n / ins[1], q / hit[1],
+         q / miss[1]);
+  printf("%10s %-14s %12.2f %12.2f %12.2f\n", "", "speedup", ins[1] / ins[0], hit[1] / hit[0],
+         miss[1] / miss[0]);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  size_t q = 4000000, sizes[] = { 10000, 1000000, 10000000 };
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "q:")) != -1) {
+    switch (opt) {
+    case 'q':
+      q = atol(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-q lookups] [entries ...]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  printf("%zu lookups per run (ops/sec)\n", q);
+  printf("%10s %-14s %12s %12s %12s\n", "entries", "table", "insert", "hit", "miss");
+  if (optind < argc)
+    for (i = optind; i < argc; i++)
+      run(atol(argv[i]), q);
+  else
+    for (i = 0; i < 3; i++)
+      run(sizes[i], q);
+  return 0;
+}
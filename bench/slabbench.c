@@ -0,0 +1,109 @@
+/*
+ * slabbench.c - 본문 크기 분포가 바뀌어 가는 동안 캐시 예산과 실제 RSS를 비교한다
+ *
+ * 크기 분포가 다른 단계를 차례로 돌리며 임의의 키로 객체를 넣어 캐시를 계속 갈아엎는다.
+ * 단계가 끝날 때마다 캐시가 센 사용량, 할당기가 잡은 메모리, 프로세스 RSS(시작할 때의
+ * RSS를 뺀 값)를 보여 준다. malloc은 blob을 Malloc/Free로, slab은 slab.c로 할당하며
+ * 각각 자식 프로세스에서 빈 캐시로 시작한다.
+ *
+ * usage: ./slabbench [-c cachebytes] [-n inserts-per-phase] [-H]
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "slab.h"
+
+static struct {
+  char *name;
+  size_t lo, hi;                /* 본문 크기 범위 */
+} phases[] = {
+  { "small 0.5-4K", 512, 4096 },
+  { "large 40-100K", 40 * 1024, MAX_OBJECT_SIZE },
+  { "medium 4-16K", 4096, 16384 },
+  { "mixed 64B-100K", 64, MAX_OBJECT_SIZE },
+};
+
+static size_t rss(void)
+{
+  FILE *fp = fopen("/proc/self/statm", "r");
+  unsigned long size, resident = 0;
+
+  if (fp) {
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+      resident = 0;
+    fclose(fp);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void run(int use_slab, int n)
+{
+  size_t base = rss(), off;
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  cache_stats_t cst;
+  slab_stats_t sst;
+  char url[MAXLINE];
+  int p, i;
+
+  slab_enabled = use_slab;
+  cache_init();
+  srand(15213);
+  for (p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+    for (i = 0; i < n; i++) {
+      memset(&meta, 0, sizeof(meta));
+      strcpy(meta.ctype, "application/octet-stream");
+      meta.expires = time(NULL) + 3600;
+      meta.size = phases[p].lo + rand() % (phases[p].hi - phases[p].lo + 1);
+      sprintf(url, "http://origin/%d/%d", p, rand() % 50000);
+      blob = cache_blob_new(&meta, meta.size);
+      for (off = 0; off < meta.size; off += 4096)   // 페이지마다 한 바이트씩 써서 실제로 잡히게
+        blob->data[blob->hdrlen + off] = 'x';
+      cache_insert(url, &meta, blob);
+      cache_blob_put(blob);
+    }
+    cache_get_stats(&cst);
+    slab_get_stats(&sst);
+    printf("%-7s %-15s %10zu %10zu %10zu %7.2f\n", use_slab ? "slab" : "malloc", phases[p].name,
+           cst.size >> 10, sst.mapped >> 10, (rss() - base) >> 10,
+           (double)(rss() - base) / cache_max_size);
+  }
+  if (use_slab)
+    printf("%-7s %lu pages moved between size classes\n", "slab", sst.moves);
+}
+
+int main(int argc, char **argv)
+{
+  int opt, n = 200000, use_slab;
+
+  cache_max_size = 256 * 1024 * 1024;
+  cache_admit_hits = 1;
+  while ((opt = getopt(argc, argv, "c:n:H")) != -1) {
+    switch (opt) {
+    case 'c':
+      cache_max_size = atol(optarg);
+      break;
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'H':
+      slab_hugepages = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c cachebytes] [-n inserts-per-phase] [-H]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  printf("cache budget %zu KB, %d inserts per phase\n", cache_max_size >> 10, n);
+  printf("%-7s %-15s %10s %10s %10s %7s\n", "alloc", "phase", "cache KB", "alloc KB",
+         "RSS KB", "RSS/bud");
+  fflush(stdout);
+  for (use_slab = 0; use_slab <= 1; use_slab++) {
+    if (Fork() == 0) {
+      run(use_slab, n);
+      exit(0);
+    }
+    Wait(NULL);
+  }
+  return 0;
+}
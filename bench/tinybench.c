@@ -0,0 +1,172 @@
+/*
+ * tinybench.c - 실행 중인 웹 서버(tiny나 proxy)에 요청을 몰아 초당 처리 수를 잰다
+ *
+ * -c개의 쓰레드가 각자 연결을 맺고 GET을 보내 응답을 끝까지 읽는 일을 -d초 동안 되풀이한다.
+ * 기본은 요청마다 새 연결을 맺으므로(HTTP/1.0) 연결 설정 비용까지 들어간다. -k를 주면
+ * HTTP/1.1로 연결 하나에 요청을 이어 보내고, 응답은 Content-length만큼 읽는다. 서버가
+ * 연결을 닫으면 새로 맺는다. 상태 코드가 200이 아니거나 응답이 중간에 끊긴 요청은 실패로
+ * 센다. 평균 지연은 요청을 보내기(필요하면 연결하기) 시작해 응답을 다 읽을 때까지의
+ * 시간이다. path가 절대 URL이면 프록시에 보내는 요청이 된다.
+ *
+ * usage: ./tinybench [-c clients] [-d secs] [-k] <host> <port> <path>
+ */
+#include "csapp.h"
+
+static char *host, *port, *path;
+static int duration = 5, keepalive;
+static volatile int stop;
+
+typedef struct {
+  long ok, failed;
+  double busy;                  /* 성공한 요청에 걸린 시간의 합(초) */
+} client_t;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 요청 하나를 보내고 응답을 끝까지 읽는다. 200이면 1 */
+static int request(char *req, int reqlen)
+{
+  char buf[MAXBUF];
+  int fd, status = 0;
+  ssize_t n, total = 0;
+
+  if ((fd = open_clientfd(host, port)) < 0)
+    return 0;
+  if (rio_writen(fd, req, reqlen) != reqlen) {
+    close(fd);
+    return 0;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    if (!total && sscanf(buf, "HTTP/%*s %d", &status) != 1)
+      status = 0;
+    total += n;
+  }
+  close(fd);
+  return n == 0 && status == 200;
+}
+
+/*
+ * 유지한 연결 *fdp로 요청 하나를 보내고 Content-length만큼 응답을 읽는다. 200이면 1.
+ * 연결이 없으면 새로 맺고, 서버가 닫겠다고 했거나 실패하면 닫아 둔다.
+ */
+static int request_keepalive(int *fdp, rio_t *rp, char *req, int reqlen)
+{
+  char buf[MAXBUF];
+  int status = 0, close_after = 0;
+  long len = -1, n;
+
+  if (*fdp < 0) {
+    if ((*fdp = open_clientfd(host, port)) < 0)
+      return 0;
+    rio_readinitb(rp, *fdp);
+  }
+  if (rio_writen(*fdp, req, reqlen) != reqlen ||
+      rio_readlineb(rp, buf, sizeof(buf)) <= 0 || sscanf(buf, "HTTP/%*s %d", &status) != 1)
+    goto fail;
+  while (rio_readlineb(rp, buf, sizeof(buf)) > 0 && strcmp(buf, "\r\n")) {
+    if (!strncasecmp(buf, "Content-length:", 15))
+      len = atol(buf + 15);
+    else if (!strncasecmp(buf, "Connection:", 11) && strstr(buf, "close"))
+      close_after = 1;
+  }
+  if (len < 0)                          // 길이를 모르면 닫힐 때까지가 본문
+    close_after = 1;
+  while (len != 0 && (n = rio_readnb(rp, buf, len > 0 && len < MAXBUF ? len : MAXBUF)) > 0)
+    len -= (len > 0) ? n : 0;
+  if (len > 0)
+    goto fail;
+  if (close_after) {
+    close(*fdp);
+    *fdp = -1;
+  }
+  return status == 200;
+
+ fail:
+  close(*fdp);
+  *fdp = -1;
+  return 0;
+}
+
+static void *client(void *vargp)
+{
+  client_t *c = vargp;
+  char req[MAXLINE];
+  int len, fd = -1, ok;
+  rio_t rio;
+  double t;
+
+  len = snprintf(req, sizeof(req), "GET %s HTTP/1.%d\r\nHost: %s:%s\r\n\r\n", path, keepalive,
+                 host, port);
+  while (!stop) {
+    t = now();
+    ok = keepalive ? request_keepalive(&fd, &rio, req, len) : request(req, len);
+    if (ok) {
+      c->ok++;
+      c->busy += now() - t;
+    }
+    else
+      c->failed++;
+  }
+  if (fd >= 0)
+    close(fd);
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int opt, nclients = 4, i;
+  long ok = 0, failed = 0;
+  double busy = 0, t;
+  client_t *c;
+  pthread_t *tids;
+
+  while ((opt = getopt(argc, argv, "c:d:k")) != -1) {
+    switch (opt) {
+    case 'c':
+      nclients = atoi(optarg);
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'k':
+      keepalive = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c clients] [-d secs] [-k] <host> <port> <path>\n", argv[0]);
+      exit(1);
+    }
+  }
+  if (optind != argc - 3) {
+    fprintf(stderr, "usage: %s [-c clients] [-d secs] [-k] <host> <port> <path>\n", argv[0]);
+    exit(1);
+  }
+  host = argv[optind];
+  port = argv[optind + 1];
+  path = argv[optind + 2];
+
+  Signal(SIGPIPE, SIG_IGN);
+  c = Calloc(nclients, sizeof(client_t));
+  tids = Malloc(nclients * sizeof(pthread_t));
+  t = now();
+  for (i = 0; i < nclients; i++)
+    Pthread_create(&tids[i], NULL, client, &c[i]);
+  Sleep(duration);
+  stop = 1;
+  for (i = 0; i < nclients; i++) {
+    Pthread_join(tids[i], NULL);
+    ok += c[i].ok;
+    failed += c[i].failed;
+    busy += c[i].busy;
+  }
+  t = now() - t;
+
+  printf("%s %d clients%s, %.1f s: %ld ok, %ld failed, %.0f req/s, %.1f us avg\n", path, nclients,
+         keepalive ? " (keep-alive)" : "", t, ok, failed, ok / t, ok ? busy / ok * 1e6 : 0);
+  return 0;
+}
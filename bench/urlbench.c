@@ -0,0 +1,113 @@
+/*
+ * urlbench.c - 캐시 키를 만드는 데 드는 시간과 URL 정규화로 합쳐지는 키 수를 잰다
+ *
+ * 자원 몇 개를 여러 가지 같은 뜻의 철자(호스트 대소문자, :80, %7e, ./ 등)로 섞어 요청
+ * 목록을 만들고, URL 하나당 다음 시간을 보여 준다.
+ *   fnv:         예전 캐시의 FNV-1a 해시 (바이트마다 곱셈)
+ *   url_hash:    지금 캐시의 해시 (8바이트마다 섞는다)
+ *   canon+fnv:   정규화한 뒤 따로 FNV-1a로 해시 (두 번 훑는다)
+ *   canon:       url_canon (정규화하며 같은 순회에서 해시)
+ * 마지막 줄은 날 URL을 키로 쓸 때와 정규화한 URL을 키로 쓸 때의 서로 다른 키 수다.
+ *
+ * usage: ./urlbench [-n urls] [-r resources]
+ */
+#include "csapp.h"
+#include "url.h"
+
+static uint64_t fnv(const char *s)
+{
+  uint64_t h = 14695981039346656037ULL;
+
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmpstr(const void *a, const void *b)
+{
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+/* keys를 정렬해 서로 다른 문자열 수를 센다 */
+static int distinct(char **keys, int n)
+{
+  int i, d = 1;
+
+  qsort(keys, n, sizeof(char *), cmpstr);
+  for (i = 1; i < n; i++)
+    d += strcmp(keys[i - 1], keys[i]) != 0;
+  return d;
+}
+
+int main(int argc, char **argv)
+{
+  static char *hosts[] = { "localhost", "Localhost", "LOCALHOST", "localhost:80" };
+  static char *dirs[] = { "/static/", "/static/./", "/x/../static/", "/%73tatic/" };
+  int opt, n = 1000000, nres = 1000, i, r;
+  char **urls, **canon, **sorted, buf[MAXLINE];
+  volatile uint64_t sink = 0;
+  double t;
+
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'r':
+      nres = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n urls] [-r resources]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  urls = Malloc(n * sizeof(char *));
+  canon = Malloc(n * sizeof(char *));
+  sorted = Malloc(n * sizeof(char *));
+  srand(15213);
+  for (i = 0; i < n; i++) {
+    r = rand() % nres;
+    sprintf(buf, "http://%s%simages/%s%d.png?v=%d", hosts[rand() % 4], dirs[rand() % 4],
+            rand() % 2 ? "~" : "%7e", r, r % 7);
+    urls[i] = Malloc(strlen(buf) + 1);
+    canon[i] = Malloc(strlen(buf) + 2);
+    strcpy(urls[i], buf);
+  }
+
+  printf("%d urls, %d resources (ns/url)\n", n, nres);
+  t = now_ns();
+  for (i = 0; i < n; i++)
+    sink += fnv(urls[i]);
+  printf("%-12s %8.1f\n", "fnv", (now_ns() - t) / n);
+  t = now_ns();
+  for (i = 0; i < n; i++)
+    sink += url_hash(urls[i]);
+  printf("%-12s %8.1f\n", "url_hash", (now_ns() - t) / n);
+  t = now_ns();
+  for (i = 0; i < n; i++) {
+    url_canon(urls[i], canon[i]);
+    sink += fnv(canon[i]);
+  }
+  printf("%-12s %8.1f\n", "canon+fnv", (now_ns() - t) / n);
+  t = now_ns();
+  for (i = 0; i < n; i++)
+    sink += url_canon(urls[i], canon[i]);
+  printf("%-12s %8.1f\n", "canon", (now_ns() - t) / n);
+
+  memcpy(sorted, urls, n * sizeof(char *));
+  printf("distinct keys: raw %d, canonical ", distinct(sorted, n));
+  memcpy(sorted, canon, n * sizeof(char *));
+  printf("%d\n", distinct(sorted, n));
+  return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * zipbench.c - 텍스트 객체를 압축해 저장할 때 얻는 용량과 적중마다 드는 CPU를 잰다
+ *
+ * 파일마다 같은 본문을 평문(-z 없음)과 압축(-z) 두 가지로 캐시에 넣고 다음을 보여 준다.
+ *   stored:   캐시가 차지하는 blob 크기 (헤더 포함) - 평문 / 압축
+ *   insert:   cache_insert 한 번의 CPU 시간 (압축 쪽은 deflate 포함, 객체마다 한 번)
+ *   plain:    평문 객체 적중: 조회 + write 한 번
+ *   gzip:     압축 객체를 gzip을 받는 클라이언트에 보내는 적중 (보내는 양이 줄어든다)
+ *   identity: 압축 객체를 gzip을 못 받는 클라이언트에 풀어서 보내는 적중 (inflate 비용)
+ * 마지막 줄의 비율이 같은 예산에 들어가는 객체 수가 몇 배로 느는지다.
+ *
+ * 시간은 hitbench처럼 보내는 쓰레드의 CLOCK_THREAD_CPUTIME_ID로 잰다.
+ *
+ * usage: ./zipbench [-i iters] [file ...]
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "url.h"
+
+static char *default_files[] = {
+  "../tiny/home.html", "../tiny/tiny.c", "../csapp.c", "../csapp.h",
+  "../proxy.c", "../cache.c", "../README",
+};
+
+static void *drain(void *vargp)
+{
+  int fd = *(int *)vargp;
+  char buf[MAXBUF * 8];
+
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+  return NULL;
+}
+
+static double cpu_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 확장자로 content type을 정한다 (tiny의 get_filetype처럼, 그 밖은 text/plain) */
+static char *ctype_of(char *file)
+{
+  if (strstr(file, ".html"))
+    return "text/html";
+  if (strstr(file, ".css"))
+    return "text/css";
+  if (strstr(file, ".js"))
+    return "application/javascript";
+  return "text/plain";
+}
+
+/* 파일을 읽어 평문 blob을 만든다. MAX_OBJECT_SIZE를 넘는 부분은 자른다 */
+static cache_blob_t *load(char *file, cache_meta_t *meta)
+{
+  cache_blob_t *blob;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    return NULL;
+  memset(meta, 0, sizeof(*meta));
+  strcpy(meta->ctype, ctype_of(file));
+  strcpy(meta->lastmod, "Mon, 19 Oct 2026 00:00:00 GMT");
+  meta->expires = time(NULL) + 3600;
+  meta->size = st.st_size < MAX_OBJECT_SIZE ? st.st_size : MAX_OBJECT_SIZE;
+  blob = cache_blob_new(meta, meta->size);
+  if (rio_readn(fd, blob->data + blob->hdrlen, meta->size) != meta->size) {
+    cache_blob_put(blob);
+    blob = NULL;
+  }
+  close(fd);
+  return blob;
+}
+
+/* 적중 한 번: 조회해서 (필요하면 풀어서) 보낸다 */
+static void hit(int fd, char *url, int gzip_ok)
+{
+  cache_meta_t meta;
+  cache_blob_t *blob, *plain;
+
+  cache_lookup(url, url_hash(url), &meta, &blob);
+  if (meta.zlen && !gzip_ok) {
+    plain = cache_decode(&meta, blob);
+    cache_blob_put(blob);
+    blob = plain;
+  }
+  Rio_writen(fd, blob->data, blob->len);
+  cache_blob_put(blob);
+}
+
+static double time_hits(int fd, char *url, int gzip_ok, int iters)
+{
+  double t = cpu_ns();
+  int i;
+
+  for (i = 0; i < iters; i++)
+    hit(fd, url, gzip_ok);
+  return (cpu_ns() - t) / iters;
+}
+
+/* 지금 캐시에 든 url의 blob 크기 */
+static size_t stored(char *url)
+{
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  size_t len;
+
+  cache_lookup(url, url_hash(url), &meta, &blob);
+  len = blob->len;
+  cache_blob_put(blob);
+  return len;
+}
+
+int main(int argc, char **argv)
+{
+  char **files = default_files, purl[MAXLINE], zurl[MAXLINE], *name;
+  int nfiles = sizeof(default_files) / sizeof(default_files[0]);
+  int iters = 5000, sv[2], i, opt;
+  size_t plen, zlen, ptotal = 0, ztotal = 0;
+  double t, t_pins, t_zins;
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  pthread_t tid;
+
+  while ((opt = getopt(argc, argv, "i:")) != -1) {
+    if (opt != 'i') {
+      fprintf(stderr, "usage: %s [-i iters] [file ...]\n", argv[0]);
+      exit(1);
+    }
+    iters = atoi(optarg);
+  }
+  if (optind < argc) {
+    files = argv + optind;
+    nfiles = argc - optind;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    unix_error("socketpair error");
+  Pthread_create(&tid, NULL, drain, &sv[1]);
+  cache_max_size = 64 * 1024 * 1024;    // 예산 때문에 내보내지 않게 넉넉히
+  cache_init();
+
+  printf("%-12s %8s %8s %8s %10s %10s %10s %10s %10s\n", "file", "size", "stored", "zstored",
+         "insert ns", "zinsert ns", "plain ns", "gzip ns", "ident ns");
+  for (i = 0; i < nfiles; i++) {
+    if (!(blob = load(files[i], &meta))) {
+      fprintf(stderr, "%s: can't read\n", files[i]);
+      continue;
+    }
+    name = strrchr(files[i], '/') ? strrchr(files[i], '/') + 1 : files[i];
+    sprintf(purl, "http://localhost:15213/plain/%d", i);
+    sprintf(zurl, "http://localhost:15213/zip/%d", i);
+
+    cache_compress = 0;
+    t = cpu_ns();
+    cache_insert(purl, &meta, blob);
+    t_pins = cpu_ns() - t;
+    cache_compress = 1;
+    t = cpu_ns();
+    cache_insert(zurl, &meta, blob);
+    t_zins = cpu_ns() - t;
+    cache_blob_put(blob);
+
+    plen = stored(purl);
+    zlen = stored(zurl);
+    ptotal += plen;
+    ztotal += zlen;
+    printf("%-12.12s %8zu %8zu %8zu %10.0f %10.0f %10.0f %10.0f %10.0f\n", name, meta.size,
+           plen, zlen, t_pins, t_zins, time_hits(sv[0], purl, 1, iters),
+           time_hits(sv[0], zurl, 1, iters), time_hits(sv[0], zurl, 0, iters));
+  }
+  if (ztotal)
+    printf("total stored %zu -> %zu bytes: %.2fx objects per cache budget\n",
+           ptotal, ztotal, (double)ptotal / ztotal);
+  Close(sv[0]);
+  Pthread_join(tid, NULL);
+  return 0;
+}
@@ -0,0 +1,1046 @@
+/*
+ * cache.c - URL을 키로 하는 LRU 웹 객체 캐시
+ *
+ * URL은 열린 주소법 해시 색인(hindex.c)으로 찾고, 본문은 세그먼트 단위로 저장한다. 작은 객체는
+ * 세그먼트 하나, MAX_OBJECT_SIZE보다 큰 객체는 CACHE_SEGMENT_SIZE 조각 여러 개로
+ * 나뉘며, 이중 연결 리스트로 세그먼트의 LRU 순서를 관리해 조각마다 따로 내보낸다.
+ * 세그먼트가 모두 빠진 객체는 색인에서도 지운다.
+ *
+ * 세그먼트 데이터는 참조 횟수를 가진 blob이다. 작은 객체의 blob에는 200 응답 헤더까지
+ * 미리 직렬화해 두어 적중 시 헤더를 다시 만들지 않고 통째로 보낸다. 모든 연산은 하나의
+ * 뮤텍스 아래에서 수행되지만, 조회는 본문을 복사하지 않고 blob의 참조만 넘겨주므로
+ * 락을 잡는 시간은 본문 크기와 무관하다.
+ *
+ * 공유 메모리 캐시(shmcache.c)가 켜져 있으면 작은 객체는 그쪽에도 넣고, 여기서 못 찾은
+ * 객체는 그쪽에서 찾아 이 프로세스의 캐시로 가져온다.
+ *
+ * 새 객체는 입장 필터를 거친다. 요청 횟수를 count-min sketch로 세고 CACHE_ADMIT_WINDOW번
+ * 기록할 때마다 모든 계수를 반으로 줄여, 최근에 여러 번 요청된 객체만 캐시에 들인다.
+ *
+ * blob은 slab.c의 크기 등급 조각에 담긴다. 예산(cache_size)은 본문 길이가 아니라 조각
+ * 크기에 세그먼트와 객체 구조체를 더한 실제 사용량으로 센다. 할당기가 잡은 페이지와 힙에
+ * 둔 구조체를 합쳐도 예산을 넘지 않게, 새 페이지가 있어야 하는 할당은 먼저 세그먼트를
+ * 내보내 자리를 만든다. 보통은 같은 등급의 LRU 끝을 내보내 그 조각을 바로 다시 쓴다. 그
+ * 등급의 가장 오래된 세그먼트가 전체 LRU 끝보다 훨씬 젊다면 그 등급에 메모리가 모자란
+ * 것이므로, 전체 LRU 끝이 든 페이지 하나를 골라 거기 든 세그먼트만 내보내 그 페이지를
+ * 모자란 등급으로 옮긴다(memcached의 slab_reassign과 같은 재배치). 할당 하나가 하는 일은
+ * CACHE_EVICT_PAGES 페이지를 넘지 않고, 그래도 자리가 안 나면 예산을 넘겨 받은 뒤 회수
+ * 쓰레드가 되돌린다.
+ *
+ * 예산 안으로 되돌리는 일은 회수 쓰레드가 맡는다. 사용량이 CACHE_EVICT_HIGH%를 넘으면
+ * 깨어나 CACHE_EVICT_LOW%까지 LRU 끝에서 내보내며, CACHE_EVICT_BATCH개마다 락을 놓고
+ * 그동안 내보낸 blob을 돌려준다. 그래서 큰 객체를 넣는 요청이 작은 객체 수십 개를 락을
+ * 쥔 채 지우느라 모두를 붙잡아 두는 일이 없다. 넣는 쪽은 회수가 못 따라와 예산 자체를
+ * 넘겼을 때만 직접 내보낸다.
+ *
+ * 원 서버에서 받아 오는 중인 키는 fetching 목록에 올라, 같은 키를 찾다 놓친 요청들이
+ * 원 서버로 몰려가지 않고 첫 요청의 응답이 캐시에 들어오기를 기다릴 수 있다.
+ *
+ * 운영자는 객체를 바로 지우거나(cache_purge) 키의 모양으로 금지할 수 있다(cache_ban).
+ * 금지는 세대 번호를 붙여 목록에 올려 둘 뿐이고, 객체를 찾을 때 그 객체가 마지막으로
+ * 확인한 세대보다 새 금지에만 비춰 보아 걸리면 그때 지운다. 캐시 전체를 훑는 일은 없다.
+ * 공유 메모리 캐시를 함께 쓰는 프로세스끼리는 지우기와 금지를 그 영역으로 알리고, 조회할
+ * 때 다른 프로세스가 알린 것을 자기 금지 목록에 들인다.
+ *
+ * -z를 주면 텍스트 객체는 gzip으로 압축해 저장한다. 압축된 blob의 헤더에는
+ * Content-Encoding: gzip이 들어 있어 gzip을 받는 클라이언트에게는 그대로 보내고,
+ * 나머지 클라이언트에게는 호출자가 cache_decode로 풀어 보낸다. 같은 예산에 더 많은
+ * 객체가 들어가는 대신 gzip을 못 받는 클라이언트의 적중마다 inflate 비용이 든다.
+ */
+#include <zlib.h>
+#include "cache.h"
+#include "hindex.h"
+#include "url.h"
+#include "shmcache.h"
+#include "slab.h"
+
+int cache_default_ttl = CACHE_DEFAULT_TTL;
+int cache_swr = 0;
+int cache_prefetch = 0;
+size_t cache_max_size = MAX_CACHE_SIZE;
+int cache_admit_hits = CACHE_ADMIT_HITS;
+int cache_compress = 0;
+int cache_reclaim = 1;
+
+static hindex_t url_index;              /* url 해시 -> cache_obj_t */
+static cache_seg_t *lru_head, *lru_tail;
+static cache_seg_t *cls_head[SLAB_MAX_CLASSES], *cls_tail[SLAB_MAX_CLASSES]; /* 등급별 LRU */
+static unsigned long lru_clock;         /* lru_push마다 1씩 는다 */
+static size_t cache_size;               /* 캐시가 차지한 메모리 (seg_cost, obj_cost의 합) */
+static size_t meta_size;                /* 그중 힙에 둔 세그먼트와 객체 구조체 */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_stats_t stats;             /* cache_mutex가 보호 (rejects는 admit_mutex) */
+
+static cache_fetch_t *fetching;         /* 받아 오는 중인 키 (cache_mutex가 보호) */
+static cache_ban_t *ban_newest, *ban_oldest; /* 금지 목록 (cache_mutex가 보호) */
+static unsigned long ban_gen;           /* 가장 새 금지의 세대 */
+static unsigned long ban_base;          /* 가장 오래된 금지보다 앞선 세대로 확인된 객체 수 */
+static pthread_cond_t fetch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t reclaim_cond = PTHREAD_COND_INITIALIZER;
+static int reclaim_started;
+
+static uint8_t sketch[CACHE_SKETCH_ROWS][CACHE_SKETCH_WIDTH];
+static unsigned sketch_adds;            /* 마지막으로 계수를 줄인 뒤 기록한 횟수 */
+static pthread_mutex_t admit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int url_match(void *obj, void *url)
+{
+  return !strcmp(((cache_obj_t *)obj)->url, url);
+}
+
+static void remove_obj(cache_obj_t *obj);
+static void ban_sync(void);
+
+/* gen 세대로 확인된 객체 수의 계수기 */
+static unsigned long *gen_count(unsigned long gen)
+{
+  cache_ban_t *b;
+
+  for (b = ban_newest; b && b->gen > gen; b = b->older)
+    ;
+  return (b && b->gen == gen) ? &b->nobjs : &ban_base;
+}
+
+/* 어느 객체도 더 비춰 볼 일이 없는 가장 오래된 금지들을 떼어 낸다 */
+static void ban_prune(void)
+{
+  cache_ban_t *b;
+
+  while ((b = ban_oldest) && !ban_base) {
+    ban_base = b->nobjs;                // 이 세대의 객체는 이제 남은 모든 금지보다 앞선다
+    if ((ban_oldest = b->newer))
+      ban_oldest->older = NULL;
+    else
+      ban_newest = NULL;
+    if (b->type == CACHE_BAN_REGEX)
+      regfree(&b->re);
+    Free(b->pattern);
+    Free(b);
+  }
+}
+
+static void set_gen(cache_obj_t *obj, unsigned long gen)
+{
+  (*gen_count(obj->gen))--;
+  obj->gen = gen;
+  (*gen_count(gen))++;
+  ban_prune();
+}
+
+static int ban_match(cache_ban_t *b, char *key)
+{
+  char url[MAXLINE], *p, *end, *at, *colon, *bracket;
+  size_t n = strcspn(key, "\n"), len;  // 변형 키면 '\n' 앞의 URL 부분만
+
+  switch (b->type) {
+  case CACHE_BAN_EXACT:
+    return !strcmp(key, b->pattern);
+  case CACHE_BAN_PREFIX:
+    return !strncmp(key, b->pattern, strlen(b->pattern));
+  case CACHE_BAN_REGEX:
+    if (n >= MAXLINE)
+      n = MAXLINE - 1;
+    memcpy(url, key, n);
+    url[n] = '\0';
+    return !regexec(&b->re, url, 0, NULL, 0);
+  default:
+    if (!(p = strstr(key, "://")) || p > key + n)
+      return 0;
+    p += 3;
+    end = p + strcspn(p, "/?\n");
+    if ((at = memchr(p, '@', end - p)))
+      p = at + 1;
+    len = strlen(b->pattern);
+    if (end - p < len || strncmp(p, b->pattern, len))
+      return 0;
+    colon = strrchr(b->pattern, ':');
+    bracket = strrchr(b->pattern, ']');
+    return p + len == end ||            // 포트 없는 pattern은 그 호스트의 모든 포트
+      (p[len] == ':' && !(colon && (!bracket || colon > bracket)));
+  }
+}
+
+/* 객체가 마지막으로 확인한 세대 뒤에 생긴 금지들에 비춰 본다. 걸려서 지웠으면 1 */
+static int ban_check(cache_obj_t *obj)
+{
+  cache_ban_t *b;
+
+  for (b = ban_newest; b && b->gen > obj->gen; b = b->older)
+    if (ban_match(b, obj->url)) {
+      remove_obj(obj);
+      stats.banned++;
+      return 1;
+    }
+  set_gen(obj, ban_gen);
+  return 0;
+}
+
+static cache_obj_t *find(char *url, uint64_t hash)
+{
+  cache_obj_t *obj = hindex_find(&url_index, hash, url_match, url);
+
+  if (obj && obj->gen != ban_gen && ban_check(obj))
+    return NULL;
+  return obj;
+}
+
+/* 같은 응답 본문인지: 크기와 검증자가 모두 같아야 세그먼트를 섞어 쓸 수 있다 */
+static int same_version(cache_meta_t *a, cache_meta_t *b)
+{
+  return a->size == b->size && !strcmp(a->etag, b->etag) && !strcmp(a->lastmod, b->lastmod);
+}
+
+int cache_format_hdrs(char *buf, char *status, cache_meta_t *meta, size_t clen, char *ctype)
+{
+  int n;
+
+  n = sprintf(buf, "HTTP/1.0 %s\r\n", status);
+  n += sprintf(buf + n, "Connection: close\r\n");
+  n += sprintf(buf + n, "Accept-Ranges: bytes\r\n");
+  n += sprintf(buf + n, "Content-length: %zu\r\n", clen);
+  n += sprintf(buf + n, "Content-type: %s\r\n", ctype);
+  if (meta->lastmod[0])
+    n += sprintf(buf + n, "Last-Modified: %s\r\n", meta->lastmod);
+  if (meta->etag[0])
+    n += sprintf(buf + n, "ETag: %s\r\n", meta->etag);
+  return n;
+}
+
+static void remove_seg(cache_seg_t *seg);
+
+/* 슬랩이 잡을 수 있는 메모리: 예산에서 힙에 둔 구조체를 뺀다 */
+static size_t slab_limit(void)
+{
+  size_t meta = __atomic_load_n(&meta_size, __ATOMIC_RELAXED);
+
+  return meta < cache_max_size ? cache_max_size - meta : 1;
+}
+
+/* seg의 blob이 든 슬랩 페이지의 세그먼트 목록 */
+static cache_seg_t **page_segs(cache_seg_t *seg)
+{
+  return (cache_seg_t **)slab_page_slot(seg->blob);
+}
+
+/*
+ * 슬랩에서 size 바이트 조각을 받는다. 예산만큼 페이지를 다 잡아 새 페이지를 못 받으면
+ * 같은 등급의 가장 오래된 세그먼트 하나를, 또는 전체 LRU 끝이 든 다른 등급의 페이지
+ * 하나를 비우고 다시 해 본다. CACHE_EVICT_PAGES번 해도 안 되거나, 내보낼 것이 없거나,
+ * 호출자가 이미 cache_mutex를 쥐고 있으면(locked) 예산을 넘겨서라도 준다.
+ */
+static void *blob_alloc(size_t size, size_t *cap, int locked)
+{
+  cache_seg_t *victim, **segs;
+  cache_blob_t *pin;
+  void *p = NULL;
+  int cls = slab_class(size), tries = 0;
+
+  while (!locked && tries++ < CACHE_EVICT_PAGES && !(p = slab_alloc(size, cap, slab_limit()))) {
+    pin = NULL;
+    pthread_mutex_lock(&cache_mutex);
+    // 같은 등급의 끝이 전체 끝의 절반 이상 묵었으면 그것을, 아니면 전체 끝을 내보낸다
+    if ((victim = lru_tail) && cls >= 0 && cls_tail[cls] &&
+        lru_clock - cls_tail[cls]->stamp >= (lru_clock - lru_tail->stamp) / 2)
+      victim = cls_tail[cls];
+    if (victim && (victim->cls == cls || victim->cls < 0)) {
+      remove_seg(victim);               // 같은 등급이면 돌아온 조각을 바로 다시 쓴다
+      stats.evictions++;
+    }
+    else if (victim) {
+      // 페이지의 마지막 조각이 풀리며 페이지가 돌려지지 않게 하나를 쥔 채 비운다
+      pin = victim->blob;
+      cache_blob_get(pin);
+      segs = page_segs(victim);
+      while (*segs) {
+        remove_seg(*segs);
+        stats.evictions++;
+      }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (pin)
+      cache_blob_put(pin);
+    if (!victim)
+      break;
+  }
+  return p ? p : slab_alloc(size, cap, 0);
+}
+
+static cache_blob_t *blob_new(cache_meta_t *meta, size_t bodylen, int locked)
+{
+  char hdrs[MAXBUF];
+  cache_blob_t *blob;
+  size_t cap;
+  int n = 0;
+
+  if (meta) {
+    n = cache_format_hdrs(hdrs, "200 OK", meta, meta->zlen ? meta->zlen : meta->size, meta->ctype);
+    if (meta->zlen)
+      n += sprintf(hdrs + n, "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+    n += sprintf(hdrs + n, "\r\n");
+  }
+  blob = blob_alloc(sizeof(cache_blob_t) + n + bodylen, &cap, locked);
+  blob->cap = cap;
+  blob->refcnt = 1;
+  blob->len = n + bodylen;
+  blob->hdrlen = n;
+  blob->idx = 0;
+  memcpy(blob->data, hdrs, n);
+  return blob;
+}
+
+cache_blob_t *cache_blob_new(cache_meta_t *meta, size_t bodylen)
+{
+  return blob_new(meta, bodylen, 0);
+}
+
+void cache_blob_get(cache_blob_t *blob)
+{
+  __atomic_add_fetch(&blob->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+void cache_blob_put(cache_blob_t *blob)
+{
+  if (__atomic_sub_fetch(&blob->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+    slab_free(blob, blob->cap);
+}
+
+#define SEG_META (sizeof(cache_seg_t) + CACHE_MALLOC_OVERHEAD)
+
+/* 세그먼트 하나가 차지하는 메모리: blob 조각과 세그먼트 구조체 */
+static size_t seg_cost(cache_seg_t *seg)
+{
+  return seg->blob->cap + SEG_META;
+}
+
+/* 객체가 힙에 둔 메모리: 구조체, url, 세그먼트 표 */
+static size_t obj_meta(cache_obj_t *obj)
+{
+  return sizeof(cache_obj_t) + strlen(obj->url) + 1 + obj->nsegs * sizeof(cache_seg_t *) +
+    3 * CACHE_MALLOC_OVERHEAD;
+}
+
+/* 세그먼트 말고 객체 자체가 차지하는 메모리: 힙에 둔 것과 큰 객체의 헤더 blob */
+static size_t obj_cost(cache_obj_t *obj)
+{
+  return obj_meta(obj) + (obj->hdr ? obj->hdr->cap : 0);
+}
+
+/* 세그먼트를 blob이 든 슬랩 페이지의 목록에 건다 (슬랩 밖의 blob이면 하지 않는다) */
+static void page_link(cache_seg_t *seg)
+{
+  cache_seg_t **segs;
+
+  if (seg->cls < 0)
+    return;
+  segs = page_segs(seg);
+  seg->pprev = NULL;
+  seg->pnext = *segs;
+  if (*segs)
+    (*segs)->pprev = seg;
+  *segs = seg;
+}
+
+/* blob을 놓기 전에 불러야 한다. 놓으면 페이지가 돌려질 수 있다 */
+static void page_unlink(cache_seg_t *seg)
+{
+  if (seg->cls < 0)
+    return;
+  if (seg->pprev)
+    seg->pprev->pnext = seg->pnext;
+  else
+    *page_segs(seg) = seg->pnext;
+  if (seg->pnext)
+    seg->pnext->pprev = seg->pprev;
+}
+
+static void lru_unlink(cache_seg_t *seg)
+{
+  if (seg->prev)
+    seg->prev->next = seg->next;
+  else
+    lru_head = seg->next;
+  if (seg->next)
+    seg->next->prev = seg->prev;
+  else
+    lru_tail = seg->prev;
+  seg->prev = seg->next = NULL;
+  if (seg->cls < 0)
+    return;
+  if (seg->cprev)
+    seg->cprev->cnext = seg->cnext;
+  else
+    cls_head[seg->cls] = seg->cnext;
+  if (seg->cnext)
+    seg->cnext->cprev = seg->cprev;
+  else
+    cls_tail[seg->cls] = seg->cprev;
+  seg->cprev = seg->cnext = NULL;
+}
+
+static void lru_push(cache_seg_t *seg)
+{
+  seg->stamp = ++lru_clock;
+  seg->prev = NULL;
+  seg->next = lru_head;
+  if (lru_head)
+    lru_head->prev = seg;
+  lru_head = seg;
+  if (!lru_tail)
+    lru_tail = seg;
+  if (seg->cls < 0)
+    return;
+  seg->cprev = NULL;
+  seg->cnext = cls_head[seg->cls];
+  if (cls_head[seg->cls])
+    cls_head[seg->cls]->cprev = seg;
+  cls_head[seg->cls] = seg;
+  if (!cls_tail[seg->cls])
+    cls_tail[seg->cls] = seg;
+}
+
+static void lru_touch(cache_seg_t *seg)
+{
+  lru_unlink(seg);
+  lru_push(seg);
+}
+
+/* 색인에서 떼어내고 남은 세그먼트와 함께 메모리를 돌려준다 */
+static void remove_obj(cache_obj_t *obj)
+{
+  cache_seg_t *seg;
+  int i;
+
+  hindex_remove(&url_index, obj->hash, obj);
+  (*gen_count(obj->gen))--;
+  ban_prune();
+  for (i = 0; i < obj->nsegs; i++) {
+    if (!(seg = obj->segs[i]))
+      continue;
+    lru_unlink(seg);
+    page_unlink(seg);
+    cache_size -= seg_cost(seg);
+    meta_size -= SEG_META;
+    cache_blob_put(seg->blob);
+    Free(seg);
+  }
+  cache_size -= obj_cost(obj);
+  meta_size -= obj_meta(obj);
+  if (obj->hdr)
+    cache_blob_put(obj->hdr);
+  Free(obj->segs);
+  Free(obj->url);
+  Free(obj);
+}
+
+/* 세그먼트 하나만 내보낸다. 객체에 남은 세그먼트가 없으면 객체도 지운다 */
+static void remove_seg(cache_seg_t *seg)
+{
+  cache_obj_t *obj = seg->obj;
+
+  obj->segs[seg->idx] = NULL;
+  obj->npresent--;
+  lru_unlink(seg);
+  page_unlink(seg);
+  cache_size -= seg_cost(seg);
+  meta_size -= SEG_META;
+  cache_blob_put(seg->blob);
+  Free(seg);
+  if (!obj->npresent)
+    remove_obj(obj);
+}
+
+/* 빈 객체를 만들어 색인에 넣는다. 같은 url의 객체가 있으면 먼저 지운다 */
+static cache_obj_t *new_obj(char *url, uint64_t hash, cache_meta_t *meta)
+{
+  cache_obj_t *obj, *old;
+
+  if ((old = find(url, hash)))
+    remove_obj(old);
+  obj = Malloc(sizeof(cache_obj_t));
+  obj->url = Malloc(strlen(url) + 1);
+  strcpy(obj->url, url);
+  obj->hash = hash;
+  obj->meta = *meta;
+  obj->hits = 0;
+  obj->refreshing = 0;
+  obj->nsegs = (meta->size <= MAX_OBJECT_SIZE) ? 1 :
+    (meta->size + CACHE_SEGMENT_SIZE - 1) / CACHE_SEGMENT_SIZE;
+  obj->npresent = 0;
+  obj->segs = Calloc(obj->nsegs, sizeof(cache_seg_t *));
+  obj->hdr = (obj->nsegs > 1) ? blob_new(meta, 0, 1) : NULL;
+  hindex_insert(&url_index, hash, obj);
+  obj->gen = ban_gen;
+  (*gen_count(ban_gen))++;
+  cache_size += obj_cost(obj);
+  meta_size += obj_meta(obj);
+  return obj;
+}
+
+/*
+ * blob의 참조를 하나 잡아 세그먼트로 붙인다. 높은 수위를 넘으면 회수 쓰레드를 깨우고,
+ * 예산 자체를 넘으면 그만큼은 여기서 LRU 순으로 내보낸다.
+ */
+static void add_seg(cache_obj_t *obj, int idx, cache_blob_t *blob)
+{
+  cache_seg_t *seg = Malloc(sizeof(cache_seg_t));
+
+  cache_blob_get(blob);
+  seg->obj = obj;
+  seg->idx = idx;
+  seg->blob = blob;
+  seg->cls = slab_class(blob->cap);
+  obj->segs[idx] = seg;
+  obj->npresent++;
+  lru_push(seg);
+  page_link(seg);
+  cache_size += seg_cost(seg);
+  meta_size += SEG_META;
+  stats.inserts++;
+  if (cache_reclaim && cache_size > cache_max_size / 100 * CACHE_EVICT_HIGH)
+    pthread_cond_signal(&reclaim_cond);
+  while (cache_size > cache_max_size && lru_tail != seg) {
+    remove_seg(lru_tail);
+    stats.evictions++;
+    stats.inline_evictions += cache_reclaim;
+  }
+}
+
+/*
+ * 회수 쓰레드. 높은 수위를 넘으면 낮은 수위까지 LRU 끝을 내보낸다. blob의 참조를 하나씩
+ * 더 잡아 두었다가 락을 놓은 뒤 돌려주므로 조각과 페이지를 푸는 일은 락 밖에서 한다.
+ */
+static void *reclaim_thread(void *vargp)
+{
+  cache_blob_t *victims[CACHE_EVICT_BATCH];
+  int i, n;
+
+  Pthread_detach(pthread_self());
+  pthread_mutex_lock(&cache_mutex);
+  while (1) {
+    while (!cache_reclaim || cache_size <= cache_max_size / 100 * CACHE_EVICT_HIGH)
+      pthread_cond_wait(&reclaim_cond, &cache_mutex);
+    while (cache_reclaim && cache_size > cache_max_size / 100 * CACHE_EVICT_LOW && lru_tail) {
+      for (n = 0; n < CACHE_EVICT_BATCH && lru_tail &&
+             cache_size > cache_max_size / 100 * CACHE_EVICT_LOW; n++) {
+        victims[n] = lru_tail->blob;
+        cache_blob_get(victims[n]);
+        remove_seg(lru_tail);
+        stats.evictions++;
+        stats.reclaimed++;
+      }
+      pthread_mutex_unlock(&cache_mutex);
+      for (i = 0; i < n; i++)
+        cache_blob_put(victims[i]);
+      sched_yield();                    // 락을 기다리던 요청이 먼저 잡게 한다
+      pthread_mutex_lock(&cache_mutex);
+    }
+  }
+  return NULL;
+}
+
+void cache_init(void)
+{
+  pthread_t tid;
+
+  slab_configure(cache_max_size);       // 예산에 맞춰 페이지를 줄이고, 너무 작으면 Malloc으로
+  pthread_mutex_lock(&cache_mutex);     // 앞서 띄운 회수 쓰레드가 돌고 있을 수 있다
+  if (url_index.ctrl)
+    hindex_free(&url_index);
+  hindex_init(&url_index, CACHE_INDEX_CAP);
+  memset(cls_head, 0, sizeof(cls_head));
+  memset(cls_tail, 0, sizeof(cls_tail));
+  lru_head = lru_tail = NULL;
+  cache_size = meta_size = 0;
+  ban_base = 0;
+  ban_prune();
+  pthread_mutex_unlock(&cache_mutex);
+  if (cache_reclaim && !reclaim_started) {
+    reclaim_started = 1;
+    Pthread_create(&tid, NULL, reclaim_thread, NULL);
+  }
+}
+
+int cache_lookup(char *url, uint64_t hash, cache_meta_t *meta, cache_blob_t **blob)
+{
+  cache_obj_t *obj;
+  cache_blob_t *shared;
+  time_t now = time(NULL);
+  unsigned long gen;
+  int rc;
+
+  *blob = NULL;
+  if (shm_cache_enabled && shm_cache_has_bans())
+    ban_sync();
+  pthread_mutex_lock(&cache_mutex);
+  if (!(obj = find(url, hash))) {
+    gen = ban_gen;
+    pthread_mutex_unlock(&cache_mutex);
+    // 다른 프로세스가 공유 영역에 넣어 둔 객체면 이 프로세스의 캐시로 가져온다
+    if (!shm_cache_enabled || !(shared = shm_cache_lookup(url, hash, meta)))
+      return CACHE_MISS;
+    pthread_mutex_lock(&cache_mutex);
+    if (!(obj = find(url, hash))) {
+      obj = new_obj(url, hash, meta);
+      add_seg(obj, 0, shared);
+      if (gen != ban_gen) {             // 공유 영역에서 읽는 사이에 생긴 금지에도 비춰 본다
+        set_gen(obj, gen);
+        if (ban_check(obj)) {
+          pthread_mutex_unlock(&cache_mutex);
+          cache_blob_put(shared);
+          return CACHE_MISS;
+        }
+      }
+    }
+    cache_blob_put(shared);
+  }
+  if (obj->meta.vary[0] && !strchr(obj->url, '\n')) {  // Vary 표식
+    lru_touch(obj->segs[0]);
+    *meta = obj->meta;
+    pthread_mutex_unlock(&cache_mutex);
+    return CACHE_VARY;
+  }
+  obj->hits++;
+  *meta = obj->meta;
+  if (obj->hdr)
+    *blob = obj->hdr;
+  else {
+    lru_touch(obj->segs[0]);
+    *blob = obj->segs[0]->blob;
+  }
+  cache_blob_get(*blob);
+  rc = (now < obj->meta.expires) ? CACHE_FRESH : CACHE_STALE;
+
+  /* 오래된 객체(SWR 모드)나 곧 만료될 인기 객체는 갱신을 한 호출자에게만 맡긴다 */
+  if (!obj->refreshing &&
+      ((rc == CACHE_STALE && cache_swr) ||
+       (rc == CACHE_FRESH && cache_prefetch && obj->hits >= CACHE_HOT_HITS &&
+        obj->meta.expires - now <= cache_prefetch))) {
+    obj->refreshing = 1;
+    rc |= CACHE_REFRESH;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return rc;
+}
+
+cache_blob_t *cache_read_segment(char *url, cache_meta_t *meta, int idx)
+{
+  cache_obj_t *obj;
+  cache_seg_t *seg;
+  cache_blob_t *blob;
+
+  pthread_mutex_lock(&cache_mutex);
+  if (!(obj = find(url, url_hash(url))) || !same_version(&obj->meta, meta) ||
+      idx >= obj->nsegs || !(seg = obj->segs[idx])) {
+    pthread_mutex_unlock(&cache_mutex);
+    return NULL;
+  }
+  lru_touch(seg);
+  blob = seg->blob;
+  cache_blob_get(blob);
+  pthread_mutex_unlock(&cache_mutex);
+  return blob;
+}
+
+/*
+ * 압축할 content type과 zlib 압축 수준. 자주 다시 요청되는 마크업과 스크립트는 공들여
+ * 줄이고, 그 밖의 텍스트(소스, 로그 같은 큰 평문)는 가장 빠른 수준으로 줄인다.
+ */
+static struct {
+  char *prefix;
+  int level;
+} zip_types[] = {
+  { "text/html", 6 },
+  { "text/css", 6 },
+  { "text/javascript", 6 },
+  { "application/javascript", 6 },
+  { "application/json", 6 },
+  { "application/xml", 6 },
+  { "image/svg+xml", 6 },
+  { "text/", 1 },
+};
+
+static int zip_level(char *ctype)
+{
+  int i;
+
+  for (i = 0; i < sizeof(zip_types) / sizeof(zip_types[0]); i++)
+    if (!strncasecmp(ctype, zip_types[i].prefix, strlen(zip_types[i].prefix)))
+      return zip_types[i].level;
+  return -1;
+}
+
+/* 평문 blob을 gzip으로 압축한 새 blob을 만들고 meta->zlen을 채운다. 10% 넘게 줄지 않으면 NULL */
+static cache_blob_t *compress_blob(cache_meta_t *meta, cache_blob_t *blob, int level)
+{
+  z_stream z;
+  cache_blob_t *zblob = NULL;
+  char *buf;
+  uLong bound;
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+  bound = deflateBound(&z, meta->size);
+  buf = Malloc(bound);
+  z.next_in = (Bytef *)blob->data + blob->hdrlen;
+  z.avail_in = meta->size;
+  z.next_out = (Bytef *)buf;
+  z.avail_out = bound;
+  if (deflate(&z, Z_FINISH) == Z_STREAM_END && z.total_out * 10 < meta->size * 9) {
+    meta->zlen = z.total_out;
+    zblob = cache_blob_new(meta, meta->zlen);
+    memcpy(zblob->data + zblob->hdrlen, buf, meta->zlen);
+  }
+  deflateEnd(&z);
+  Free(buf);
+  return zblob;
+}
+
+cache_blob_t *cache_decode(cache_meta_t *meta, cache_blob_t *blob)
+{
+  cache_meta_t plain = *meta;
+  cache_blob_t *out;
+  z_stream z;
+  int rc;
+
+  plain.zlen = 0;
+  out = cache_blob_new(&plain, plain.size);
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 15 + 16) != Z_OK) {
+    cache_blob_put(out);
+    return NULL;
+  }
+  z.next_in = (Bytef *)blob->data + blob->hdrlen;
+  z.avail_in = blob->len - blob->hdrlen;
+  z.next_out = (Bytef *)out->data + out->hdrlen;
+  z.avail_out = plain.size;
+  rc = inflate(&z, Z_FINISH);
+  inflateEnd(&z);
+  if (rc != Z_STREAM_END || z.total_out != plain.size) {
+    cache_blob_put(out);
+    return NULL;
+  }
+  *meta = plain;
+  return out;
+}
+
+void cache_insert(char *url, cache_meta_t *meta, cache_blob_t *blob)
+{
+  uint64_t hash = url_hash(url);
+  cache_meta_t zmeta = *meta;
+  cache_blob_t *zblob = NULL;
+  int level;
+
+  if (meta->size > MAX_OBJECT_SIZE)
+    return;
+  // 압축은 락 밖에서 한다
+  if (cache_compress && !meta->zlen && meta->size >= CACHE_ZIP_MIN &&
+      (level = zip_level(meta->ctype)) >= 0 && (zblob = compress_blob(&zmeta, blob, level))) {
+    meta = &zmeta;
+    blob = zblob;
+  }
+
+  pthread_mutex_lock(&cache_mutex);
+  add_seg(new_obj(url, hash, meta), 0, blob);
+  if (zblob) {
+    stats.zipped++;
+    stats.zip_in += meta->size;
+    stats.zip_out += meta->zlen;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  if (shm_cache_enabled)
+    shm_cache_insert(url, hash, meta, blob);
+  if (zblob)
+    cache_blob_put(zblob);
+}
+
+void cache_put_segment(char *url, cache_meta_t *meta, int idx, cache_blob_t *blob, int create)
+{
+  uint64_t hash = url_hash(url);
+  cache_obj_t *obj;
+
+  pthread_mutex_lock(&cache_mutex);
+  if (!(obj = find(url, hash)) || !same_version(&obj->meta, meta)) {
+    if (!create) {
+      pthread_mutex_unlock(&cache_mutex);
+      return;
+    }
+    obj = new_obj(url, hash, meta);
+  }
+  else
+    obj->meta.expires = meta->expires;
+  /* 큰 객체 하나가 캐시를 다 밀어내지 않도록 예산의 일부까지만 채운다 */
+  if (idx < obj->nsegs && !obj->segs[idx] &&
+      (obj->npresent + 1) * (size_t)CACHE_SEGMENT_SIZE <= cache_max_size / CACHE_OBJECT_SHARE)
+    add_seg(obj, idx, blob);
+  else if (!obj->npresent)              // 하나도 못 채운 빈 객체는 남기지 않는다
+    remove_obj(obj);
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+cache_blob_t *cache_refresh(char *url, cache_meta_t *meta)
+{
+  uint64_t hash = url_hash(url);
+  cache_obj_t *obj;
+  cache_seg_t *seg;
+  cache_blob_t *blob;
+  cache_meta_t now;
+  int changed, small;
+
+  pthread_mutex_lock(&cache_mutex);
+  if (!(obj = find(url, hash))) {
+    pthread_mutex_unlock(&cache_mutex);
+    return NULL;
+  }
+  /* 304 응답에 새 검증자가 실려 왔으면 그것으로 바꾼다 */
+  changed = (meta->lastmod[0] && strcmp(obj->meta.lastmod, meta->lastmod)) ||
+    (meta->etag[0] && strcmp(obj->meta.etag, meta->etag));
+  if (meta->lastmod[0])
+    strcpy(obj->meta.lastmod, meta->lastmod);
+  if (meta->etag[0])
+    strcpy(obj->meta.etag, meta->etag);
+  obj->meta.expires = meta->expires;
+
+  /* 직렬화해 둔 헤더에 옛 검증자가 들어 있으므로 새로 만든다. blob은 바꾸지 않는다 */
+  if (changed && obj->hdr) {
+    cache_size -= obj->hdr->cap;
+    cache_blob_put(obj->hdr);
+    obj->hdr = blob_new(&obj->meta, 0, 1);
+    cache_size += obj->hdr->cap;
+  }
+  else if (changed && (seg = obj->segs[0])) {    // 압축해 둔 본문이면 압축된 그대로 옮긴다
+    blob = blob_new(&obj->meta, seg->blob->len - seg->blob->hdrlen, 1);
+    memcpy(blob->data + blob->hdrlen, seg->blob->data + seg->blob->hdrlen,
+           seg->blob->len - seg->blob->hdrlen);
+    cache_size += blob->cap - seg->blob->cap;
+    page_unlink(seg);
+    cache_blob_put(seg->blob);
+    lru_unlink(seg);                    // 헤더 길이가 바뀌어 등급이 달라질 수 있다
+    seg->blob = blob;
+    seg->cls = slab_class(blob->cap);
+    lru_push(seg);
+    page_link(seg);
+  }
+  blob = obj->hdr ? obj->hdr : obj->segs[0]->blob;
+  cache_blob_get(blob);
+  *meta = now = obj->meta;
+  small = !obj->hdr;
+  pthread_mutex_unlock(&cache_mutex);
+
+  if (shm_cache_enabled && small) {     // 공유 영역의 사본도 같은 판으로 맞춘다
+    if (changed)
+      shm_cache_insert(url, hash, &now, blob);
+    else
+      shm_cache_touch(url, hash, &now);
+  }
+  return blob;
+}
+
+void cache_insert_vary(char *url, char *vary)
+{
+  uint64_t hash = url_hash(url);
+  cache_obj_t *obj;
+  cache_meta_t meta;
+  cache_blob_t *blob;
+  int added = 0;
+
+  memset(&meta, 0, sizeof(meta));
+  strcpy(meta.vary, vary);
+  blob = cache_blob_new(NULL, 0);       // 본문이 없는 표식도 세그먼트 하나로 LRU에 올린다
+  pthread_mutex_lock(&cache_mutex);
+  if (!(obj = find(url, hash)) || strcmp(obj->meta.vary, vary)) {
+    add_seg(new_obj(url, hash, &meta), 0, blob);
+    added = 1;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  if (shm_cache_enabled && added)
+    shm_cache_insert(url, hash, &meta, blob);
+  cache_blob_put(blob);
+}
+
+int cache_fetch_begin(char *url, int wait)
+{
+  uint64_t hash = url_hash(url);
+  cache_fetch_t *f;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&cache_mutex);
+  for (f = fetching; f; f = f->next)
+    if (f->hash == hash && !strcmp(f->url, url))
+      break;
+  if (!f) {                             // 처음 온 요청이 받아 온다
+    f = Malloc(sizeof(cache_fetch_t));
+    f->url = Malloc(strlen(url) + 1);
+    strcpy(f->url, url);
+    f->hash = hash;
+    f->waiters = f->done = 0;
+    f->next = fetching;
+    fetching = f;
+    pthread_mutex_unlock(&cache_mutex);
+    return 1;
+  }
+  if (wait) {
+    stats.coalesced++;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += CACHE_COALESCE_WAIT;
+    f->waiters++;
+    while (!f->done && pthread_cond_timedwait(&fetch_cond, &cache_mutex, &deadline) != ETIMEDOUT)
+      ;
+    if (--f->waiters == 0 && f->done) {
+      Free(f->url);
+      Free(f);
+    }
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return 0;
+}
+
+void cache_fetch_end(char *url)
+{
+  uint64_t hash = url_hash(url);
+  cache_fetch_t **pp, *f;
+
+  pthread_mutex_lock(&cache_mutex);
+  for (pp = &fetching; (f = *pp); pp = &f->next)
+    if (f->hash == hash && !strcmp(f->url, url)) {
+      *pp = f->next;
+      f->done = 1;
+      if (!f->waiters) {
+        Free(f->url);
+        Free(f);
+      }
+      pthread_cond_broadcast(&fetch_cond);
+      break;
+    }
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+void cache_release(char *url)
+{
+  cache_obj_t *obj;
+
+  pthread_mutex_lock(&cache_mutex);
+  if ((obj = find(url, url_hash(url))))
+    obj->refreshing = 0;
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+int cache_admit(char *url)
+{
+  uint64_t h = url_hash(url), step = (h >> 32) | 1;
+  unsigned min = 255, i, j;
+  uint8_t *c[CACHE_SKETCH_ROWS];
+
+  if (cache_admit_hits <= 1)
+    return 1;
+  pthread_mutex_lock(&admit_mutex);
+  for (i = 0; i < CACHE_SKETCH_ROWS; i++) {
+    c[i] = &sketch[i][(h + i * step) & (CACHE_SKETCH_WIDTH - 1)];
+    if (*c[i] < min)
+      min = *c[i];
+  }
+  /* 가장 작은 계수만 올려(conservative update) 충돌로 부풀려지는 것을 줄인다 */
+  if (min < 255) {
+    for (i = 0; i < CACHE_SKETCH_ROWS; i++)
+      if (*c[i] == min)
+        (*c[i])++;
+    min++;
+  }
+  if (++sketch_adds >= CACHE_ADMIT_WINDOW) {  // 창이 지나면 옛 요청의 무게를 반으로
+    for (i = 0; i < CACHE_SKETCH_ROWS; i++)
+      for (j = 0; j < CACHE_SKETCH_WIDTH; j++)
+        sketch[i][j] >>= 1;
+    sketch_adds = 0;
+  }
+  if (min < cache_admit_hits)
+    stats.rejects++;
+  pthread_mutex_unlock(&admit_mutex);
+  return min >= cache_admit_hits;
+}
+
+int cache_purge(char *url)
+{
+  uint64_t hash = url_hash(url);
+  cache_obj_t *obj;
+  char key[MAXLINE];
+  int found = 0, vary = 0;
+
+  pthread_mutex_lock(&cache_mutex);
+  if ((obj = find(url, hash))) {
+    vary = obj->meta.vary[0] && !strchr(obj->url, '\n');
+    remove_obj(obj);
+    stats.purges++;
+    found = 1;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  if (shm_cache_enabled) {
+    shm_cache_remove(url, hash);
+    shm_cache_publish(CACHE_BAN_EXACT, url);  // 다른 프로세스의 캐시에 남은 사본
+  }
+  if (vary && strlen(url) + 1 < MAXLINE) {  // 변형 키는 요청 헤더를 알아야 만들 수 있다
+    sprintf(key, "%s\n", url);
+    cache_ban(CACHE_BAN_PREFIX, key);
+  }
+  return found;
+}
+
+/* 금지를 목록에 올린다. publish면 공유 영역을 비우고 다른 프로세스에도 알린다 */
+static int ban_add(int type, char *pattern, int publish)
+{
+  cache_ban_t *b = Malloc(sizeof(cache_ban_t));
+
+  if (type == CACHE_BAN_REGEX && regcomp(&b->re, pattern, REG_EXTENDED | REG_NOSUB)) {
+    Free(b);
+    return -1;
+  }
+  b->type = type;
+  b->pattern = Malloc(strlen(pattern) + 1);
+  strcpy(b->pattern, pattern);
+  b->nobjs = 0;
+  // 공유 영역을 먼저 비워야 금지가 보인 뒤에 옛 사본을 가져오는 일이 없다
+  if (publish && shm_cache_enabled) {
+    shm_cache_flush();
+    shm_cache_publish(type, pattern);
+  }
+  pthread_mutex_lock(&cache_mutex);
+  b->gen = ++ban_gen;
+  b->newer = NULL;
+  if ((b->older = ban_newest))
+    ban_newest->newer = b;
+  else
+    ban_oldest = b;
+  ban_newest = b;
+  stats.bans++;
+  ban_prune();                          // 확인할 객체가 하나도 없으면 바로 떨어진다
+  pthread_mutex_unlock(&cache_mutex);
+  return 0;
+}
+
+int cache_ban(int type, char *pattern)
+{
+  return ban_add(type, pattern, 1);
+}
+
+/* 다른 프로세스가 공유 영역에 알린 금지를 이 프로세스의 금지 목록에 들인다 */
+static void ban_sync(void)
+{
+  char pattern[SHM_BAN_LEN];
+  int type, rc;
+
+  while ((rc = shm_cache_next_ban(&type, pattern)))
+    if (rc < 0)
+      ban_add(CACHE_BAN_PREFIX, "", 0); // 놓친 금지가 있으면 모두 무효로
+    else
+      ban_add(type, pattern, 0);
+}
+
+void cache_get_stats(cache_stats_t *st)
+{
+  pthread_mutex_lock(&cache_mutex);
+  *st = stats;
+  st->size = cache_size;
+  pthread_mutex_unlock(&cache_mutex);
+  pthread_mutex_lock(&admit_mutex);
+  st->rejects = stats.rejects;
+  pthread_mutex_unlock(&admit_mutex);
+}
@@ -0,0 +1,251 @@
+/*
+ * cache.h - 프록시가 원 서버(tiny) 응답을 저장해 두는 웹 객체 캐시
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <regex.h>
+#include "csapp.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+#define CACHE_SEGMENT_SIZE (256 * 1024)  /* MAX_OBJECT_SIZE보다 큰 객체를 나누어 저장하는 단위 */
+#define CACHE_OBJECT_SHARE 2    /* 큰 객체 하나는 예산의 1/2까지만 세그먼트를 채운다 */
+#define CACHE_INDEX_CAP 1024    /* URL 색인의 처음 슬롯 수 (차면 두 배씩 는다) */
+#define CACHE_DEFAULT_TTL 60    /* 응답에 만료 정보가 없을 때의 신선도 수명(초) */
+#define CACHE_HOT_HITS 4        /* 이만큼 조회된 객체는 만료 전에 미리 갱신한다 */
+#define CACHE_EVICT_HIGH 90     /* 사용량이 예산의 이 %를 넘으면 회수 쓰레드를 깨운다 */
+#define CACHE_EVICT_LOW 80      /* 회수 쓰레드는 이 %까지 내보낸다 */
+#define CACHE_EVICT_BATCH 8    /* 회수 쓰레드가 락을 한 번 잡고 내보내는 세그먼트 수 */
+#define CACHE_EVICT_PAGES 4     /* 새 조각 하나를 위해 비워 보는 최대 페이지(또는 세그먼트) 수 */
+#define CACHE_MALLOC_OVERHEAD 16 /* Malloc 블록마다 붙는 머리와 정렬 (구조체 비용에 더한다) */
+#define CACHE_ADMIT_HITS 2      /* 기본 입장 조건: 두 번째 요청부터 캐시한다 */
+#define CACHE_SKETCH_ROWS 4     /* 입장 필터(count-min sketch)의 행 수 */
+#define CACHE_SKETCH_WIDTH 65536 /* 행마다의 계수기 수 (2의 거듭제곱) */
+#define CACHE_ADMIT_WINDOW (4 * CACHE_SKETCH_WIDTH) /* 이만큼 기록할 때마다 계수를 반으로 줄인다 */
+
+/* cache_lookup의 결과 */
+#define CACHE_MISS  0
+#define CACHE_FRESH 1           /* 그대로 응답해도 되는 객체 */
+#define CACHE_STALE 2           /* 원 서버에 재검증이 필요한 객체 */
+#define CACHE_REFRESH 4         /* 위 값에 OR된다: 호출자가 백그라운드 갱신을 맡았다 */
+#define CACHE_VARY 8            /* url이 Vary 표식이다: meta->vary로 변형 키를 만들어 다시 찾는다 */
+
+#define CACHE_ZIP_MIN 256       /* 이보다 작은 본문은 압축하지 않는다 */
+#define CACHE_COALESCE_WAIT 5   /* 같은 키를 받아 오는 다른 요청을 기다리는 최대 시간(초) */
+
+/* cache_ban의 종류 */
+#define CACHE_BAN_PREFIX 0      /* 키가 pattern으로 시작한다 */
+#define CACHE_BAN_REGEX 1       /* 키의 URL 부분이 POSIX 확장 정규식 pattern에 맞는다 */
+#define CACHE_BAN_HOST 2        /* 키의 호스트가 pattern이다 (pattern에 포트가 없으면 모든 포트) */
+#define CACHE_BAN_EXACT 3       /* 키가 pattern이다 (cache_purge를 다른 프로세스에 알릴 때) */
+
+/* 캐시된 응답을 다시 만들고 재검증하는 데 필요한 메타데이터 */
+typedef struct {
+  char ctype[128];              /* Content-type */
+  char lastmod[64];             /* Last-Modified 검증자 (없으면 빈 문자열) */
+  char etag[128];               /* ETag 검증자 (없으면 빈 문자열) */
+  char vary[128];               /* Vary: 소문자 헤더 이름을 쉼표로 이은 것 (없으면 빈 문자열) */
+  time_t expires;               /* 이 시각이 지나면 재검증한다 */
+  size_t size;                  /* 본문 전체 크기 */
+  size_t zlen;                  /* gzip으로 압축해 저장했으면 압축된 본문 크기 (아니면 0) */
+} cache_meta_t;
+
+/*
+ * 미리 직렬화해 둔 응답. 상태 줄과 헤더, 본문이 한 덩어리로 이어져 있어 캐시 적중을
+ * send 한 번으로 보낼 수 있다. 만든 뒤에는 바꾸지 않으며, 참조 횟수로 수명을 관리하므로
+ * 락을 놓은 뒤 보내는 동안 캐시에서 내보내져도 안전하다.
+ */
+typedef struct {
+  int refcnt;
+  size_t cap;                   /* 할당받은 조각 크기 (이 구조체 포함) */
+  size_t len;                   /* data 전체 길이 */
+  size_t hdrlen;                /* 앞쪽 상태 줄과 헤더 길이 (본문 조각이면 0) */
+  int idx;                      /* 본문 조각이면 몇 번째 세그먼트인지 */
+  char data[];
+} cache_blob_t;
+
+/* 본문 조각. 내보내기(LRU)는 세그먼트 단위로 이루어진다 */
+typedef struct cache_seg {
+  struct cache_obj *obj;        /* 이 세그먼트가 속한 객체 */
+  int idx;                      /* 본문에서 idx * CACHE_SEGMENT_SIZE 위치부터 */
+  cache_blob_t *blob;           /* 작은 객체는 헤더까지 담은 전체 응답, 큰 객체는 본문 조각만 */
+  struct cache_seg *prev, *next;/* LRU 리스트 (head가 가장 최근) */
+  int cls;                      /* blob 조각의 슬랩 등급 (슬랩 밖이면 -1) */
+  struct cache_seg *cprev, *cnext; /* 같은 등급끼리의 LRU 리스트 */
+  struct cache_seg *pprev, *pnext; /* blob이 같은 슬랩 페이지에 든 세그먼트 목록 */
+  unsigned long stamp;          /* 마지막으로 LRU 맨 앞에 올린 때 (lru_clock) */
+} cache_seg_t;
+
+typedef struct cache_obj {
+  char *url;                    /* 캐시 키 */
+  uint64_t hash;                /* url의 64비트 해시 */
+  cache_meta_t meta;
+  unsigned hits;                /* 조회 횟수 */
+  int refreshing;               /* 백그라운드 갱신이 진행 중이면 1 */
+  int nsegs;                    /* 세그먼트 수 (MAX_OBJECT_SIZE 이하 객체는 1) */
+  int npresent;                 /* 채워져 있는 세그먼트 수 */
+  cache_seg_t **segs;           /* 아직 없거나 내보낸 세그먼트는 NULL */
+  cache_blob_t *hdr;            /* 큰 객체의 200 응답 헤더 (작은 객체는 NULL) */
+  unsigned long gen;            /* 마지막으로 금지 목록에 비춰 본 세대 */
+} cache_obj_t;
+
+/* 캐시가 얼마나 드나드는지 보는 누적 통계 */
+typedef struct {
+  unsigned long inserts;        /* 저장한 세그먼트 수 */
+  unsigned long evictions;      /* 예산 때문에 내보낸 세그먼트 수 */
+  unsigned long reclaimed;      /* 그중 회수 쓰레드가 내보낸 수 */
+  unsigned long inline_evictions; /* 그중 넣는 요청이 예산을 넘겨 직접 내보낸 수 */
+  unsigned long rejects;        /* 입장 필터가 돌려보낸 객체 수 */
+  unsigned long zipped;         /* 압축해 저장한 객체 수 */
+  unsigned long zip_in;         /* 그 객체들의 원래 본문 크기 합 */
+  unsigned long zip_out;        /* 압축된 본문 크기 합 */
+  unsigned long coalesced;      /* 다른 요청이 받아 오기를 기다린 요청 수 */
+  unsigned long purges;         /* cache_purge로 지운 객체 수 */
+  unsigned long bans;           /* 추가된 금지 수 */
+  unsigned long banned;         /* 금지에 걸려 조회할 때 지운 객체 수 */
+  size_t size;                  /* 지금 캐시가 차지한 메모리 (blob 조각과 구조체) */
+} cache_stats_t;
+
+/* 원 서버에서 받아 오는 중인 키. 같은 키의 다른 요청은 끝나기를 기다린다 */
+typedef struct cache_fetch {
+  char *url;
+  uint64_t hash;
+  int waiters;                  /* 기다리는 요청 수 (0이 되어야 해제) */
+  int done;
+  struct cache_fetch *next;
+} cache_fetch_t;
+
+/*
+ * 금지 목록의 항목. 금지는 추가될 때 캐시를 훑지 않고 세대 번호만 하나 올린다. 객체는
+ * 마지막으로 확인한 세대를 기억하고, 찾을 때 그보다 새 금지에만 비춰 본다. 걸리면 그때
+ * 지우고, 아니면 지금 세대로 올린다. 어느 객체도 더 비춰 볼 일이 없는 가장 오래된 금지는
+ * 목록에서 떨어진다.
+ */
+typedef struct cache_ban {
+  unsigned long gen;            /* 이 금지가 만든 세대 */
+  int type;                     /* CACHE_BAN_* */
+  char *pattern;
+  regex_t re;                   /* CACHE_BAN_REGEX일 때 컴파일한 pattern */
+  unsigned long nobjs;          /* 이 세대로 확인된 객체 수 */
+  struct cache_ban *older, *newer;
+} cache_ban_t;
+
+extern int cache_default_ttl;   /* -t 옵션으로 바꿀 수 있는 기본 신선도 수명 */
+extern int cache_swr;           /* -s: 오래된 객체를 바로 주고 갱신은 뒤에서 한다 */
+extern int cache_prefetch;      /* -r: 인기 객체를 만료 몇 초 전부터 미리 갱신할지 (0이면 끔) */
+extern size_t cache_max_size;   /* -c: 캐시 전체 예산 (기본 MAX_CACHE_SIZE) */
+extern int cache_admit_hits;    /* -a: 창 안에서 이만큼 요청된 객체만 캐시한다 (1이면 필터를 끈다) */
+extern int cache_compress;      /* -z: 텍스트 객체를 gzip으로 압축해 저장한다 */
+extern int cache_reclaim;       /* 0이면 회수 쓰레드 없이 넣는 쪽에서 내보낸다 (벤치마크 비교용) */
+
+/* 캐시를 비우고, cache_reclaim이면 처음 한 번 회수 쓰레드를 띄운다 */
+void cache_init(void);
+
+/*
+ * 캐시된 메타데이터로 상태 줄과 응답 헤더를 buf에 쓰고 길이를 돌려준다. 헤더를 끝내는
+ * 빈 줄은 붙이지 않으므로 호출자가 헤더를 더 붙일 수 있다.
+ */
+int cache_format_hdrs(char *buf, char *status, cache_meta_t *meta, size_t clen, char *ctype);
+
+/*
+ * 본문 bodylen 바이트를 담을 blob을 만든다(참조 1). meta가 주어지면 그 메타데이터로 만든
+ * 200 응답 헤더를 앞에 미리 써 두고, 본문은 호출자가 data + hdrlen에 채운다.
+ * meta->zlen이 0이 아니면 Content-Encoding: gzip 응답의 헤더를 쓴다.
+ */
+cache_blob_t *cache_blob_new(cache_meta_t *meta, size_t bodylen);
+void cache_blob_get(cache_blob_t *blob);
+void cache_blob_put(cache_blob_t *blob);
+
+/*
+ * url을 찾아 메타데이터를 meta에 복사하고, 보낼 응답 blob의 참조를 *blob에 담는다(없으면 NULL).
+ * 작은 객체는 헤더와 본문이 모두 든 blob이다. meta->size가 MAX_OBJECT_SIZE보다 큰 객체는
+ * 헤더만 든 blob이며, 본문은 호출자가 cache_read_segment로 조각씩 받아 이어 보낸다. 받은
+ * 참조는 다 보낸 뒤 cache_blob_put으로 돌려준다. 일부 세그먼트만 있는 객체도 찾은 것으로
+ * 치며, 빠진 세그먼트는 호출자가 원 서버에 그 범위만 요청해 채운다.
+ * 백그라운드 갱신이 필요하고 아직 아무도 맡지 않았다면 결과에 CACHE_REFRESH를 붙여 돌려주며,
+ * 그 호출자는 갱신을 마친 뒤 반드시 cache_release를 불러야 한다. 키마다 갱신은 한 번에 하나뿐이다.
+ *
+ * 키는 보통 url이지만, Vary가 있는 응답은 url 뒤에 '\n'과 요청의 해당 헤더 줄을 붙인
+ * 변형 키에 저장되고 url 자리에는 Vary 표식만 남는다. 표식을 찾으면 blob 없이 CACHE_VARY를
+ * 돌려주며 meta->vary에 헤더 이름들이 담긴다. Vary가 없는 흔한 경우는 조회 한 번으로 끝난다.
+ *
+ * hash는 url의 url_hash이다. 조회는 요청마다 하므로 url_canon이 키를 만들며 함께 계산한
+ * 값을 그대로 받는다. 원 서버를 거치는 나머지 연산은 키를 직접 해시한다.
+ */
+int cache_lookup(char *url, uint64_t hash, cache_meta_t *meta, cache_blob_t **blob);
+
+/* meta와 같은 판(크기, 검증자)인 객체의 idx번째 세그먼트 blob의 참조를 돌려준다. 없으면 NULL */
+cache_blob_t *cache_read_segment(char *url, cache_meta_t *meta, int idx);
+
+/*
+ * 작은 객체를 저장한다. blob은 cache_blob_new(meta, meta->size)로 만들어 본문을 채운 것이며,
+ * 캐시는 자기 참조를 따로 잡는다. 같은 url이 있으면 교체하고, 공간이 모자라면 LRU 순으로 내보낸다.
+ * cache_compress가 켜져 있고 텍스트 객체면 gzip으로 압축한 사본을 대신 저장한다.
+ */
+void cache_insert(char *url, cache_meta_t *meta, cache_blob_t *blob);
+
+/*
+ * 큰 객체의 idx번째 세그먼트를 채운다. 첫 클라이언트에게 흘려보내는 동안 조각이 찰 때마다
+ * 부르면 된다. 같은 판의 객체가 이미 있으면 빠진 세그먼트만 채우고, 없거나 판이 다르면
+ * create일 때만 새로 만든다.
+ */
+void cache_put_segment(char *url, cache_meta_t *meta, int idx, cache_blob_t *blob, int create);
+
+/*
+ * 304 Not Modified를 받았을 때 본문은 그대로 두고 메타데이터만 제자리에서 갱신한다.
+ * 검증자가 바뀌었으면 헤더를 다시 직렬화한다. cache_lookup처럼 지금 보낼 blob의 참조를
+ * 돌려주고 meta에는 캐시의 메타데이터 전체를 담는다. 객체가 그새 사라졌으면 NULL.
+ */
+cache_blob_t *cache_refresh(char *url, cache_meta_t *meta);
+
+/*
+ * 압축해 저장된 작은 객체의 blob(meta->zlen != 0)을 풀어 평문 200 응답 blob(참조 1)을 만든다.
+ * 성공하면 meta->zlen을 0으로 바꾼다. 데이터가 깨졌으면 NULL.
+ */
+cache_blob_t *cache_decode(cache_meta_t *meta, cache_blob_t *blob);
+
+/* url이 vary 헤더들에 따라 변형되는 자원이라는 표식을 남긴다. 같은 url의 객체는 대신한다. */
+void cache_insert_vary(char *url, char *vary);
+
+/*
+ * url을 원 서버에서 받아 오려는 요청끼리 하나로 모은다. 받아 오는 요청이 없으면 호출자를
+ * 그 요청으로 등록하고 1을 돌려주며, 호출자는 응답을 캐시에 넣은 뒤 반드시 cache_fetch_end를
+ * 부른다. 이미 있으면 0을 돌려주는데, wait이면 그 요청이 끝날 때까지(최대
+ * CACHE_COALESCE_WAIT초) 기다린 뒤 돌아오므로 호출자는 캐시를 다시 찾으면 된다.
+ */
+int cache_fetch_begin(char *url, int wait);
+void cache_fetch_end(char *url);
+
+/* cache_lookup이 맡긴 백그라운드 갱신이 끝났음(성공이든 실패든)을 알린다. */
+void cache_release(char *url);
+
+/*
+ * 캐시에 없던 url이 요청되었음을 입장 필터에 기록하고, 최근 창 안에서 cache_admit_hits번
+ * 이상 요청되었으면 1을 돌려준다. 0이면 호출자는 본문을 캐시에 넣지 않고 흘려보내기만 한다.
+ * 한 번 요청되고 마는 객체가 쓸모 있는 객체를 밀어내지 않게 한다.
+ */
+int cache_admit(char *url);
+
+/*
+ * url의 객체를 바로 지운다. 공유 영역의 사본도 지우며, Vary 표식이면 그 변형들은 url 뒤에
+ * '\n'이 붙은 키의 금지로 지운다. 공유 영역을 함께 쓰는 다른 프로세스에는 url의 금지로
+ * 알린다. 이 프로세스에서 지운 객체가 없으면 0.
+ */
+int cache_purge(char *url);
+
+/*
+ * type(CACHE_BAN_*)과 pattern에 맞는 키의 객체를 모두 무효로 한다. 캐시를 훑지 않고 다음
+ * 조회에서 하나씩 지운다. 공유 영역은 금지보다 먼저 들어간 사본을 모두 버리고, 영역을
+ * 함께 쓰는 다른 프로세스는 다음 조회 때 금지를 받아 간다.
+ * 정규식이 틀렸으면 -1, 아니면 0.
+ */
+int cache_ban(int type, char *pattern);
+
+void cache_get_stats(cache_stats_t *stats);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,174 @@
+/*
+ * hindex.c - 캐시의 URL 색인: 열린 주소법 해시 테이블 (SwissTable 방식)
+ *
+ * 해시의 위쪽 57비트(h1)로 탐색을 시작할 슬롯을, 아래 7비트(h2)를 제어 바이트의 태그로
+ * 쓴다. 탐색은 HINDEX_GROUP개 슬롯 묶음 단위로, 묶음의 제어 바이트에서 태그가 맞는
+ * 자리를 비트마스크로 얻어 그 슬롯만 들여다본다. 묶음에 빈 칸이 하나라도 있으면 더
+ * 찾을 필요가 없다. 다음 묶음은 삼각수 간격(GROUP, 2*GROUP, ...)으로 건너뛰며, 테이블
+ * 크기가 2의 거듭제곱이라 모든 묶음을 한 번씩 들른다.
+ *
+ * 제어 배열 끝에 앞쪽 GROUP바이트의 사본을 두어 어느 위치에서든 GROUP바이트를 한 번에
+ * 읽을 수 있다. 지운 칸은 탐색이 끊기지 않도록 빈 칸과 다른 표시로 남기며, 항목과 지운
+ * 칸이 7/8을 넘으면 새 테이블로 옮긴다(항목이 적으면 같은 크기로 옮겨 지운 칸만 치운다).
+ *
+ * SSE2가 없는 빌드에서는 같은 비교를 바이트 단위 반복문으로 한다.
+ */
+#include "csapp.h"
+#include "hindex.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe               /* 최상위 비트가 1이면 빈 칸이나 지운 칸 */
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7f))
+
+/* 묶음의 제어 바이트 중 b와 같은 자리의 비트마스크 */
+static inline unsigned group_match(const uint8_t *g, uint8_t b)
+{
+#ifdef __SSE2__
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)g),
+                                                    _mm_set1_epi8((char)b)));
+#else
+  unsigned m = 0;
+  int i;
+
+  for (i = 0; i < HINDEX_GROUP; i++)
+    if (g[i] == b)
+      m |= 1u << i;
+  return m;
+#endif
+}
+
+/* 묶음에서 빈 칸이나 지운 칸인 자리의 비트마스크 */
+static inline unsigned group_free(const uint8_t *g)
+{
+#ifdef __SSE2__
+  return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+#else
+  unsigned m = 0;
+  int i;
+
+  for (i = 0; i < HINDEX_GROUP; i++)
+    if (g[i] & 0x80)
+      m |= 1u << i;
+  return m;
+#endif
+}
+
+/* 제어 바이트를 쓰고, 앞쪽 GROUP바이트면 끝의 사본도 맞춘다 */
+static void set_ctrl(hindex_t *ix, size_t i, uint8_t c)
+{
+  ix->ctrl[i] = c;
+  ix->ctrl[((i - HINDEX_GROUP) & (ix->cap - 1)) + HINDEX_GROUP] = c;
+}
+
+void hindex_init(hindex_t *ix, size_t cap)
+{
+  ix->cap = HINDEX_MIN_CAP;
+  while (ix->cap < cap)
+    ix->cap <<= 1;
+  ix->ctrl = Malloc(ix->cap + HINDEX_GROUP);
+  memset(ix->ctrl, CTRL_EMPTY, ix->cap + HINDEX_GROUP);
+  ix->slots = Malloc(ix->cap * sizeof(hindex_slot_t));
+  ix->size = ix->tombs = 0;
+}
+
+void hindex_free(hindex_t *ix)
+{
+  Free(ix->ctrl);
+  Free(ix->slots);
+  ix->ctrl = NULL;
+  ix->slots = NULL;
+  ix->cap = ix->size = ix->tombs = 0;
+}
+
+void *hindex_find(hindex_t *ix, uint64_t hash, hindex_match_t match, void *key)
+{
+  size_t mask = ix->cap - 1, pos = H1(hash) & mask, step = 0, i;
+  uint8_t tag = H2(hash);
+  const uint8_t *g;
+  unsigned m;
+
+  while (1) {
+    g = ix->ctrl + pos;
+    for (m = group_match(g, tag); m; m &= m - 1) {
+      i = (pos + __builtin_ctz(m)) & mask;
+      if (ix->slots[i].hash == hash && match(ix->slots[i].val, key))
+        return ix->slots[i].val;
+    }
+    if (group_match(g, CTRL_EMPTY))
+      return NULL;
+    step += HINDEX_GROUP;
+    pos = (pos + step) & mask;
+  }
+}
+
+/* hash가 들어갈 첫 빈 칸이나 지운 칸 */
+static size_t find_free(hindex_t *ix, uint64_t hash)
+{
+  size_t mask = ix->cap - 1, pos = H1(hash) & mask, step = 0;
+  unsigned m;
+
+  while (!(m = group_free(ix->ctrl + pos))) {
+    step += HINDEX_GROUP;
+    pos = (pos + step) & mask;
+  }
+  return (pos + __builtin_ctz(m)) & mask;
+}
+
+static void rehash(hindex_t *ix, size_t cap)
+{
+  hindex_t old = *ix;
+  size_t i, j;
+
+  hindex_init(ix, cap);
+  for (i = 0; i < old.cap; i++)
+    if (!(old.ctrl[i] & 0x80)) {
+      j = find_free(ix, old.slots[i].hash);
+      set_ctrl(ix, j, H2(old.slots[i].hash));
+      ix->slots[j] = old.slots[i];
+      ix->size++;
+    }
+  hindex_free(&old);
+}
+
+void hindex_insert(hindex_t *ix, uint64_t hash, void *val)
+{
+  size_t i;
+
+  if ((ix->size + ix->tombs + 1) * 8 > ix->cap * 7)
+    rehash(ix, (ix->size + 1) * 16 > ix->cap * 7 ? ix->cap * 2 : ix->cap);
+  i = find_free(ix, hash);
+  if (ix->ctrl[i] == CTRL_DELETED)
+    ix->tombs--;
+  set_ctrl(ix, i, H2(hash));
+  ix->slots[i].hash = hash;
+  ix->slots[i].val = val;
+  ix->size++;
+}
+
+int hindex_remove(hindex_t *ix, uint64_t hash, void *val)
+{
+  size_t mask = ix->cap - 1, pos = H1(hash) & mask, step = 0, i;
+  const uint8_t *g;
+  unsigned m;
+
+  while (1) {
+    g = ix->ctrl + pos;
+    for (m = group_match(g, H2(hash)); m; m &= m - 1) {
+      i = (pos + __builtin_ctz(m)) & mask;
+      if (ix->slots[i].val == val) {
+        set_ctrl(ix, i, CTRL_DELETED);
+        ix->size--;
+        ix->tombs++;
+        return 1;
+      }
+    }
+    if (group_match(g, CTRL_EMPTY))
+      return 0;
+    step += HINDEX_GROUP;
+    pos = (pos + step) & mask;
+  }
+}
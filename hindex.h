@@ -0,0 +1,46 @@
+/*
+ * hindex.h - 캐시의 URL 색인: 열린 주소법 해시 테이블 (SwissTable 방식)
+ *
+ * 항목은 64비트 해시와 값 포인터만 담은 슬롯 배열에 바로 놓이고, 슬롯마다 1바이트 제어
+ * 바이트(빈 칸, 지운 칸, 또는 해시의 아래 7비트 태그)를 따로 둔다. 찾을 때는 제어 바이트
+ * 16개를 SSE2로 한 번에 태그와 비교하고, 태그가 맞은 슬롯만 64비트 해시를 비교한 뒤
+ * 키를 확인한다. 체인을 따라 노드마다 캐시 미스를 내는 일이 없다.
+ */
+#ifndef __HINDEX_H__
+#define __HINDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HINDEX_GROUP 16         /* 한 번에 훑는 제어 바이트 수 (SSE2 레지스터 하나) */
+#define HINDEX_MIN_CAP 16
+
+typedef struct {
+  uint64_t hash;
+  void *val;
+} hindex_slot_t;
+
+typedef struct {
+  uint8_t *ctrl;                /* cap + HINDEX_GROUP 바이트. 끝의 GROUP바이트는 앞쪽의 사본 */
+  hindex_slot_t *slots;
+  size_t cap;                   /* 슬롯 수 (2의 거듭제곱) */
+  size_t size;                  /* 든 항목 수 */
+  size_t tombs;                 /* 지운 칸 수 */
+} hindex_t;
+
+/* 값 val이 찾는 키 key의 것인지. 64비트 해시가 같을 때만 불린다 */
+typedef int (*hindex_match_t)(void *val, void *key);
+
+void hindex_init(hindex_t *ix, size_t cap);
+void hindex_free(hindex_t *ix);
+
+/* hash이고 match(val, key)가 참인 값을 찾는다. 없으면 NULL */
+void *hindex_find(hindex_t *ix, uint64_t hash, hindex_match_t match, void *key);
+
+/* 값을 넣는다. 같은 키가 이미 있는지는 호출자가 먼저 확인한다 */
+void hindex_insert(hindex_t *ix, uint64_t hash, void *val);
+
+/* hash로 넣었던 값 val을 지운다. 없으면 0 */
+int hindex_remove(hindex_t *ix, uint64_t hash, void *val);
+
+#endif /* __HINDEX_H__ */
@@ -1,40 +1,168 @@
+#define _XOPEN_SOURCE 700   /* strptime */
+#define _DEFAULT_SOURCE     /* timegm */
 #include <stdio.h>
+#include <limits.h>
 #include "csapp.h"
+#include "cache.h"
+#include "shmcache.h"
+#include "slab.h"
+#include "url.h"
+#include "sendall.h"
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+/* 원 서버 응답 헤더에서 뽑아낸 정보 */
+typedef struct {
+  int status;                   /* 상태 코드 */
+  long clen;                    /* Content-length (없으면 -1) */
+  int nostore;                  /* Cache-Control: no-store, no-cache, private */
+  int hot;                      /* X-Cache-Hot: 원 서버가 입장 필터를 건너뛰라고 표시한 객체 */
+  int varyall;                  /* Vary: * (어떤 요청 헤더로도 변형을 가릴 수 없다) */
+  long maxage;                  /* Cache-Control: max-age (없으면 -1) */
+  time_t expires;               /* Expires (없으면 0) */
+  long range_first, range_last; /* 206의 Content-Range: bytes first-last/total */
+  long range_total;
+  cache_meta_t meta;
+} resp_t;
+
+/* 클라이언트가 요청한 바이트 범위 (양 끝 포함) */
+typedef struct {
+  size_t first, last;
+} range_t;
+
+#define MAX_RANGES 8            /* 이보다 많은 범위를 요청하면 Range를 무시하고 전체를 준다 */
+#define BYTERANGES_BOUNDARY "PROXY_BYTERANGES"
+
+/* 백그라운드 갱신 작업: 재검증에 필요한 것만 담는다 */
+typedef struct {
+  char url[MAXLINE];
+  char host[MAXLINE];
+  cache_meta_t meta;            /* 조건부 요청에 쓸 검증자 */
+} refresh_job_t;
+
+/* -u prefix=secs: 경로가 prefix로 시작하는 동적 응답을 짧게 캐시하는 규칙 */
+typedef struct {
+  char prefix[MAXLINE];
+  int ttl;
+} micro_rule_t;
+
+#define MAX_MICRO_RULES 16
+#define ADMIN_PREFIX "/proxy-admin/"  /* 이 경로로 온 요청은 프록시 자신이 처리한다 */
+
+#define REFRESH_NTHREADS 2      /* 백그라운드 갱신 작업자 수 */
+#define REFRESH_QSIZE 64        /* 대기열이 차면 새 갱신 요청은 버린다 */
 
 void doit(int fd);
 void parse_uri(char *url, char *hostname, char *port, char *filename);
+int build_request(char *req, char *method, char *filename, char *host,
+                  cache_meta_t *stale, char *hdrs);
+void read_requesthdrs(rio_t *rp, char *hdrs, char *host, char *range);
+int read_resphdrs(rio_t *rp, resp_t *resp, char *hdrs);
+void forward_response(int server_fd, int fd, char *url, int cacheable,
+                      cache_meta_t *stale, cache_blob_t *blob, char *range, char *reqhdrs);
+void serve_cached(int fd, char *url, cache_meta_t *meta, cache_blob_t *blob, char *range);
+int parse_range(char *spec, size_t size, range_t *ranges);
+void serve_ranges(int fd, char *url, cache_meta_t *meta, cache_blob_t *blob, range_t *ranges, int nranges);
+long send_body(int fd, char *url, cache_meta_t *meta, cache_blob_t *blob, size_t first, size_t last);
+cache_blob_t *fetch_segment(char *url, cache_meta_t *meta, int idx, int probe);
+void fetch_remainder(int fd, char *url, size_t offset);
+int variant_key(char *url, char *vary, char *reqhdrs, char *key);
+static void split_key(char *key, char *url, char *vhdrs);
+static cache_blob_t *decode_for(char *reqhdrs, char *range, cache_meta_t *meta, cache_blob_t *blob);
+static int lookup_cached(char *url, uint64_t hash, char *key, char *host, char *hdrs, char *range,
+                         cache_meta_t *meta, cache_blob_t **blob);
+static int micro_ttl(char *url);
+static int dynamic_url(char *url);
+static void admin(int fd, char *method, char *url);
+static int from_loopback(int fd);
+static int query_arg(char *url, char *name, char *val);
+static void admin_reply(int fd, char *status, char *msg);
+static void admin_stats(int fd);
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
 void *thread(void *vargp);
+static void copy_hdrval(char *dst, char *val, size_t size);
+void refresh_init(void);
+void refresh_enqueue(char *url, char *host, cache_meta_t *meta);
+void *refresh_thread(void *vargp);
+
+static refresh_job_t *refresh_q[REFRESH_QSIZE];   /* 갱신 작업 원형 대기열 */
+static int refresh_front, refresh_rear;
+static sem_t refresh_mutex, refresh_slots, refresh_items;
+static micro_rule_t micro_rules[MAX_MICRO_RULES];
+static int nmicro_rules;
 
-// /* You won't lose style points for including this long line in your code */
-// static const char *user_agent_hdr =
-//     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
-//     "Firefox/10.0.3\r\n";
+/* You won't lose style points for including this long line in your code */
+static const char *user_agent_hdr =
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
+    "Firefox/10.0.3\r\n";
 
 int main(int argc, char **argv) {
-  int listenfd, *connfdp;
-  char hostname[MAXLINE], port[MAXLINE];
+  int listenfd, *connfdp, opt;
+  char hostname[MAXLINE], port[MAXLINE], *shm_name = NULL, *eq;
   socklen_t clientlen;
   pthread_t tid;
   struct sockaddr_storage clientaddr;
 
   /* Check command line args */
-  if (argc != 2) {                       
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+  while ((opt = getopt(argc, argv, "t:sr:c:m:a:zu:H")) != -1) {
+    switch (opt) {
+    case 't':                           // 만료 정보가 없는 응답의 신선도 수명(초)
+      cache_default_ttl = atoi(optarg);
+      break;
+    case 's':                           // stale-while-revalidate
+      cache_swr = 1;
+      break;
+    case 'r':                           // 인기 객체를 만료 몇 초 전부터 미리 갱신할지
+      cache_prefetch = atoi(optarg);
+      break;
+    case 'c':                           // 캐시 전체 예산(바이트)
+      cache_max_size = atol(optarg);
+      break;
+    case 'a':                           // 창 안에서 몇 번 요청된 객체부터 캐시할지 (1이면 모두)
+      cache_admit_hits = atoi(optarg);
+      break;
+    case 'm':                           // 이 이름의 공유 메모리 캐시를 다른 프록시 프로세스와 함께 쓴다
+      shm_name = optarg;
+      break;
+    case 'z':                           // 텍스트 객체를 gzip으로 압축해 저장
+      cache_compress = 1;
+      break;
+    case 'H':                           // 캐시 저장소를 2MB 휴즈 페이지로
+      slab_hugepages = 1;
+      break;
+    case 'u':                           // 마이크로 캐시 규칙: -u /cgi-bin/=1 (여러 번 줄 수 있다)
+      if (!(eq = strrchr(optarg, '=')) || eq == optarg || eq - optarg >= MAXLINE ||
+          nmicro_rules == MAX_MICRO_RULES) {
+        fprintf(stderr, "%s: bad micro-cache rule %s (want /prefix=secs)\n", argv[0], optarg);
+        exit(1);
+      }
+      memcpy(micro_rules[nmicro_rules].prefix, optarg, eq - optarg);
+      micro_rules[nmicro_rules].prefix[eq - optarg] = '\0';
+      micro_rules[nmicro_rules++].ttl = atoi(eq + 1);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-t ttl] [-s] [-r secs] [-c bytes] [-a hits] [-m shmname] [-z] [-u prefix=secs] [-H] <port>\n", argv[0]);
+      exit(1);
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-t ttl] [-s] [-r secs] [-c bytes] [-a hits] [-m shmname] [-z] [-u prefix=secs] [-H] <port>\n", argv[0]);
     exit(1);
   }
 
-  listenfd = Open_listenfd(argv[1]);      // 듣기 식별자 생성
-  while (1) {                             
+  Signal(SIGPIPE, SIG_IGN);               // 클라이언트가 먼저 끊어도 프록시가 죽지 않도록
+  cache_init();
+  if (shm_name && shm_cache_open(shm_name, cache_max_size) < 0) {
+    fprintf(stderr, "%s: can't open shared memory cache %s: %s\n", argv[0], shm_name, strerror(errno));
+    exit(1);
+  }
+  refresh_init();
+  listenfd = Open_listenfd(argv[optind]); // 듣기 식별자 생성
+  while (1) {
     clientlen = sizeof(clientaddr);
-    connfdp = Malloc(sizeof(int));       
-    *connfdp = Accept(listenfd, (SA *)&clientaddr,      
+    connfdp = Malloc(sizeof(int));
+    *connfdp = Accept(listenfd, (SA *)&clientaddr,
                     &clientlen);
     Pthread_create(&tid, NULL, thread, connfdp);   // &tid: 쓰레드 객체   thread: 쓰레드가 하게될 작업   connfdp: thread에 들어갈 인자
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 
+    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
                 0);
     printf("Accepted connection from (%s, %s)\n", hostname, port);
   }
@@ -43,53 +171,337 @@ int main(int argc, char **argv) {
 
 void doit(int fd)
 {
-  int server_fd;
-  char buf[MAXLINE], sbuf[MAX_OBJECT_SIZE], method[MAXLINE], url[MAXLINE], version[MAXLINE];
-  char hostname[MAXLINE], port[MAXLINE], filename[MAXLINE];                           
-  rio_t rio , servrio;
+  int server_fd, rc = CACHE_MISS, cacheable, n, micro, lead = 0;
+  char buf[MAXLINE], method[MAXLINE], url[MAXLINE], version[MAXLINE], key[MAXLINE];
+  char hostname[MAXLINE], port[MAXLINE], filename[MAXLINE], host[MAXLINE];
+  char hdrs[MAXBUF], req[MAXLINE + 2 * MAXBUF], range[MAXLINE];
+  cache_blob_t *blob = NULL;
+  size_t first = 0;
+  cache_meta_t meta;
+  uint64_t hash;
+  rio_t rio;
 
   //클라이언트로부터 요청을 받는부분
   /* Read request line and headers */
-  Rio_readinitb(&rio, fd);                                          
-  Rio_readlineb(&rio, buf, MAXLINE);                    
+  Rio_readinitb(&rio, fd);
+  if (rio_readlineb(&rio, buf, MAXLINE) <= 0)
+    return;
   printf("Request headers:\n");
-  printf("%s", buf);                                    
-  sscanf(buf, "%s %s %s", method, url, version);
+  printf("%s", buf);
+  if (sscanf(buf, "%s %s %s", method, url, version) != 3 ||
+      (!strstr(url, "://") && strncmp(url, ADMIN_PREFIX, strlen(ADMIN_PREFIX)))) {
+    clienterror(fd, url, "400", "Bad request", "Proxy couldn't parse the request");
+    return;
+  }
+  if (!strncmp(url, ADMIN_PREFIX, strlen(ADMIN_PREFIX)) || !strcasecmp(method, "PURGE")) {
+    read_requesthdrs(&rio, hdrs, host, range);
+    admin(fd, method, url);
+    return;
+  }
+  hash = url_canon(url, buf);           // 같은 자원이 늘 같은 캐시 키가 되도록
+  strcpy(url, buf);
   parse_uri(url, hostname, port, filename);
-  printf("%s %s \n", hostname, port);
+  read_requesthdrs(&rio, hdrs, host, range);
+  if (!host[0]) {                       // 클라이언트가 Host를 안 보냈으면 URL에서 만든다
+    strcpy(host, hostname);
+    strcat(host, ":");
+    strcat(host, port);
+  }
+
+  // GET 응답만 캐시한다. 신선한 객체는 원 서버에 가지 않고 바로 응답
+  cacheable = !strcasecmp(method, "GET");
+  micro = cacheable ? micro_ttl(url) : -1;
+  strcpy(key, url);
+  if (cacheable) {
+    rc = lookup_cached(url, hash, key, host, hdrs, range, &meta, &blob);
+    // 마이크로 캐시 경로는 같은 키를 받아 오는 요청을 하나로 모은다. 이미 누가 받아 오는
+    // 중이면 오래된 사본은 그대로 주고, 사본이 없으면 그 응답을 기다렸다가 다시 찾는다
+    if (micro >= 0 && rc != CACHE_FRESH && !(rc == CACHE_STALE && cache_swr)) {
+      if (cache_fetch_begin(key, rc == CACHE_MISS))
+        lead = 1;
+      else if (rc == CACHE_MISS)
+        rc = lookup_cached(url, hash, key, host, hdrs, range, &meta, &blob);
+    }
+    if (rc == CACHE_FRESH || (rc == CACHE_STALE && (cache_swr || (micro >= 0 && !lead)))) {
+      serve_cached(fd, key, &meta, blob, range);
+      cache_blob_put(blob);
+      return;
+    }
+  }
+
+  // 캐시에 없는 객체의 범위 요청: 첫 범위가 든 세그먼트만 Range로 받아 크기를 알아내고,
+  // 나머지 필요한 세그먼트도 그 범위만 받아 채운다. 원 서버가 Range를 모르면 전체를 받는다.
+  // 받은 세그먼트는 입장 필터에 걸려 캐시에 못 들어갔더라도 이 응답에는 그대로 쓴다.
+  // 작은 객체라면 그 blob이 곧 헤더까지 갖춘 전체 응답이다.
+  if (cacheable && rc == CACHE_MISS && range[0]) {
+    sscanf(range, "bytes=%zu-", &first);
+    if ((blob = fetch_segment(key, &meta, first / CACHE_SEGMENT_SIZE, 1))) {
+      serve_cached(fd, key, &meta, blob, range);
+      goto done;
+    }
+  }
 
 // proxy와 tiny 연결해서 요청 보내기
-  server_fd = Open_clientfd(hostname, port);
-  Rio_readinitb(&servrio, server_fd);
+  if ((server_fd = open_clientfd(hostname, port)) < 0) {
+    if (rc == CACHE_STALE)              // 원 서버가 죽어 있으면 오래된 사본이라도 준다
+      serve_cached(fd, key, &meta, blob, range);
+    else
+      clienterror(fd, hostname, "502", "Bad gateway", "Proxy couldn't connect to the server");
+    goto done;
+  }
 
-  //sprintf(buf, "%s", oldurl);
-  
-  // tiny에 보낼 헤더 작성
-  sprintf(buf, "GET %s HTTP/1.0\r\n", filename);
-  sprintf(buf, "%sHOST: %s:%s\r\n", buf, hostname, port);
-  sprintf(buf, "%sUser-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n", buf);
-  sprintf(buf, "%sConnection: close\r\n", buf);
-  sprintf(buf, "%sProxy-Connection: close\r\n\r\n", buf);
-  Rio_writen(server_fd, buf, strlen(buf));
-  // tiny에서 proxy응답 받는 부분
-  Rio_readnb(&servrio, sbuf, MAX_OBJECT_SIZE); //수정 전 &rio
+  n = build_request(req, method, filename, host, rc == CACHE_STALE ? &meta : NULL, hdrs);
+  if (rio_writen(server_fd, req, n) == n)
+    forward_response(server_fd, fd, key, cacheable,
+                     rc == CACHE_STALE ? &meta : NULL, blob, range, hdrs);
+  Close(server_fd);
+ done:
+  if (lead)                             // 기다리던 요청들을 깨운다
+    cache_fetch_end(key);
+  if (blob)
+    cache_blob_put(blob);
+}
 
-  // 클라이언트로 응답 보내기
-  // Rio_writen(fd, sbuf, strlen(sbuf));
-  Rio_writen(fd, sbuf, MAX_OBJECT_SIZE);
+/*
+ * lookup_cached - 캐시에서 url(해시는 hash)을 찾아 결과(CACHE_MISS/FRESH/STALE)를 돌려준다.
+ *     Vary 표식이 있으면 이 요청의 헤더(hdrs)로 변형 키를 만들어 한 번 더 찾으며, 실제로
+ *     찾은 키를 key에 남긴다. 백그라운드 갱신을 맡았으면 작업자에게 넘기고, 압축된 객체는
+ *     이 요청에 맞게 푼다.
+ */
+static int lookup_cached(char *url, uint64_t hash, char *key, char *host, char *hdrs, char *range,
+                         cache_meta_t *meta, cache_blob_t **blob)
+{
+  int rc;
 
-  printf("Response headers:\n");
+  strcpy(key, url);
+  rc = cache_lookup(key, hash, meta, blob);
+  if (rc == CACHE_VARY)
+    rc = (variant_key(url, meta->vary, hdrs, key) < 0) ? CACHE_MISS :
+      cache_lookup(key, url_hash(key), meta, blob);
+  if (rc & CACHE_REFRESH)
+    refresh_enqueue(key, host, meta);
+  rc &= ~CACHE_REFRESH;
+  if (rc != CACHE_MISS && !(*blob = decode_for(hdrs, range, meta, *blob)))
+    rc = CACHE_MISS;
+  return rc;
+}
 
-  Close(server_fd);
+/*
+ * micro_ttl - url(절대 URL이나 캐시 키)의 경로에 맞는 마이크로 캐시 규칙의 수명(초).
+ *     먼저 준 규칙이 이기며, 맞는 규칙이 없으면 -1.
+ */
+static int micro_ttl(char *url)
+{
+  char *path = strstr(url, "://");
+  int i;
+
+  if (!path || !(path = strchr(path + 3, '/')))
+    return -1;
+  for (i = 0; i < nmicro_rules; i++)
+    if (!strncmp(path, micro_rules[i].prefix, strlen(micro_rules[i].prefix)))
+      return micro_rules[i].ttl;
+  return -1;
+}
+
+/*
+ * dynamic_url - url(절대 URL이나 캐시 키)이 쿼리를 달았거나 /cgi-bin/ 아래에 있으면 1.
+ *     이런 응답에는 원 서버가 밝히지 않은 한 기본 수명(-t)을 주지 않는다.
+ */
+static int dynamic_url(char *url)
+{
+  char *path = strstr(url, "://"), *end;
+
+  if (!path || !(path = strchr(path + 3, '/')))
+    return 0;
+  if (!(end = strchr(path, '\n')))      // 변형 키면 URL 부분만 본다
+    end = path + strlen(path);
+  return memchr(path, '?', end - path) != NULL || !strncmp(path, "/cgi-bin/", 9);
+}
+
+/*
+ * admin - 프록시 자신에게 온 관리 요청을 처리한다. 루프백에서 온 것만 받는다.
+ *   PURGE <url>                      url의 객체를 지운다 (Squid, Varnish와 같은 방식)
+ *   GET /proxy-admin/purge?url=<url>     위와 같다
+ *   GET /proxy-admin/purge?host=<host>   그 호스트의 객체를 모두 무효로
+ *   GET /proxy-admin/ban?prefix=<url>    url로 시작하는 객체를 모두 무효로
+ *   GET /proxy-admin/ban?regex=<ERE>     URL이 정규식에 맞는 객체를 모두 무효로
+ * 값은 퍼센트 인코딩해 보낸다. URL과 호스트는 캐시 키와 같게 정규화한 뒤 쓴다.
+ */
+static void admin(int fd, char *method, char *url)
+{
+  char val[MAXLINE], key[MAXLINE + 16], msg[MAXLINE + 64];
+  char *purge = ADMIN_PREFIX "purge?", *ban = ADMIN_PREFIX "ban?", *stats = ADMIN_PREFIX "stats";
+
+  if (!from_loopback(fd)) {
+    clienterror(fd, url, "403", "Forbidden", "Admin requests are accepted only from localhost");
+    return;
+  }
+  if (!strcasecmp(method, "PURGE") && strstr(url, "://")) {
+    url_canon(url, key);
+    sprintf(msg, "%s %s\n", cache_purge(key) ? "purged" : "not cached", key);
+    admin_reply(fd, strncmp(msg, "purged", 6) ? "404 Not Found" : "200 OK", msg);
+  }
+  else if (!strncmp(url, purge, strlen(purge)) && query_arg(url, "url", val)) {
+    url_canon(val, key);
+    sprintf(msg, "%s %s\n", cache_purge(key) ? "purged" : "not cached", key);
+    admin_reply(fd, strncmp(msg, "purged", 6) ? "404 Not Found" : "200 OK", msg);
+  }
+  else if (!strncmp(url, purge, strlen(purge)) && query_arg(url, "host", val)) {
+    sprintf(msg, "http://%s/", val);    // 캐시 키의 호스트처럼 소문자로, 기본 포트 없이
+    url_canon(msg, key);
+    key[7 + strcspn(key + 7, "/")] = '\0';
+    cache_ban(CACHE_BAN_HOST, key + 7);
+    sprintf(msg, "banned host %s\n", key + 7);
+    admin_reply(fd, "200 OK", msg);
+  }
+  else if (!strncmp(url, ban, strlen(ban)) && query_arg(url, "prefix", val)) {
+    if (strstr(val, "://"))             // 경로 일부만 준 접두사는 정규화하지 않는다
+      url_canon(val, key);
+    else
+      strcpy(key, val);
+    cache_ban(CACHE_BAN_PREFIX, key);
+    sprintf(msg, "banned prefix %s\n", key);
+    admin_reply(fd, "200 OK", msg);
+  }
+  else if (!strncmp(url, ban, strlen(ban)) && query_arg(url, "regex", val)) {
+    if (cache_ban(CACHE_BAN_REGEX, val) < 0) {
+      sprintf(msg, "bad regex %s\n", val);
+      admin_reply(fd, "400 Bad Request", msg);
+    }
+    else {
+      sprintf(msg, "banned regex %s\n", val);
+      admin_reply(fd, "200 OK", msg);
+    }
+  }
+  else if (!strcmp(url, stats))
+    admin_stats(fd);
+  else
+    clienterror(fd, url, "404", "Not found", "Unknown admin request");
+}
+
+/*
+ * admin_stats - 캐시와 슬랩 할당기의 회계를 "이름 값" 줄로 돌려준다. 크기는 바이트이고,
+ *     슬랩 등급은 페이지나 조각을 쥔 것만 적는다.
+ */
+static void admin_stats(int fd)
+{
+  char msg[MAXBUF - 256];
+  cache_stats_t cst;
+  slab_stats_t sst;
+  int i, n;
+
+  cache_get_stats(&cst);
+  slab_get_stats(&sst);
+  n = sprintf(msg, "budget %zu\nsize %zu\n", cache_max_size, cst.size);
+  n += sprintf(msg + n, "inserts %lu\nevictions %lu\nreclaimed %lu\ninline_evictions %lu\n",
+               cst.inserts, cst.evictions, cst.reclaimed, cst.inline_evictions);
+  n += sprintf(msg + n, "rejects %lu\ncoalesced %lu\npurges %lu\nbans %lu\nbanned %lu\n",
+               cst.rejects, cst.coalesced, cst.purges, cst.bans, cst.banned);
+  n += sprintf(msg + n, "zipped %lu\nzip_in %lu\nzip_out %lu\n", cst.zipped, cst.zip_in, cst.zip_out);
+  n += sprintf(msg + n, "slab %s\nslab_page %zu\nslab_max_chunk %zu\nslab_mapped %zu\nslab_used %zu\n",
+               slab_enabled ? "on" : "off", sst.page, sst.max_chunk, sst.mapped, sst.used);
+  n += sprintf(msg + n, "slab_pages %lu\nslab_empty %lu\nslab_moves %lu\n", sst.pages, sst.empty, sst.moves);
+  for (i = 0; i < sst.nclasses; i++)
+    if (sst.cls_pages[i] || sst.cls_used[i])
+      n += sprintf(msg + n, "slab_class %zu pages %lu used %lu\n",
+                   sst.chunk[i], sst.cls_pages[i], sst.cls_used[i]);
+  admin_reply(fd, "200 OK", msg);
+}
+
+/* from_loopback - fd의 상대가 127.0.0.0/8이나 ::1(v4 매핑 포함)이면 1 */
+static int from_loopback(int fd)
+{
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  struct in6_addr *a6;
+
+  if (getpeername(fd, (SA *)&addr, &len) < 0)
+    return 0;
+  if (addr.ss_family == AF_INET)
+    return (ntohl(((struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24) == 127;
+  if (addr.ss_family == AF_INET6) {
+    a6 = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+    return IN6_IS_ADDR_LOOPBACK(a6) || (IN6_IS_ADDR_V4MAPPED(a6) && a6->s6_addr[12] == 127);
+  }
+  return 0;
+}
+
+/*
+ * query_arg - url의 질의에서 name=값을 찾아 퍼센트 인코딩과 '+'를 풀어 val에 쓴다.
+ *     없으면 0.
+ */
+static int query_arg(char *url, char *name, char *val)
+{
+  char *p = strchr(url, '?');
+  size_t n = strlen(name);
+  int hi, lo;
+
+  while (p) {
+    p++;
+    if (!strncmp(p, name, n) && p[n] == '=') {
+      for (p += n + 1; *p && *p != '&'; p++)
+        if (*p == '%' && isxdigit(p[1]) && isxdigit(p[2])) {
+          hi = isdigit(p[1]) ? p[1] - '0' : tolower(p[1]) - 'a' + 10;
+          lo = isdigit(p[2]) ? p[2] - '0' : tolower(p[2]) - 'a' + 10;
+          *val++ = hi * 16 + lo;
+          p += 2;
+        }
+        else
+          *val++ = *p == '+' ? ' ' : *p;
+      *val = '\0';
+      return 1;
+    }
+    p = strchr(p, '&');
+  }
+  return 0;
+}
+
+/* admin_reply - 관리 요청에 text/plain 응답을 보낸다 */
+static void admin_reply(int fd, char *status, char *msg)
+{
+  char buf[MAXBUF];
+  int n;
+
+  n = snprintf(buf, sizeof(buf), "HTTP/1.0 %s\r\nContent-type: text/plain\r\n"
+               "Content-length: %d\r\nConnection: close\r\n\r\n%s",
+               status, (int)strlen(msg), msg);
+  rio_writen(fd, buf, n);
+}
+
+/*
+ * build_request - 원 서버(tiny)에 보낼 요청을 req에 만들고 길이를 돌려준다.
+ *     stale이 주어지면 그 검증자로 조건부 요청을 만든다.
+ */
+int build_request(char *req, char *method, char *filename, char *host,
+                  cache_meta_t *stale, char *hdrs)
+{
+  int n;
+
+  // tiny에 보낼 헤더 작성
+  n = sprintf(req, "%s %s HTTP/1.0\r\n", method, filename);
+  n += sprintf(req + n, "Host: %s\r\n", host);
+  n += sprintf(req + n, "%s", user_agent_hdr);
+  n += sprintf(req + n, "Connection: close\r\n");
+  n += sprintf(req + n, "Proxy-Connection: close\r\n");
+  if (stale) {                          // 오래된 객체는 조건부 요청으로 재검증
+    if (stale->etag[0])
+      n += sprintf(req + n, "If-None-Match: %s\r\n", stale->etag);
+    if (stale->lastmod[0])
+      n += sprintf(req + n, "If-Modified-Since: %s\r\n", stale->lastmod);
+  }
+  n += sprintf(req + n, "%s\r\n", hdrs);
+  return n;
 }
 
 void parse_uri(char *url, char *hostname, char *port, char *filename)
 {
   char *p;
   char arg1[MAXLINE], arg2[MAXLINE];
-  
+
   p = strchr(url, '/');
   strcpy(arg1, p+2);              // hostname:port/home.html
+  if (!strchr(arg1, '/'))         // hostname:port 처럼 경로가 없으면 "/"
+    strcat(arg1, "/");
 
   if (strstr(arg1, ":")) {
 
@@ -104,16 +516,710 @@ void parse_uri(char *url, char *hostname, char *port, char *filename)
     *p = '/';
     strcpy(filename, p);          // /home.html
   }
-  
+
   else {                          // hostname/home.html
     p = strchr(arg1, '/');
     *p = '\0';
     strcpy(hostname, arg1);
     *p ='/';
     strcpy(filename, p);
+    strcpy(port, "80");
+  }
+}
+
+/* Accept-Encoding 값에 q=0이 아닌 gzip이 들어 있는지 */
+static int accepts_gzip(char *val)
+{
+  char *p = val, *q;
+
+  while (1) {
+    p += strspn(p, " \t");
+    if (!strncasecmp(p, "gzip", 4) && strchr(" \t;,\r\n", p[4])) {
+      q = p + 4 + strspn(p + 4, " \t");
+      if (*q != ';')
+        return 1;
+      q += 1 + strspn(q + 1, " \t");
+      return strncasecmp(q, "q=", 2) || atof(q + 2) > 0;
+    }
+    p += strcspn(p, ",\r\n");
+    if (*p++ != ',')
+      return 0;
+  }
+}
+
+/* Accept-Language 값에서 첫 언어의 주 태그(en-US면 en)를 소문자로 lang에 담는다. 없으면 0 */
+static int primary_lang(char *val, char *lang)
+{
+  int n = 0;
+
+  val += strspn(val, " \t");
+  while (isalpha((unsigned char)val[n]) && n < 8) {
+    lang[n] = tolower(val[n]);
+    n++;
+  }
+  lang[n] = '\0';
+  return n;
+}
+
+/*
+ * read_requesthdrs - 클라이언트 요청 헤더를 읽어 원 서버로 그대로 넘길 것만 hdrs에 모은다.
+ *     프록시가 직접 쓰는 헤더와, 캐시가 전체 본문을 받아야 하므로 조건부/범위 헤더는 뺀다.
+ *     Range 값은 프록시가 캐시에서 직접 답하도록 range에 따로 담는다.
+ *     Vary에 흔히 오르는 Accept-Encoding과 Accept-Language는 캐시 변형 수가 늘지 않도록
+ *     정규화해서 넘긴다: gzip을 받는지 여부와 첫 언어의 주 태그만 남는다.
+ */
+void read_requesthdrs(rio_t *rp, char *hdrs, char *host, char *range)
+{
+  char buf[MAXLINE], lang[16];
+  size_t n = 0, len;
+
+  hdrs[0] = host[0] = range[0] = '\0';
+  while (rio_readlineb(rp, buf, MAXLINE) > 0 && strcmp(buf, "\r\n")) {
+    if (!strncasecmp(buf, "Host:", 5)) {
+      sscanf(buf + 5, "%s", host);
+      continue;
+    }
+    if (!strncasecmp(buf, "Range:", 6)) {
+      copy_hdrval(range, buf + 6, MAXLINE);
+      continue;
+    }
+    if (!strncasecmp(buf, "User-Agent:", 11) || !strncasecmp(buf, "Connection:", 11) ||
+        !strncasecmp(buf, "Proxy-Connection:", 17) || !strncasecmp(buf, "If-Modified-Since:", 18) ||
+        !strncasecmp(buf, "If-None-Match:", 14) || !strncasecmp(buf, "If-Range:", 9))
+      continue;
+    if (!strncasecmp(buf, "Accept-Encoding:", 16)) {
+      if (!accepts_gzip(buf + 16))
+        continue;
+      strcpy(buf, "Accept-Encoding: gzip\r\n");
+    }
+    else if (!strncasecmp(buf, "Accept-Language:", 16)) {
+      if (!primary_lang(buf + 16, lang))
+        continue;
+      sprintf(buf, "Accept-Language: %s\r\n", lang);
+    }
+    if (n + (len = strlen(buf)) < MAXBUF) {
+      memcpy(hdrs + n, buf, len + 1);
+      n += len;
+    }
+  }
+}
+
+/* 헤더 값에서 HTTP 날짜를 읽는다. 실패하면 0 */
+static time_t parse_httpdate(char *s)
+{
+  struct tm tm;
+
+  memset(&tm, 0, sizeof(tm));
+  while (*s == ' ')
+    s++;
+  if (!strptime(s, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+    return 0;
+  return timegm(&tm);
+}
+
+/* 헤더 값을 앞뒤 공백과 CRLF를 뺀 채로 dst에 복사한다 */
+static void copy_hdrval(char *dst, char *val, size_t size)
+{
+  size_t len;
+
+  while (*val == ' ' || *val == '\t')
+    val++;
+  len = strcspn(val, "\r\n");
+  if (len >= size)
+    len = size - 1;
+  memcpy(dst, val, len);
+  dst[len] = '\0';
+}
+
+/*
+ * Vary 값을 소문자 헤더 이름의 쉼표 목록으로 resp->meta.vary에 모은다(공백은 뺀다).
+ * 여러 줄로 오면 이어 붙인다. "*"거나 너무 길면 변형을 가릴 수 없으므로 varyall.
+ */
+static void parse_vary(char *val, resp_t *resp)
+{
+  char *vary = resp->meta.vary;
+  size_t n = strlen(vary);
+
+  if (n > 0)                            // 앞선 Vary 줄에 잇는다
+    vary[n++] = ',';
+  for (; *val && *val != '\r' && *val != '\n'; val++) {
+    if (*val == ' ' || *val == '\t' || (*val == ',' && (n == 0 || vary[n - 1] == ',')))
+      continue;
+    if (*val == '*' || n + 2 >= sizeof(resp->meta.vary)) {
+      resp->varyall = 1;
+      return;
+    }
+    vary[n++] = tolower(*val);
+  }
+  if (n > 0 && vary[n - 1] == ',')
+    n--;
+  vary[n] = '\0';
+}
+
+/*
+ * read_resphdrs - 원 서버 응답의 상태 줄과 헤더를 읽어 hdrs에 그대로 모으고,
+ *     캐시에 필요한 정보는 resp에 채운다. 모은 헤더의 길이를 돌려주고, 실패하면 -1.
+ */
+int read_resphdrs(rio_t *rp, resp_t *resp, char *hdrs)
+{
+  char buf[MAXLINE], *p;
+  size_t n = 0, len;
+
+  memset(resp, 0, sizeof(resp_t));
+  resp->clen = resp->maxage = resp->range_first = -1;
+  strcpy(resp->meta.ctype, "text/plain");
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0 || sscanf(buf, "%*s %d", &resp->status) != 1)
+    return -1;
+  do {
+    if (n + (len = strlen(buf)) >= MAXBUF)
+      return -1;
+    memcpy(hdrs + n, buf, len + 1);
+    n += len;
+    if (!strcmp(buf, "\r\n"))
+      break;
+
+    if (!strncasecmp(buf, "Content-length:", 15))
+      resp->clen = atol(buf + 15);
+    else if (!strncasecmp(buf, "Content-type:", 13))
+      copy_hdrval(resp->meta.ctype, buf + 13, sizeof(resp->meta.ctype));
+    else if (!strncasecmp(buf, "Last-Modified:", 14))
+      copy_hdrval(resp->meta.lastmod, buf + 14, sizeof(resp->meta.lastmod));
+    else if (!strncasecmp(buf, "ETag:", 5))
+      copy_hdrval(resp->meta.etag, buf + 5, sizeof(resp->meta.etag));
+    else if (!strncasecmp(buf, "Content-Range:", 14))
+      sscanf(buf + 14, " bytes %ld-%ld/%ld", &resp->range_first, &resp->range_last, &resp->range_total);
+    else if (!strncasecmp(buf, "Content-Encoding:", 17)) {
+      // 캐시는 인코딩을 기억하지 않으므로 원 서버가 인코딩한 본문은 저장하지 않는다
+      copy_hdrval(buf, buf + 17, MAXLINE);
+      if (strcasecmp(buf, "identity"))
+        resp->nostore = 1;
+    }
+    else if (!strncasecmp(buf, "X-Cache-Hot:", 12))
+      resp->hot = 1;
+    else if (!strncasecmp(buf, "Vary:", 5))
+      parse_vary(buf + 5, resp);
+    else if (!strncasecmp(buf, "Expires:", 8))
+      resp->expires = parse_httpdate(buf + 8);
+    else if (!strncasecmp(buf, "Cache-Control:", 14)) {
+      for (p = buf; *p; p++)
+        *p = tolower(*p);
+      if (strstr(buf, "no-store") || strstr(buf, "no-cache") || strstr(buf, "private"))
+        resp->nostore = 1;
+      if ((p = strstr(buf, "max-age=")))
+        resp->maxage = atol(p + 8);
+    }
+  } while (rio_readlineb(rp, buf, MAXLINE) > 0);
+
+  // 신선도 수명: max-age > Expires > 기본값. 기본값은 재검증할 수 있는 응답에만 준다
+  // (검증자가 없는 응답이 -t초 동안 그대로 나가지 않도록). 없으면 받자마자 오래된 것이다
+  if (resp->maxage >= 0)
+    resp->meta.expires = time(NULL) + resp->maxage;
+  else if (resp->expires)
+    resp->meta.expires = resp->expires;
+  else if (resp->meta.lastmod[0] || resp->meta.etag[0])
+    resp->meta.expires = time(NULL) + cache_default_ttl;
+  else
+    resp->meta.expires = time(NULL);
+  return n;
+}
+
+/*
+ * forward_response - 원 서버 응답을 클라이언트에 흘려보내면서 본문을 캐시에 넣는다.
+ *     본문은 캐시에 넣을 blob에 바로 읽어 들여 그 자리에서 클라이언트에 쓴다.
+ *     MAX_OBJECT_SIZE보다 큰 객체는 세그먼트가 찰 때마다 바로바로 넣는다. stale이 주어지면 재검증 요청에 대한 응답이며,
+ *     304가 오면 캐시의 메타데이터만 갱신하고 blob으로 들고 있던 오래된 응답을 보낸다
+ *     (range가 있으면 그 범위만). fd가 음수면 백그라운드 갱신이므로
+ *     클라이언트에는 아무것도 쓰지 않고 캐시만 갱신한다.
+ *     url은 캐시 키이며, 응답에 Vary가 있으면 reqhdrs(원 서버에 보낸 요청 헤더)로
+ *     변형 키를 다시 정해 그 키에 넣는다. 마이크로 캐시 규칙(-u)에 맞는 url은 그 규칙의
+ *     수명으로 입장 필터 없이 넣는다.
+ */
+void forward_response(int server_fd, int fd, char *url, int cacheable,
+                      cache_meta_t *stale, cache_blob_t *blob, char *range, char *reqhdrs)
+{
+  char buf[MAXBUF], hdrs[MAXBUF], *body = NULL, *p;
+  char base[MAXLINE], vhdrs[MAXLINE], key[MAXLINE];
+  cache_blob_t *out = NULL, *seg = NULL, *fresh;
+  size_t total = 0, want;
+  ssize_t n;
+  int hdrlen, micro;
+  resp_t resp;
+  rio_t servrio;
+
+  // tiny에서 proxy응답 받는 부분
+  Rio_readinitb(&servrio, server_fd);
+  if ((hdrlen = read_resphdrs(&servrio, &resp, hdrs)) < 0) {
+    if (fd < 0)
+      return;
+    if (stale)
+      serve_cached(fd, url, stale, blob, range);
+    else
+      clienterror(fd, url, "502", "Bad gateway", "Proxy got a bad response from the server");
+    return;
+  }
+  // 마이크로 캐시 규칙은 원 서버가 신선도를 밝히지 않은 응답의 기본 수명을 대신한다.
+  // 규칙이 없으면 동적 응답(쿼리가 있거나 /cgi-bin/ 아래)에는 기본 수명을 주지 않는다
+  if ((micro = micro_ttl(url)) >= 0 && resp.maxage < 0 && !resp.expires)
+    resp.meta.expires = time(NULL) + micro;
+  else if (micro < 0 && resp.maxage < 0 && !resp.expires && dynamic_url(url))
+    resp.meta.expires = time(NULL);
+
+  if (resp.status == 304 && stale) {   // 바뀌지 않았다: 헤더 왕복만으로 재검증 끝
+    if (resp.meta.lastmod[0])
+      strcpy(stale->lastmod, resp.meta.lastmod);
+    if (resp.meta.etag[0])
+      strcpy(stale->etag, resp.meta.etag);
+    stale->expires = resp.meta.expires;
+    // 갱신된 blob은 압축된 것일 수 있으므로 이 클라이언트에 맞게 다시 고른다
+    if ((fresh = cache_refresh(url, &resp.meta)) && fd >= 0)
+      fresh = decode_for(reqhdrs, range, &resp.meta, fresh);
+    if (fd >= 0)
+      serve_cached(fd, url, fresh ? &resp.meta : stale, fresh ? fresh : blob, range);
+    if (fresh)
+      cache_blob_put(fresh);
+    return;
+  }
+
+  // 클라이언트로 응답 보내기
+  printf("Response headers:\n");
+  printf("%s", hdrs);
+  if (fd >= 0 && rio_writen(fd, hdrs, hdrlen) != hdrlen)
+    return;
+  cacheable = cacheable && resp.status == 200 && !resp.nostore;
+  // 신선도도 검증자도 없는 응답은 다음 요청이 어차피 다시 받아야 하므로 넣지 않는다
+  if (micro < 0 && resp.maxage < 0 && !resp.expires && !resp.meta.lastmod[0] && !resp.meta.etag[0])
+    cacheable = 0;
+  // Vary가 있으면 이 요청의 헤더로 정한 변형 키에 넣고, url 자리에는 표식을 남긴다
+  split_key(url, base, vhdrs);
+  if (cacheable && (resp.varyall || variant_key(base, resp.meta.vary, reqhdrs, key) < 0))
+    cacheable = 0;
+  // 캐시에 없던 객체는 입장 필터를 통과해야 복사해 둔다 (재검증 응답은 이미 들어온 객체).
+  // 마이크로 캐시 객체는 몰려온 요청들이 곧바로 이 사본을 써야 하므로 필터를 건너뛴다
+  if (cacheable && !stale && !resp.hot && micro < 0 && !cache_admit(key))
+    cacheable = 0;
+  if (cacheable && resp.meta.vary[0])
+    cache_insert_vary(base, resp.meta.vary);
+  if (cacheable && resp.clen > MAX_OBJECT_SIZE)       // 크기를 아는 큰 객체는 세그먼트로 캐시
+    resp.meta.size = resp.clen;
+  else if (cacheable && resp.clen >= 0) {             // 크기를 알면 헤더를 붙인 blob에 바로 받는다
+    resp.meta.size = resp.clen;
+    out = cache_blob_new(&resp.meta, resp.clen);
+    body = out->data + out->hdrlen;
+  }
+  else if (cacheable)                                 // 모르면 모아 두었다가 끝에 blob을 만든다
+    body = Malloc(MAX_OBJECT_SIZE);
+
+  while (resp.clen < 0 || total < resp.clen) {
+    want = MAXBUF;
+    if (resp.clen >= 0 && resp.clen - total < want)
+      want = resp.clen - total;
+    if (body && total < MAX_OBJECT_SIZE && MAX_OBJECT_SIZE - total < want)
+      want = MAX_OBJECT_SIZE - total;
+    if (resp.meta.size > MAX_OBJECT_SIZE) {
+      if (CACHE_SEGMENT_SIZE - total % CACHE_SEGMENT_SIZE < want)
+        want = CACHE_SEGMENT_SIZE - total % CACHE_SEGMENT_SIZE;
+      if (!seg) {                       // 세그먼트 경계: 새 조각을 시작한다
+        seg = cache_blob_new(NULL, resp.clen - total < CACHE_SEGMENT_SIZE ?
+                             resp.clen - total : CACHE_SEGMENT_SIZE);
+        seg->idx = total / CACHE_SEGMENT_SIZE;
+      }
+      p = seg->data + total % CACHE_SEGMENT_SIZE;
+    }
+    else
+      p = (body && total < MAX_OBJECT_SIZE) ? body + total : buf;
+    if ((n = rio_readnb(&servrio, p, want)) <= 0)
+      break;
+    if (fd >= 0 && rio_writen(fd, p, n) != n) {
+      if (!cacheable)
+        return;
+      fd = -1;                          // 클라이언트가 떠나도 캐시는 마저 채운다
+    }
+    total += n;
+    if (seg && (total % CACHE_SEGMENT_SIZE == 0 || total == resp.clen)) {
+      cache_put_segment(key, &resp.meta, (total - 1) / CACHE_SEGMENT_SIZE, seg, 1);
+      cache_blob_put(seg);
+      seg = NULL;
+    }
+  }
+  if (seg)                              // 중간에 끊겨 다 못 채운 세그먼트
+    cache_blob_put(seg);
+
+  // 끝까지 온전히 받은 작은 객체만 캐시
+  if (out) {
+    if (total == resp.clen)
+      cache_insert(key, &resp.meta, out);
+    cache_blob_put(out);
+  }
+  else if (body) {
+    if (total <= MAX_OBJECT_SIZE) {
+      resp.meta.size = total;
+      out = cache_blob_new(&resp.meta, total);
+      memcpy(out->data + out->hdrlen, body, total);
+      cache_insert(key, &resp.meta, out);
+      cache_blob_put(out);
+    }
+    Free(body);
   }
 }
 
+/*
+ * serve_cached - 캐시된 응답을 보낸다. 작은 객체는 미리 직렬화해 둔 blob(헤더 + 본문)을
+ *     send 한 번으로 보내고, 큰 객체는 헤더 blob 뒤에 세그먼트를 차례로 이어 보낸다.
+ *     큰 객체의 blob이 헤더가 아니라 방금 원 서버에서 받은 세그먼트거나 NULL이면
+ *     메타데이터로 헤더를 만든다. range(클라이언트의 Range 값)가
+ *     있으면 206으로 그 범위만 보내고, 만족할 수 없는 범위면 416을 보낸다.
+ */
+void serve_cached(int fd, char *url, cache_meta_t *meta, cache_blob_t *blob, char *range)
+{
+  char buf[MAXBUF];
+  range_t ranges[MAX_RANGES];
+  long off;
+  int n, nranges;
+
+  if (range && range[0] && (nranges = parse_range(range, meta->size, ranges)) >= 0) {
+    if (nranges > 0) {
+      serve_ranges(fd, url, meta, blob, ranges, nranges);
+      return;
+    }
+    n = sprintf(buf, "HTTP/1.0 416 Range Not Satisfiable\r\n");
+    n += sprintf(buf + n, "Connection: close\r\n");
+    n += sprintf(buf + n, "Content-Range: bytes */%zu\r\n", meta->size);
+    n += sprintf(buf + n, "Content-length: 0\r\n\r\n");
+    rio_writen(fd, buf, n);
+    return;
+  }
+
+  if (blob && meta->size <= MAX_OBJECT_SIZE) {  // 적중: 통째로 한 번에
+    send_all(fd, blob->data, blob->len);
+    return;
+  }
+  if (blob && blob->hdrlen)
+    n = send_all(fd, blob->data, blob->hdrlen);
+  else {
+    n = cache_format_hdrs(buf, "200 OK", meta, meta->size, meta->ctype);
+    n += sprintf(buf + n, "\r\n");
+    n = rio_writen(fd, buf, n);
+  }
+  if (n <= 0 || !meta->size)
+    return;
+  if ((off = send_body(fd, url, meta, blob, 0, meta->size - 1)) >= 0 && off < meta->size)
+    fetch_remainder(fd, url, off);      // 캐시에서도 원 서버 범위 요청으로도 못 채운 부분부터
+}
+
+/*
+ * parse_range - "bytes=0-99,200-,-50" 형식의 Range 값을 크기 size인 본문에 맞춰 풀어
+ *     ranges에 채운다. 만족할 수 있는 범위의 개수를 돌려주며(0이면 416), 형식이 틀렸거나
+ *     너무 많으면 -1을 돌려주어 Range를 무시하게 한다.
+ */
+int parse_range(char *spec, size_t size, range_t *ranges)
+{
+  char *p, *end;
+  long a, b;
+  int n = 0;
+
+  if (strncasecmp(spec, "bytes=", 6))
+    return -1;
+  for (p = spec + 6; *p; p = end) {
+    while (*p == ' ' || *p == ',')
+      p++;
+    if (!*p)
+      break;
+    if (n == MAX_RANGES)
+      return -1;
+    if (*p == '-') {                    // -n: 마지막 n바이트
+      b = strtol(p + 1, &end, 10);
+      if (end == p + 1 || b < 0)
+        return -1;
+      if (b == 0 || size == 0)
+        continue;
+      ranges[n].first = ((size_t)b >= size) ? 0 : size - b;
+      ranges[n++].last = size - 1;
+      continue;
+    }
+    a = strtol(p, &end, 10);
+    if (end == p || *end != '-' || a < 0)
+      return -1;
+    p = end + 1;
+    b = strtol(p, &end, 10);
+    if (end == p)                       // a-: 끝까지
+      b = LONG_MAX;
+    if (b < a)
+      return -1;
+    if ((size_t)a >= size)              // 본문 밖의 범위는 건너뛴다
+      continue;
+    ranges[n].first = a;
+    ranges[n++].last = ((size_t)b >= size) ? size - 1 : b;
+  }
+  return n;
+}
+
+/* serve_ranges - 범위가 하나면 206 하나로, 여럿이면 multipart/byteranges로 보낸다 */
+void serve_ranges(int fd, char *url, cache_meta_t *meta, cache_blob_t *blob, range_t *ranges, int nranges)
+{
+  char buf[MAXBUF], parts[MAX_RANGES][MAXLINE], ctype[MAXLINE];
+  size_t clen = 0;
+  int n, i, partlen[MAX_RANGES];
+
+  if (nranges == 1) {
+    n = cache_format_hdrs(buf, "206 Partial Content", meta,
+                    ranges[0].last - ranges[0].first + 1, meta->ctype);
+    n += sprintf(buf + n, "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                 ranges[0].first, ranges[0].last, meta->size);
+    if (rio_writen(fd, buf, n) == n)
+      send_body(fd, url, meta, blob, ranges[0].first, ranges[0].last);
+    return;
+  }
+
+  // 각 부분의 머리말을 먼저 만들어 두어야 전체 Content-length를 알 수 있다
+  for (i = 0; i < nranges; i++) {
+    partlen[i] = sprintf(parts[i], "\r\n--%s\r\nContent-type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                         BYTERANGES_BOUNDARY, meta->ctype, ranges[i].first, ranges[i].last, meta->size);
+    clen += partlen[i] + ranges[i].last - ranges[i].first + 1;
+  }
+  clen += strlen("\r\n--" BYTERANGES_BOUNDARY "--\r\n");
+  sprintf(ctype, "multipart/byteranges; boundary=%s", BYTERANGES_BOUNDARY);
+  n = cache_format_hdrs(buf, "206 Partial Content", meta, clen, ctype);
+  n += sprintf(buf + n, "\r\n");
+  if (rio_writen(fd, buf, n) != n)
+    return;
+  for (i = 0; i < nranges; i++)
+    if (rio_writen(fd, parts[i], partlen[i]) != partlen[i] ||
+        send_body(fd, url, meta, blob, ranges[i].first, ranges[i].last) != ranges[i].last + 1)
+      return;
+  rio_writen(fd, "\r\n--" BYTERANGES_BOUNDARY "--\r\n", strlen("\r\n--" BYTERANGES_BOUNDARY "--\r\n"));
+}
+
+/*
+ * send_body - 캐시된 본문의 [first, last] 구간을 보낸다. 작은 객체는 blob의 본문에서,
+ *     큰 객체는 세그먼트 blob에서 보내며(blob이 세그먼트면 그것부터 쓴다), 빠진 세그먼트는
+ *     원 서버에 그 세그먼트 범위만 요청해 채운다. 보낸 끝 위치(last + 1이면 전부)를 돌려주고, 클라이언트에 쓰다 실패하면 -1.
+ */
+long send_body(int fd, char *url, cache_meta_t *meta, cache_blob_t *blob, size_t first, size_t last)
+{
+  cache_blob_t *seg;
+  size_t off = first, end, len;
+  int idx;
+
+  if (meta->size <= MAX_OBJECT_SIZE)
+    return send_all(fd, blob->data + blob->hdrlen + first, last - first + 1) < 0 ? -1 : last + 1;
+
+  while (off <= last) {
+    idx = off / CACHE_SEGMENT_SIZE;
+    if (blob && !blob->hdrlen && blob->idx == idx) {
+      seg = blob;
+      cache_blob_get(seg);
+    }
+    else if (!(seg = cache_read_segment(url, meta, idx)) && !(seg = fetch_segment(url, meta, idx, 0)))
+      break;
+    end = (size_t)idx * CACHE_SEGMENT_SIZE + seg->len - 1;
+    if (seg->len == 0 || end < off) {
+      cache_blob_put(seg);
+      break;
+    }
+    len = (end < last ? end : last) - off + 1;
+    if (send_all(fd, seg->data + off % CACHE_SEGMENT_SIZE, len) < 0) {
+      cache_blob_put(seg);
+      return -1;
+    }
+    cache_blob_put(seg);
+    off += len;
+  }
+  return off;
+}
+
+/*
+ * fetch_segment - 큰 객체의 idx번째 세그먼트 범위만 원 서버에 Range로 요청해 받고
+ *     캐시에도 채운다. If-Range로 meta와 같은 판일 때만 206을 받으며, 받은 세그먼트의
+ *     blob 참조를 돌려준다(작은 객체라면 헤더까지 갖춘 전체 응답). probe면 meta를 모르는
+ *     상태이므로 206 응답으로 meta를 채우고, 입장 필터를 통과한 객체만 캐시에 새로 만든다.
+ *     probe가 아니면 이미 캐시에 있는 객체의 빠진 세그먼트만 채운다. 실패하면 NULL.
+ */
+cache_blob_t *fetch_segment(char *url, cache_meta_t *meta, int idx, int probe)
+{
+  char hostname[MAXLINE], port[MAXLINE], filename[MAXLINE], host[MAXLINE];
+  char hdrs[MAXLINE + MAXBUF], req[2 * MAXLINE + 2 * MAXBUF], base[MAXLINE], vhdrs[MAXLINE];
+  size_t first = (size_t)idx * CACHE_SEGMENT_SIZE, len;
+  int server_fd, n, create;
+  cache_blob_t *blob;
+  resp_t resp;
+  rio_t servrio;
+
+  split_key(url, base, vhdrs);
+  parse_uri(base, hostname, port, filename);
+  if ((server_fd = open_clientfd(hostname, port)) < 0)
+    return NULL;
+  strcpy(host, hostname);
+  strcat(host, ":");
+  strcat(host, port);
+  n = sprintf(hdrs, "%sRange: bytes=%zu-%zu\r\n", vhdrs, first, first + CACHE_SEGMENT_SIZE - 1);
+  if (!probe && (meta->etag[0] || meta->lastmod[0]))
+    sprintf(hdrs + n, "If-Range: %s\r\n", meta->etag[0] ? meta->etag : meta->lastmod);
+  n = build_request(req, "GET", filename, host, NULL, hdrs);
+  Rio_readinitb(&servrio, server_fd);
+  if (rio_writen(server_fd, req, n) != n || read_resphdrs(&servrio, &resp, hdrs) < 0 ||
+      resp.status != 206 || resp.range_first != first || resp.range_last < resp.range_first ||
+      resp.nostore || (!probe && resp.range_total != meta->size)) {
+    Close(server_fd);
+    return NULL;
+  }
+  len = resp.range_last - resp.range_first + 1;
+  if (probe) {
+    *meta = resp.meta;
+    meta->size = resp.range_total;
+  }
+  // 작은 객체라면 세그먼트 하나가 곧 전체이므로 헤더를 붙인 blob에 받는다
+  if (len > CACHE_SEGMENT_SIZE || (meta->size <= MAX_OBJECT_SIZE && len != meta->size)) {
+    Close(server_fd);
+    return NULL;
+  }
+  blob = cache_blob_new(meta->size <= MAX_OBJECT_SIZE ? meta : NULL, len);
+  blob->idx = idx;
+  if (rio_readnb(&servrio, blob->data + blob->hdrlen, len) != len) {
+    Close(server_fd);
+    cache_blob_put(blob);
+    return NULL;
+  }
+  Close(server_fd);
+
+  // Vary가 있는 응답은 변형 키를 이미 아는 경우(url이 변형 키)에만 새로 넣는다
+  create = probe && (!resp.meta.vary[0] || strchr(url, '\n')) && !resp.varyall &&
+    (resp.hot || cache_admit(url));
+  if (meta->size <= MAX_OBJECT_SIZE) {
+    if (create)
+      cache_insert(url, meta, blob);
+  }
+  else
+    cache_put_segment(url, meta, idx, blob, create);
+  return blob;
+}
+
+/*
+ * fetch_remainder - 캐시에서 보내던 큰 객체의 offset 이후를 원 서버에서 받아 이어 보낸다.
+ *     응답 헤더는 이미 나갔으므로 원 서버 응답의 본문 앞부분은 버린다.
+ */
+void fetch_remainder(int fd, char *url, size_t offset)
+{
+  char hostname[MAXLINE], port[MAXLINE], filename[MAXLINE], host[MAXLINE];
+  char buf[MAXBUF], req[MAXLINE + 2 * MAXBUF], base[MAXLINE], vhdrs[MAXLINE];
+  size_t total = 0, want;
+  ssize_t n;
+  int server_fd;
+  resp_t resp;
+  rio_t servrio;
+
+  split_key(url, base, vhdrs);
+  parse_uri(base, hostname, port, filename);
+  if ((server_fd = open_clientfd(hostname, port)) < 0)
+    return;
+  strcpy(host, hostname);
+  strcat(host, ":");
+  strcat(host, port);
+  n = build_request(req, "GET", filename, host, NULL, vhdrs);
+  Rio_readinitb(&servrio, server_fd);
+  if (rio_writen(server_fd, req, n) != n || read_resphdrs(&servrio, &resp, buf) < 0 ||
+      resp.status != 200) {
+    Close(server_fd);
+    return;
+  }
+  while (resp.clen < 0 || total < resp.clen) {
+    want = MAXBUF;
+    if (total < offset && offset - total < want)
+      want = offset - total;
+    if ((n = rio_readnb(&servrio, buf, want)) <= 0)
+      break;
+    if (total >= offset && rio_writen(fd, buf, n) != n)
+      break;
+    total += n;
+  }
+  Close(server_fd);
+}
+
+/*
+ * variant_key - url과 Vary 헤더 이름 목록(vary)으로, reqhdrs를 보낸 요청이 받을 변형의
+ *     캐시 키를 key에 만든다. url 뒤에 '\n'을 두고 vary의 각 헤더를 요청에 있던 그대로
+ *     (앞뒤 공백을 빼고) "이름: 값\r\n" 줄로 붙이므로, 키에서 원 서버에 다시 보낼 헤더를
+ *     되살릴 수 있다. vary가 비어 있으면 key는 url이다. 키가 MAXLINE을 넘으면 -1.
+ */
+int variant_key(char *url, char *vary, char *reqhdrs, char *key)
+{
+  char *name, *line, *end;
+  size_t n, len, vlen;
+
+  n = strlen(url);
+  memcpy(key, url, n + 1);
+  if (!vary[0])
+    return 0;
+  key[n++] = '\n';
+  key[n] = '\0';
+  for (name = vary; *name; name += len + (name[len] == ',')) {
+    len = strcspn(name, ",");
+    for (line = reqhdrs; *line; line = end) {
+      end = line + strcspn(line, "\n");
+      end += (*end == '\n');
+      if (strncasecmp(line, name, len) || line[len] != ':')
+        continue;
+      line += len + 1;
+      line += strspn(line, " \t");
+      vlen = strcspn(line, "\r\n");
+      while (vlen > 0 && (line[vlen - 1] == ' ' || line[vlen - 1] == '\t'))
+        vlen--;
+      if (n + len + vlen + 5 > MAXLINE)
+        return -1;
+      n += sprintf(key + n, "%.*s: %.*s\r\n", (int)len, name, (int)vlen, line);
+      break;
+    }
+  }
+  return 0;
+}
+
+/* 캐시 키를 url과 원 서버에 다시 보낼 변형 헤더 줄로 나눈다 */
+static void split_key(char *key, char *url, char *vhdrs)
+{
+  char *p = strchr(key, '\n');
+  size_t n = p ? p - key : strlen(key);
+
+  memcpy(url, key, n);
+  url[n] = '\0';
+  strcpy(vhdrs, p ? p + 1 : "");
+}
+
+/*
+ * decode_for - 압축해 저장된 객체(meta->zlen != 0)는 gzip을 받는 클라이언트의 전체 요청에만
+ *     그대로 보낸다. 그 밖의 요청에는 blob을 풀어 평문 blob으로 바꿔 돌려주고 원래 참조는
+ *     놓는다. 범위 요청은 평문 기준이므로 역시 푼다. 풀지 못하면 참조를 놓고 NULL.
+ *     reqhdrs는 read_requesthdrs가 정규화한 헤더다.
+ */
+static cache_blob_t *decode_for(char *reqhdrs, char *range, cache_meta_t *meta, cache_blob_t *blob)
+{
+  cache_blob_t *plain;
+
+  if (!blob || !meta->zlen || (!range[0] && strstr(reqhdrs, "Accept-Encoding: gzip\r\n")))
+    return blob;
+  plain = cache_decode(meta, blob);
+  cache_blob_put(blob);
+  return plain;
+}
+
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
+{
+  char buf[MAXLINE], body[MAXBUF];
+  int n;
+
+  /* Build the HTTP response body */
+  n = sprintf(body, "<html><title>Proxy Error</title>");
+  n += sprintf(body + n, "<body bgcolor=\"ffffff\">\r\n");
+  n += sprintf(body + n, "%s: %s\r\n", errnum, shortmsg);
+  n += sprintf(body + n, "<p>%s: %s\r\n", longmsg, cause);
+  sprintf(body + n, "<hr><em>The Proxy server</em>\r\n");
+
+  /* Print the HTTP response */
+  n = sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
+  n += sprintf(buf + n, "Content-type: text/html\r\n");
+  n += sprintf(buf + n, "Content-length: %d\r\n\r\n", (int)strlen(body));
+  if (rio_writen(fd, buf, n) == n)
+    rio_writen(fd, body, strlen(body));
+}
+
 void *thread(void *vargp)
 {
   int connfd = *((int *)vargp);
@@ -122,4 +1228,65 @@ void *thread(void *vargp)
   doit(connfd);
   Close(connfd);
   return NULL;
-}
\ No newline at end of file
+}
+
+void refresh_init(void)
+{
+  pthread_t tid;
+  int i;
+
+  Sem_init(&refresh_mutex, 0, 1);
+  Sem_init(&refresh_slots, 0, REFRESH_QSIZE);
+  Sem_init(&refresh_items, 0, 0);
+  for (i = 0; i < REFRESH_NTHREADS; i++)
+    Pthread_create(&tid, NULL, refresh_thread, NULL);
+}
+
+/* refresh_enqueue - 갱신 작업을 넣는다. 요청 쓰레드가 기다리지 않도록 대기열이 차 있으면 버린다 */
+void refresh_enqueue(char *url, char *host, cache_meta_t *meta)
+{
+  refresh_job_t *job;
+
+  if (sem_trywait(&refresh_slots) < 0) {
+    cache_release(url);
+    return;
+  }
+  job = Malloc(sizeof(refresh_job_t));
+  strcpy(job->url, url);
+  strcpy(job->host, host);
+  job->meta = *meta;
+  P(&refresh_mutex);
+  refresh_q[(++refresh_rear) % REFRESH_QSIZE] = job;
+  V(&refresh_mutex);
+  V(&refresh_items);
+}
+
+/* refresh_thread - 대기열에서 작업을 꺼내 원 서버에 조건부 요청을 보내고 캐시를 갱신한다 */
+void *refresh_thread(void *vargp)
+{
+  int server_fd, n;
+  char hostname[MAXLINE], port[MAXLINE], filename[MAXLINE];
+  char req[MAXLINE + 2 * MAXBUF], url[MAXLINE], vhdrs[MAXLINE];
+  refresh_job_t *job;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    P(&refresh_items);
+    P(&refresh_mutex);
+    job = refresh_q[(++refresh_front) % REFRESH_QSIZE];
+    V(&refresh_mutex);
+    V(&refresh_slots);
+
+    split_key(job->url, url, vhdrs);    // 변형이면 같은 변형 헤더로 재검증한다
+    parse_uri(url, hostname, port, filename);
+    if ((server_fd = open_clientfd(hostname, port)) >= 0) {
+      n = build_request(req, "GET", filename, job->host, &job->meta, vhdrs);
+      if (rio_writen(server_fd, req, n) == n)
+        forward_response(server_fd, -1, job->url, 1, &job->meta, NULL, NULL, vhdrs);
+      Close(server_fd);
+    }
+    cache_release(job->url);
+    Free(job);
+  }
+  return NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ * sendall.c - 캐시된 blob을 소켓으로 보내기 (MSG_ZEROCOPY)
+ */
+#include <poll.h>
+#include "csapp.h"
+#include <linux/errqueue.h>    /* csapp.h가 들여오는 struct timespec이 먼저 필요하다 */
+#include "sendall.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+/* 보낸 zerocopy send들의 완료 알림을 ndone에 더한다. 알림이 오지 않으면 -1 */
+static int zerocopy_reap(int fd, unsigned *ndone)
+{
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  struct sock_extended_err *serr;
+  struct pollfd pfd = { fd, 0, 0 };
+
+  if (poll(&pfd, 1, ZEROCOPY_WAIT) <= 0)
+    return -1;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    serr = (struct sock_extended_err *)CMSG_DATA(cm);
+    if (serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY && serr->ee_errno == 0)
+      *ndone += serr->ee_data - serr->ee_info + 1;  // [ee_info, ee_data] 범위의 send가 끝났다
+  }
+  return 0;
+}
+
+ssize_t send_all(int fd, char *buf, size_t len)
+{
+  size_t left = len;
+  ssize_t n;
+  unsigned nsent = 0, ndone = 0;
+  int one = 1, flags = 0;
+
+  if (len >= ZEROCOPY_MIN && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+    flags = MSG_ZEROCOPY;
+  while (left > 0) {
+    if ((n = send(fd, buf, left, flags)) < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS && flags) {  // 고정할 수 있는 페이지 한도: 복사로 보낸다
+        flags = 0;
+        continue;
+      }
+      break;
+    }
+    if (flags)
+      nsent++;
+    buf += n;
+    left -= n;
+  }
+  while (ndone < nsent)
+    if (zerocopy_reap(fd, &ndone) < 0)
+      break;
+  return left ? -1 : len;
+}
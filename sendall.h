@@ -0,0 +1,22 @@
+/*
+ * sendall.h - 캐시된 blob을 소켓으로 보내기
+ *
+ * 프록시가 캐시 적중에 쓰는 송신 경로다. 벤치마크(bench/hitbench.c)도 같은 함수로 잰다.
+ */
+#ifndef __SENDALL_H__
+#define __SENDALL_H__
+
+#include <sys/types.h>
+
+#define ZEROCOPY_MIN (64 * 1024)  /* 이보다 큰 blob은 복사 없이 보낸다 */
+#define ZEROCOPY_WAIT 5000        /* 완료 알림을 기다리는 최대 시간(ms) */
+
+/*
+ * buf를 모두 보낸다. ZEROCOPY_MIN 이상이면 MSG_ZEROCOPY로 사용자 버퍼를 복사 없이
+ * 내보내고, 커널이 그 페이지를 다 쓸 때까지(완료 알림) 기다린 뒤 돌아오므로 호출자는
+ * 곧바로 blob의 참조를 놓아도 된다. zerocopy를 못 쓰는 소켓이면 보통 send로 보낸다.
+ * 보낸 바이트 수(len), 실패하면 -1.
+ */
+ssize_t send_all(int fd, char *buf, size_t len);
+
+#endif /* __SENDALL_H__ */
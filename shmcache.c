@@ -0,0 +1,374 @@
+/*
+ * shmcache.c - 여러 프록시 프로세스가 함께 쓰는 공유 메모리 캐시
+ *
+ * shm_open으로 만든 영역을 mmap해 모든 프로세스가 같은 객체 저장소를 본다.
+ * 프로세스마다 주소가 다르므로 영역 안의 연결은 모두 영역 시작에서의 오프셋이다.
+ *
+ * 영역은 머리(해시 버킷, 등급별 목록)와 SHM_PAGE_SIZE 슬랩 페이지들로 나뉜다.
+ * 페이지는 처음 필요할 때 한 크기 등급에 주어져 같은 크기의 조각으로 잘리며,
+ * 객체 하나가 조각 하나를 쓴다. 빈 조각도 빈 페이지도 없으면 그 등급의 LRU 끝을
+ * 내보내고, 그 등급에 객체가 하나도 없으면 다른 등급의 페이지를 통째로 빼앗아 온다.
+ *
+ * 머리의 epoch를 올리면 그 전에 넣은 객체는 모두 없는 것이 된다(캐시 금지). 영역을 훑지
+ * 않고, 찾다가 옛 epoch의 객체를 만나면 그때 조각을 돌려준다.
+ *
+ * 프로세스별 캐시의 금지는 머리의 고리에 남긴다. 항목을 다 쓴 뒤에 ban_seq를 올리므로,
+ * 락 없이 ban_seq만 읽어 새 금지가 있는지 알 수 있고 쓰다 죽은 항목은 보이지 않는다.
+ * 프로세스마다 어디까지 가져왔는지(ban_seen)를 따로 센다.
+ *
+ * 모든 연산은 프로세스 공유 robust 뮤텍스 하나 아래에서 이루어진다. 락을 쥔 채
+ * 프로세스가 죽으면 다음에 락을 잡는 프로세스가 EOWNERDEAD를 받는데, 목록을
+ * 고치다 말았을 수 있으므로 영역을 비우고 다시 시작한다. 캐시 내용만 잃을 뿐
+ * 깨진 목록을 따라가는 일은 없다. 락 밖에서 죽은 프로세스는 영역에 흔적을 남기지 않는다.
+ */
+#include "shmcache.h"
+
+#define ENT(off) ((shm_entry_t *)((char *)shm + (off)))
+#define OFF(e) ((uint32_t)((char *)(e) - (char *)shm))
+
+int shm_cache_enabled = 0;
+
+static shm_hdr_t *shm;
+static uint32_t ban_seen;               /* 이 프로세스가 가져온 마지막 금지의 번호 (shm->lock이 보호) */
+
+static void list_unlink(uint32_t *head, uint32_t *tail, shm_entry_t *e)
+{
+  if (e->prev)
+    ENT(e->prev)->next = e->next;
+  else
+    *head = e->next;
+  if (e->next)
+    ENT(e->next)->prev = e->prev;
+  else if (tail)
+    *tail = e->prev;
+  e->prev = e->next = 0;
+}
+
+/* tail이 NULL이면 머리만 있는 목록(빈 조각 목록)이다 */
+static void list_push(uint32_t *head, uint32_t *tail, shm_entry_t *e)
+{
+  e->prev = 0;
+  e->next = *head;
+  if (*head)
+    ENT(*head)->prev = OFF(e);
+  *head = OFF(e);
+  if (tail && !*tail)
+    *tail = OFF(e);
+}
+
+/* 영역을 빈 상태로 되돌린다 */
+static void reset(void)
+{
+  memset(shm->buckets, 0, sizeof(shm->buckets));
+  memset(shm->free_head, 0, sizeof(shm->free_head));
+  memset(shm->lru_head, 0, sizeof(shm->lru_head));
+  memset(shm->lru_tail, 0, sizeof(shm->lru_tail));
+  memset(shm->page_class, -1, shm->npages);
+  shm->next_page = shm->hand = 0;
+}
+
+static void shm_lock(void)
+{
+  if (pthread_mutex_lock(&shm->lock) == EOWNERDEAD) {
+    fprintf(stderr, "shm cache: previous lock holder died, resetting the cache\n");
+    reset();
+    pthread_mutex_consistent(&shm->lock);
+  }
+}
+
+static void shm_unlock(void)
+{
+  pthread_mutex_unlock(&shm->lock);
+}
+
+static void hash_unlink(shm_entry_t *e)
+{
+  uint32_t *pp = &shm->buckets[e->hash & (SHM_NBUCKETS - 1)];
+
+  while (*pp != OFF(e))
+    pp = &ENT(*pp)->hnext;
+  *pp = e->hnext;
+}
+
+/* 객체를 지우고 조각을 빈 조각 목록에 돌려준다 */
+static void free_entry(shm_entry_t *e)
+{
+  hash_unlink(e);
+  list_unlink(&shm->lru_head[e->cls], &shm->lru_tail[e->cls], e);
+  e->used = 0;
+  list_push(&shm->free_head[e->cls], NULL, e);
+}
+
+static shm_entry_t *find(char *url, uint64_t hash)
+{
+  uint32_t off;
+  shm_entry_t *e;
+
+  for (off = shm->buckets[hash & (SHM_NBUCKETS - 1)]; off; off = e->hnext) {
+    e = ENT(off);
+    if (e->hash == hash && !strcmp(e->data, url))
+      break;
+  }
+  if (off && e->epoch != shm->epoch) {  // 무효로 한 뒤에 처음 만난 옛 객체
+    free_entry(e);
+    return NULL;
+  }
+  return off ? e : NULL;
+}
+
+/* 페이지를 cls 등급의 조각으로 잘라 빈 조각 목록에 넣는다 */
+static void carve(uint32_t page, int cls)
+{
+  uint32_t off = shm->pages + page * SHM_PAGE_SIZE, chunk = SHM_MIN_CHUNK << cls, i;
+  shm_entry_t *e;
+
+  shm->page_class[page] = cls;
+  for (i = 0; i + chunk <= SHM_PAGE_SIZE; i += chunk) {
+    e = ENT(off + i);
+    e->cls = cls;
+    e->used = 0;
+    list_push(&shm->free_head[cls], NULL, e);
+  }
+}
+
+/* 다른 등급의 페이지 하나를 비워 cls 등급에 준다. 빼앗을 페이지가 없으면 -1 */
+static int steal_page(int cls)
+{
+  uint32_t i, page, off, chunk;
+  int victim;
+  shm_entry_t *e;
+
+  for (i = 0; i < shm->npages; i++) {
+    page = shm->hand++ % shm->npages;
+    if ((victim = shm->page_class[page]) == cls)
+      continue;
+    off = shm->pages + page * SHM_PAGE_SIZE;
+    chunk = SHM_MIN_CHUNK << victim;
+    for (; off + chunk <= shm->pages + (page + 1) * SHM_PAGE_SIZE; off += chunk) {
+      e = ENT(off);
+      if (e->used) {
+        hash_unlink(e);
+        list_unlink(&shm->lru_head[victim], &shm->lru_tail[victim], e);
+      }
+      else
+        list_unlink(&shm->free_head[victim], NULL, e);
+    }
+    carve(page, cls);
+    return 0;
+  }
+  return -1;
+}
+
+/* cls 등급의 조각 하나를 얻는다 */
+static shm_entry_t *alloc(int cls)
+{
+  shm_entry_t *e;
+
+  if (!shm->free_head[cls]) {
+    if (shm->next_page < shm->npages)
+      carve(shm->next_page++, cls);
+    else if (shm->lru_tail[cls])
+      free_entry(ENT(shm->lru_tail[cls]));
+    else if (steal_page(cls) < 0)
+      return NULL;
+  }
+  e = ENT(shm->free_head[cls]);
+  list_unlink(&shm->free_head[cls], NULL, e);
+  return e;
+}
+
+static int class_of(size_t size)
+{
+  int cls = 0;
+
+  while (cls < SHM_NCLASSES && ((size_t)SHM_MIN_CHUNK << cls) < size)
+    cls++;
+  return cls < SHM_NCLASSES ? cls : -1;
+}
+
+int shm_cache_open(char *name, size_t size)
+{
+  int fd, created = 1, i;
+  struct stat st;
+  pthread_mutexattr_t attr;
+  uint32_t npages, pages;
+
+  if (size > UINT32_MAX)                // 영역 안의 오프셋은 32비트
+    size = UINT32_MAX;
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+    if (errno != EEXIST || (fd = shm_open(name, O_RDWR, 0600)) < 0)
+      return -1;
+    created = 0;
+  }
+  if (created && ftruncate(fd, size) < 0) {
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  // 다른 프로세스가 막 만든 영역이면 크기가 잡힐 때까지 잠깐 기다린다
+  for (i = 0; fstat(fd, &st) == 0 && st.st_size < sizeof(shm_hdr_t) && i < 100; i++)
+    usleep(10000);
+  if (st.st_size < sizeof(shm_hdr_t) ||
+      (shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  if (!created) {                       // 만든 프로세스가 초기화를 끝낼 때까지 기다린다
+    for (i = 0; __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC && i < 100; i++)
+      usleep(10000);
+    if (shm->magic != SHM_MAGIC) {
+      munmap(shm, st.st_size);
+      return -1;
+    }
+    ban_seen = __atomic_load_n(&shm->ban_seq, __ATOMIC_ACQUIRE); // 빈 캐시에는 지난 금지가 필요 없다
+    shm_cache_enabled = 1;
+    return 0;
+  }
+
+  // 머리 뒤에 페이지별 등급 배열이 오고, 슬랩 페이지는 그 뒤 4KB 경계부터 시작한다
+  npages = (size - sizeof(shm_hdr_t)) / (SHM_PAGE_SIZE + 1);
+  pages = (sizeof(shm_hdr_t) + npages + 4095) & ~4095;
+  while (npages && pages + (size_t)npages * SHM_PAGE_SIZE > size)
+    npages--;
+  if (!npages) {
+    munmap(shm, st.st_size);
+    shm_unlink(name);
+    return -1;
+  }
+  shm->size = size;
+  shm->pages = pages;
+  shm->npages = npages;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&shm->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  reset();
+  __atomic_store_n(&shm->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  shm_cache_enabled = 1;
+  return 0;
+}
+
+cache_blob_t *shm_cache_lookup(char *url, uint64_t hash, cache_meta_t *meta)
+{
+  shm_entry_t *e;
+  cache_blob_t *blob = NULL;
+
+  shm_lock();
+  if ((e = find(url, hash))) {
+    list_unlink(&shm->lru_head[e->cls], &shm->lru_tail[e->cls], e);
+    list_push(&shm->lru_head[e->cls], &shm->lru_tail[e->cls], e);
+    *meta = e->meta;
+    blob = cache_blob_new(NULL, e->len);
+    memcpy(blob->data, e->data + e->urllen + 1, e->len);
+    blob->hdrlen = e->hdrlen;
+  }
+  shm_unlock();
+  return blob;
+}
+
+void shm_cache_insert(char *url, uint64_t hash, cache_meta_t *meta, cache_blob_t *blob)
+{
+  size_t urllen = strlen(url);
+  int cls = class_of(sizeof(shm_entry_t) + urllen + 1 + blob->len);
+  shm_entry_t *e;
+
+  if (cls < 0)
+    return;
+  shm_lock();
+  if ((e = find(url, hash)))
+    free_entry(e);
+  if ((e = alloc(cls))) {
+    e->used = 1;
+    e->hash = hash;
+    e->urllen = urllen;
+    e->epoch = shm->epoch;
+    e->len = blob->len;
+    e->hdrlen = blob->hdrlen;
+    e->meta = *meta;
+    memcpy(e->data, url, urllen + 1);
+    memcpy(e->data + urllen + 1, blob->data, blob->len);
+    e->hnext = shm->buckets[hash & (SHM_NBUCKETS - 1)];
+    shm->buckets[hash & (SHM_NBUCKETS - 1)] = OFF(e);
+    list_push(&shm->lru_head[cls], &shm->lru_tail[cls], e);
+  }
+  shm_unlock();
+}
+
+void shm_cache_touch(char *url, uint64_t hash, cache_meta_t *meta)
+{
+  shm_entry_t *e;
+
+  shm_lock();
+  if ((e = find(url, hash)) && e->meta.size == meta->size &&
+      !strcmp(e->meta.etag, meta->etag) && !strcmp(e->meta.lastmod, meta->lastmod))
+    e->meta.expires = meta->expires;
+  shm_unlock();
+}
+
+void shm_cache_remove(char *url, uint64_t hash)
+{
+  shm_entry_t *e;
+
+  shm_lock();
+  if ((e = find(url, hash)))
+    free_entry(e);
+  shm_unlock();
+}
+
+void shm_cache_flush(void)
+{
+  shm_lock();
+  shm->epoch++;
+  shm_unlock();
+}
+
+void shm_cache_publish(int type, char *pattern)
+{
+  shm_ban_t *b;
+
+  shm_lock();
+  b = &shm->bans[(shm->ban_seq + 1) % SHM_NBANS];
+  b->pid = getpid();
+  if (strlen(pattern) < SHM_BAN_LEN) {
+    b->type = type;
+    strcpy(b->pattern, pattern);
+  }
+  else {                                // 담을 수 없으면 빈 접두사로 모두 무효로 한다
+    b->type = CACHE_BAN_PREFIX;
+    b->pattern[0] = '\0';
+  }
+  __atomic_store_n(&shm->ban_seq, shm->ban_seq + 1, __ATOMIC_RELEASE);   // 자기 것은 pid로 거른다
+  shm_unlock();
+}
+
+int shm_cache_has_bans(void)
+{
+  return __atomic_load_n(&shm->ban_seq, __ATOMIC_ACQUIRE) != __atomic_load_n(&ban_seen, __ATOMIC_RELAXED);
+}
+
+int shm_cache_next_ban(int *type, char *pattern)
+{
+  shm_ban_t *b;
+  int rc = 0;
+
+  shm_lock();
+  while (!rc && ban_seen != shm->ban_seq) {
+    if (shm->ban_seq - ban_seen > SHM_NBANS) {
+      __atomic_store_n(&ban_seen, shm->ban_seq, __ATOMIC_RELAXED);
+      rc = -1;
+      break;
+    }
+    __atomic_store_n(&ban_seen, ban_seen + 1, __ATOMIC_RELAXED);
+    b = &shm->bans[ban_seen % SHM_NBANS];
+    if (b->pid == getpid())
+      continue;
+    *type = b->type;
+    strcpy(pattern, b->pattern);
+    rc = 1;
+  }
+  shm_unlock();
+  return rc;
+}
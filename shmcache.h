@@ -0,0 +1,98 @@
+/*
+ * shmcache.h - 여러 프록시 프로세스가 함께 쓰는 공유 메모리 캐시
+ *
+ * cache.c의 프로세스별 캐시 뒤에 붙는 두 번째 단계로, -m 옵션을 주면 켜진다.
+ * 작은 객체(MAX_OBJECT_SIZE 이하)의 직렬화된 응답을 POSIX 공유 메모리에 두어,
+ * 한 프로세스가 원 서버에서 받아 온 객체를 같은 호스트의 다른 프로세스도 쓴다.
+ *
+ * 관리 요청은 한 프로세스에만 닿으므로, 지우기와 금지도 영역에 최근 SHM_NBANS개를 번호를
+ * 붙여 남긴다. 다른 프로세스는 조회할 때 번호가 바뀌었으면 그것들을 자기 금지 목록에 들인다.
+ */
+#ifndef __SHMCACHE_H__
+#define __SHMCACHE_H__
+
+#include "cache.h"
+
+#define SHM_PAGE_SIZE (128 * 1024)  /* 슬랩 페이지 크기 = 가장 큰 크기 등급 */
+#define SHM_MIN_CHUNK 1024          /* 가장 작은 크기 등급, 등급마다 두 배씩 */
+#define SHM_NCLASSES 8              /* 1K, 2K, ... 128K */
+#define SHM_NBUCKETS 4096           /* 해시 버킷 수 (2의 거듭제곱) */
+#define SHM_NBANS 32                /* 영역에 남겨 두는 최근 금지 수 */
+#define SHM_BAN_LEN 2048            /* 금지 pattern의 최대 길이 (넘으면 모두 무효로 알린다) */
+#define SHM_MAGIC 0x53484d45        /* "SHME": 초기화가 끝난 영역 (배치가 바뀌면 올린다) */
+
+/* 슬랩 조각의 머리. 오프셋은 영역 시작에서의 바이트 수이며 0은 NULL이다 */
+typedef struct {
+  uint32_t cls;                 /* 크기 등급 */
+  uint32_t used;                /* 객체가 들어 있으면 1, 빈 조각이면 0 */
+  uint32_t prev, next;          /* used면 등급별 LRU 리스트, 아니면 빈 조각 리스트 */
+  uint32_t hnext;               /* 해시 버킷 체인 */
+  uint64_t hash;
+  uint32_t urllen;
+  uint32_t epoch;               /* 넣을 때의 영역 epoch */
+  uint32_t len, hdrlen;         /* blob 길이와 그중 헤더 길이 */
+  cache_meta_t meta;
+  char data[];                  /* url, '\0', blob */
+} shm_entry_t;
+
+/* 다른 프로세스에 알린 금지 하나 */
+typedef struct {
+  int32_t type;                 /* CACHE_BAN_* */
+  pid_t pid;                    /* 알린 프로세스 (자기 것은 다시 들이지 않는다) */
+  char pattern[SHM_BAN_LEN];
+} shm_ban_t;
+
+/* 영역 맨 앞의 머리. ban_seq 말고는 모두 lock 아래에서만 읽고 쓴다 */
+typedef struct {
+  uint32_t magic;
+  pthread_mutex_t lock;         /* 프로세스 공유, robust */
+  size_t size;                  /* 영역 전체 크기 */
+  uint32_t pages;               /* 첫 슬랩 페이지의 오프셋 */
+  uint32_t npages;
+  uint32_t next_page;           /* 아직 어느 등급에도 안 준 첫 페이지 */
+  uint32_t hand;                /* 빼앗아 올 페이지를 고르는 시계 바늘 */
+  uint32_t epoch;               /* 이보다 앞선 epoch의 객체는 없는 것으로 본다 */
+  uint32_t free_head[SHM_NCLASSES];
+  uint32_t lru_head[SHM_NCLASSES], lru_tail[SHM_NCLASSES];
+  uint32_t buckets[SHM_NBUCKETS];
+  uint32_t ban_seq;             /* 마지막으로 알린 금지의 번호 (n번은 bans[n % SHM_NBANS]) */
+  shm_ban_t bans[SHM_NBANS];
+  int8_t page_class[];          /* 페이지별 크기 등급 (-1이면 아직 안 씀) */
+} shm_hdr_t;
+
+extern int shm_cache_enabled;
+
+/*
+ * name의 공유 메모리 영역을 열고, 처음 만드는 프로세스라면 size 바이트로 만들어 초기화한다.
+ * 이미 있는 영역은 그 크기를 그대로 쓴다. 실패하면 -1.
+ */
+int shm_cache_open(char *name, size_t size);
+
+/* url의 응답을 찾아 프로세스 메모리의 새 blob(참조 1)으로 복사해 돌려준다. 없으면 NULL */
+cache_blob_t *shm_cache_lookup(char *url, uint64_t hash, cache_meta_t *meta);
+
+/* 작은 객체의 blob을 공유 영역에 넣는다. 같은 url이 있으면 교체한다 */
+void shm_cache_insert(char *url, uint64_t hash, cache_meta_t *meta, cache_blob_t *blob);
+
+/* 재검증으로 판이 그대로임을 확인한 객체의 만료 시각을 늦춘다 */
+void shm_cache_touch(char *url, uint64_t hash, cache_meta_t *meta);
+
+/* url의 객체를 지운다 */
+void shm_cache_remove(char *url, uint64_t hash);
+
+/* 지금까지 넣은 객체를 모두 무효로 한다. 조각은 찾다가 만날 때 돌려준다 */
+void shm_cache_flush(void);
+
+/* 이 프로세스가 받은 금지(type은 CACHE_BAN_*)를 다른 프로세스에 알린다 */
+void shm_cache_publish(int type, char *pattern);
+
+/* 다른 프로세스가 알린 금지 중 아직 안 가져온 것이 있으면 1. 락을 잡지 않는다 */
+int shm_cache_has_bans(void);
+
+/*
+ * 아직 안 가져온 다음 금지를 *type과 pattern(SHM_BAN_LEN바이트)에 담고 1을 돌려준다. 더
+ * 없으면 0, 가져오기 전에 덮어쓰인 금지가 있었으면 -1 (호출자는 캐시 전체를 무효로 한다).
+ */
+int shm_cache_next_ban(int *type, char *pattern);
+
+#endif /* __SHMCACHE_H__ */
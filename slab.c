@@ -0,0 +1,280 @@
+/*
+ * slab.c - 캐시 blob 전용 슬랩 할당기
+ *
+ * 페이지 크기(page_size) 경계에 맞춘 페이지를 mmap으로 잡아, 처음 필요해진 크기 등급에 주고 그
+ * 등급의 조각으로 잘라 쓴다. 페이지 머리는 페이지 맨 앞에 있으므로 조각 주소를 페이지
+ * 크기로 내림하면 머리가 나온다. 조각은 앞에서부터 필요할 때만 잘라 아직 안 쓴 부분은
+ * 건드리지 않는다(RSS에 잡히지 않는다).
+ *
+ * 등급마다 빈 조각이 남은 페이지 목록을 두고, 페이지의 조각이 모두 돌아오면 그 페이지를
+ * 등급에서 떼어 빈 페이지 목록으로 보낸다. 빈 페이지는 어느 등급이든 다시 가져가 새
+ * 크기로 자르므로, 본문 크기 분포가 바뀌면 페이지가 그쪽 등급으로 옮겨 간다.
+ * 빈 페이지가 SLAB_KEEP_EMPTY개를 넘으면 운영체제에 돌려준다. 페이지 머리에는 호출자가 쓰는
+ * 포인터 자리가 하나 있어, 캐시는 여기에 그 페이지에 든 세그먼트 목록을 걸어 두고 페이지
+ * 단위로 비운다.
+ *
+ * slab_hugepages가 켜져 있고 페이지가 2MB이면 MAP_HUGETLB로 휴즈 페이지를 먼저 시도하고,
+ * 예약된 휴즈 페이지가 없으면 보통 페이지에 MADV_HUGEPAGE를 걸어 투명 휴즈 페이지를 청한다.
+ *
+ * 모든 연산은 뮤텍스 하나 아래에서 이루어진다. 캐시 락과는 따로라서 클라이언트 쓰레드가
+ * blob의 마지막 참조를 놓으며 조각을 돌려줄 때도 캐시를 막지 않는다.
+ */
+#include <stdint.h>
+#include "csapp.h"
+#include "slab.h"
+
+#define SLAB_HDR 64             /* 페이지 머리가 차지하는 앞부분 (조각 정렬 단위) */
+
+typedef struct slab_page {
+  int cls;                      /* 속한 등급 (빈 페이지면 마지막으로 속했던 등급, 처음이면 -1) */
+  unsigned nused;               /* 나가 있는 조각 수 */
+  unsigned ncarved;             /* 앞에서부터 잘라 준 조각 수 */
+  void *free;                   /* 돌아온 조각 목록 (조각 앞에 다음 조각 포인터) */
+  struct slab_page *prev, *next;/* 등급의 빈 조각 있는 페이지 목록, 또는 빈 페이지 목록 */
+  void *slot;                   /* slab_page_slot: 캐시가 이 페이지의 세그먼트 목록을 둔다 */
+} slab_page_t;
+
+typedef struct {
+  size_t size;                  /* 조각 크기 */
+  unsigned perpage;             /* 페이지 하나의 조각 수 */
+  slab_page_t *partial;         /* 빈 조각이 남은 페이지 */
+} slab_class_t;
+
+int slab_enabled = 1;
+int slab_hugepages = 0;
+
+static slab_class_t classes[SLAB_MAX_CLASSES];
+static int nclasses;
+static size_t page_size = SLAB_PAGE_SIZE;
+static size_t max_chunk = ((SLAB_PAGE_SIZE - SLAB_HDR) / SLAB_CHUNK_DIV) & ~(size_t)15;
+static slab_page_t *empty_pages;
+static slab_stats_t stats;              /* slab_mutex가 보호 */
+static pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+/* SLAB_MIN_CHUNK부터 SLAB_GROWTH배씩 키운 등급표를 만든다. 마지막 등급은 max_chunk */
+static void init_classes(void)
+{
+  double size = SLAB_MIN_CHUNK;
+  size_t chunk;
+
+  do {
+    chunk = ((size_t)size + 15) & ~(size_t)15;
+    if (chunk > max_chunk || nclasses == SLAB_MAX_CLASSES - 1)
+      chunk = max_chunk;
+    classes[nclasses].size = chunk;
+    classes[nclasses++].perpage = (page_size - SLAB_HDR) / chunk;
+    size *= SLAB_GROWTH;
+  } while (chunk < max_chunk);
+}
+
+int slab_configure(size_t budget)
+{
+  size_t page = SLAB_PAGE_SIZE;
+
+  if (nclasses)                         // 이미 페이지를 자르기 시작했다
+    return slab_enabled;
+  while (page > SLAB_MIN_PAGE && budget < SLAB_MIN_PAGES * page)
+    page /= 2;
+  if (budget < SLAB_MIN_PAGES * page)   // 가장 작은 페이지로도 등급마다 몇 장씩 못 준다
+    slab_enabled = 0;
+  page_size = page;
+  max_chunk = ((page - SLAB_HDR) / SLAB_CHUNK_DIV) & ~(size_t)15;   // 가장 큰 등급도 페이지에 SLAB_CHUNK_DIV개
+  return slab_enabled;
+}
+
+static int class_of(size_t size)
+{
+  int lo = 0, hi = nclasses - 1, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (classes[mid].size < size)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void list_unlink(slab_page_t **head, slab_page_t *pg)
+{
+  if (pg->prev)
+    pg->prev->next = pg->next;
+  else
+    *head = pg->next;
+  if (pg->next)
+    pg->next->prev = pg->prev;
+  pg->prev = pg->next = NULL;
+}
+
+static void list_push(slab_page_t **head, slab_page_t *pg)
+{
+  pg->prev = NULL;
+  pg->next = *head;
+  if (*head)
+    (*head)->prev = pg;
+  *head = pg;
+}
+
+/* page_size 경계에 맞춘 새 페이지를 운영체제에서 받는다 */
+static slab_page_t *map_page(void)
+{
+  char *p;
+  size_t off;
+
+#ifdef MAP_HUGETLB
+  if (slab_hugepages && page_size == SLAB_PAGE_SIZE &&
+      (p = mmap(NULL, SLAB_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) != MAP_FAILED)
+    return (slab_page_t *)p;
+#endif
+  // 경계에 맞추려고 두 배를 잡은 뒤 앞뒤 남는 부분을 돌려준다
+  if ((p = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    unix_error("mmap error");
+  off = (page_size - ((uintptr_t)p & (page_size - 1))) & (page_size - 1);
+  if (off)
+    munmap(p, off);
+  munmap(p + off + page_size, page_size - off);
+  p += off;
+#ifdef MADV_HUGEPAGE
+  if (slab_hugepages && page_size == SLAB_PAGE_SIZE)
+    madvise(p, SLAB_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+  ((slab_page_t *)p)->cls = -1;
+  return (slab_page_t *)p;
+}
+
+/* cls 등급에 빈 페이지를 하나 준다. 빈 페이지 목록에 없으면 새로 받는다 */
+static slab_page_t *take_page(int cls)
+{
+  slab_page_t *pg;
+
+  if ((pg = empty_pages)) {
+    list_unlink(&empty_pages, pg);
+    stats.empty--;
+    if (pg->cls != cls)
+      stats.moves++;
+  }
+  else {
+    pg = map_page();
+    stats.mapped += page_size;
+  }
+  pg->cls = cls;
+  pg->nused = pg->ncarved = 0;
+  pg->free = NULL;
+  pg->slot = NULL;
+  list_push(&classes[cls].partial, pg);
+  stats.pages++;
+  stats.cls_pages[cls]++;
+  return pg;
+}
+
+void *slab_alloc(size_t size, size_t *cap, size_t limit)
+{
+  slab_class_t *c;
+  slab_page_t *pg;
+  void *p;
+  int cls;
+
+  if (!slab_enabled || size > max_chunk) {
+    *cap = size;
+    p = Malloc(size);
+    pthread_mutex_lock(&slab_mutex);
+    stats.mapped += size;
+    stats.used += size;
+    pthread_mutex_unlock(&slab_mutex);
+    return p;
+  }
+  pthread_once(&slab_once, init_classes);
+  cls = class_of(size);
+  c = &classes[cls];
+
+  pthread_mutex_lock(&slab_mutex);
+  if (!(pg = c->partial)) {
+    if (limit && !empty_pages && stats.mapped + page_size > limit) {
+      pthread_mutex_unlock(&slab_mutex);
+      return NULL;
+    }
+    pg = take_page(cls);
+  }
+  if ((p = pg->free))
+    pg->free = *(void **)p;
+  else
+    p = (char *)pg + SLAB_HDR + (size_t)pg->ncarved++ * c->size;
+  if (++pg->nused == c->perpage)        // 꽉 찬 페이지는 조각이 돌아올 때 다시 올린다
+    list_unlink(&c->partial, pg);
+  stats.used += c->size;
+  stats.cls_used[cls]++;
+  pthread_mutex_unlock(&slab_mutex);
+  *cap = c->size;
+  return p;
+}
+
+void slab_free(void *p, size_t cap)
+{
+  slab_page_t *pg;
+  slab_class_t *c;
+
+  if (!slab_enabled || cap > max_chunk) {
+    Free(p);
+    pthread_mutex_lock(&slab_mutex);
+    stats.mapped -= cap;
+    stats.used -= cap;
+    pthread_mutex_unlock(&slab_mutex);
+    return;
+  }
+  pg = (slab_page_t *)((uintptr_t)p & ~(uintptr_t)(page_size - 1));
+  c = &classes[pg->cls];
+
+  pthread_mutex_lock(&slab_mutex);
+  *(void **)p = pg->free;
+  pg->free = p;
+  if (pg->nused-- == c->perpage)
+    list_push(&c->partial, pg);
+  stats.used -= c->size;
+  stats.cls_used[pg->cls]--;
+  if (!pg->nused) {                     // 빈 페이지는 어느 등급이든 다시 가져갈 수 있게 뗀다
+    list_unlink(&c->partial, pg);
+    stats.pages--;
+    stats.cls_pages[pg->cls]--;
+    if (stats.empty < SLAB_KEEP_EMPTY) {
+      list_push(&empty_pages, pg);
+      stats.empty++;
+    }
+    else {
+      munmap(pg, page_size);
+      stats.mapped -= page_size;
+    }
+  }
+  pthread_mutex_unlock(&slab_mutex);
+}
+
+void **slab_page_slot(void *p)
+{
+  return &((slab_page_t *)((uintptr_t)p & ~(uintptr_t)(page_size - 1)))->slot;
+}
+
+int slab_class(size_t size)
+{
+  if (!slab_enabled || size > max_chunk)
+    return -1;
+  pthread_once(&slab_once, init_classes);
+  return class_of(size);
+}
+
+void slab_get_stats(slab_stats_t *st)
+{
+  int i;
+
+  pthread_once(&slab_once, init_classes);
+  pthread_mutex_lock(&slab_mutex);
+  *st = stats;
+  pthread_mutex_unlock(&slab_mutex);
+  st->page = page_size;
+  st->max_chunk = max_chunk;
+  st->nclasses = nclasses;
+  for (i = 0; i < nclasses; i++)
+    st->chunk[i] = classes[i].size;
+}
@@ -0,0 +1,70 @@
+/*
+ * slab.h - 캐시 blob 전용 슬랩 할당기
+ *
+ * 크기가 제각각인 본문을 Malloc/Free로 오래 넣고 빼면 힙이 조각나 RSS가 캐시 예산보다
+ * 한참 커진다. 캐시 저장소는 대신 페이지를 크기 등급별 조각으로 잘라 쓰고, 캐시는 요청
+ * 크기가 아닌 조각 크기로 예산을 센다. 페이지는 SLAB_PAGE_SIZE이지만 예산이 작으면
+ * slab_configure가 예산에 페이지가 SLAB_MIN_PAGES개 들어가도록 2의 거듭제곱으로 줄인다.
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+#define SLAB_PAGE_SIZE (2 * 1024 * 1024)   /* 가장 큰 페이지 = 2MB 휴즈 페이지 하나 */
+#define SLAB_MIN_PAGE (16 * 1024)          /* 작은 예산에서 줄일 수 있는 가장 작은 페이지 */
+#define SLAB_MIN_PAGES 64                  /* 예산에 이만큼의 페이지는 들어가야 슬랩을 쓴다 */
+#define SLAB_CHUNK_DIV 2                   /* 페이지에 이만큼 들어가지 않는 요청은 Malloc으로 */
+#define SLAB_MIN_CHUNK 64                  /* 가장 작은 크기 등급 */
+#define SLAB_GROWTH 1.25                   /* 등급마다 조각 크기가 이만큼 커진다 */
+#define SLAB_MAX_CLASSES 48
+#define SLAB_KEEP_EMPTY 2                  /* 돌려주지 않고 들고 있을 빈 페이지 수 */
+#define SLAB_MIN_BUDGET (SLAB_MIN_PAGES * SLAB_MIN_PAGE) /* 캐시 예산이 이보다 작으면 슬랩을 쓰지 않는다 */
+
+/* 할당기 통계. 모든 크기는 바이트 */
+typedef struct {
+  size_t page;                  /* 페이지 크기 */
+  size_t max_chunk;             /* 이보다 큰 요청은 Malloc으로 받았다 */
+  size_t mapped;                /* 페이지로 잡은 메모리 (Malloc으로 준 큰 요청 포함) */
+  size_t used;                  /* 쓰이고 있는 조각 크기의 합 */
+  unsigned long pages;          /* 등급에 속한 페이지 수 */
+  unsigned long empty;          /* 아무 등급에도 안 속한 빈 페이지 수 */
+  unsigned long moves;          /* 한 등급에서 비어 다른 등급으로 다시 잘린 페이지 수 */
+  int nclasses;
+  size_t chunk[SLAB_MAX_CLASSES];          /* 등급별 조각 크기 */
+  unsigned long cls_pages[SLAB_MAX_CLASSES];
+  unsigned long cls_used[SLAB_MAX_CLASSES];  /* 등급별 쓰이는 조각 수 */
+} slab_stats_t;
+
+extern int slab_enabled;        /* 0이면 모든 요청을 Malloc으로 (벤치마크 비교용) */
+extern int slab_hugepages;      /* -H: 페이지를 휴즈 페이지로 잡는다 */
+
+/*
+ * 캐시 예산 budget에 맞춰 페이지 크기를 정한다. 예산이 SLAB_MIN_BUDGET보다 작으면 슬랩을
+ * 끈다. 처음 할당하기 전에만 바꾸며, 그 뒤에는 아무것도 하지 않는다. 슬랩을 쓰면 1
+ */
+int slab_configure(size_t budget);
+
+/*
+ * size 바이트 이상의 조각을 돌려주고 실제 조각 크기를 *cap에 담는다. limit이 0이 아니고
+ * 그 등급에 빈 조각도 빈 페이지도 없는데 새 페이지를 잡으면 limit을 넘게 되면 NULL.
+ */
+void *slab_alloc(size_t size, size_t *cap, size_t limit);
+
+/* slab_alloc이 준 조각을 돌려준다. cap은 그때 받은 값 */
+void slab_free(void *p, size_t cap);
+
+/*
+ * 조각 p가 든 페이지에 호출자가 마음대로 쓰는 포인터 자리. 페이지가 등급에 새로 들어갈 때
+ * NULL이 되고, 그 뒤로는 할당기가 건드리지 않는다. 슬랩 조각(slab_class가 -1이 아닌
+ * 크기로 받은 것)에만 쓸 수 있다.
+ */
+void **slab_page_slot(void *p);
+
+/* size 바이트 요청을 받을 크기 등급. 슬랩을 안 쓰는 크기면 -1 */
+int slab_class(size_t size);
+
+void slab_get_stats(slab_stats_t *st);
+
+
+#endif /* __SLAB_H__ */
@@ -1,41 +1,93 @@
 /*
  * adder.c - a minimal CGI program that adds two numbers together
+ *
+ *     TINY_CGI_LOOP 환경 변수가 있으면 tiny의 상주 작업 프로세스로 뜬 것이다. 이때는
+ *     표준 입력의 소켓으로 요청 틀을 받아 응답 틀을 돌려주는 일을 tiny가 소켓을 닫을
+ *     때까지 되풀이한다 (틀의 모양은 ../cgipool.h).
+ *
+ *     -DTINY_PLUGIN으로 빌드한 adder.so는 tiny가 dlopen해 tiny_handle을 작업 쓰레드에서
+ *     바로 부른다 (../plugin.h). 이때는 main이 없고 환경 변수 대신 요청에서 값을 읽는다.
  */
 /* $begin adder */
 #include "csapp.h"
+#include "cgipool.h"
+#include "plugin.h"
 
-int main(void) {
-  char *buf, *p, *method;
-  char arg1[MAXLINE], arg2[MAXLINE], content[MAXLINE];
-  int n1=0, n2=0;
+/* QUERY_STRING buf와 REQUEST_METHOD method로 응답 헤더와 본문을 out에 만들고 길이를 돌려준다 */
+int respond(char *out, const char *buf, const char *method) {
+  char *p;
+  char query[MAXLINE], arg1[MAXLINE], arg2[MAXLINE], content[MAXLINE];
+  int n1=0, n2=0, n;
 
   /* Extract the two arguments */
-  if ((buf = getenv("QUERY_STRING")) != NULL) {      //getenv: "QUERY_STRING" 값을 가져온다
-    p = strchr(buf, '&');    // buf안에 &가 포함되어 있는지 확인하여 있으면 &의 위치 포인터 리턴
-    *p = '\0';
-    strcpy(arg1, buf+3);
-    strcpy(arg2, p+4);
-    n1 = atoi(arg1);
-    n2 = atoi(arg2);
+  if (buf != NULL) {
+    snprintf(query, sizeof(query), "%s", buf);       // 환경 변수를 고치지 않도록 복사해서 자른다
+    if ((p = strchr(query, '&')) != NULL) {    // buf안에 &가 포함되어 있는지 확인하여 있으면 &의 위치 포인터 리턴
+      *p = '\0';
+      strcpy(arg1, strlen(query) >= 3 ? query+3 : "");
+      strcpy(arg2, strlen(p+1) >= 3 ? p+4 : "");
+      n1 = atoi(arg1);
+      n2 = atoi(arg2);
+    }
   }
-  
-  /* Make the response body */
-  sprintf(content, "QUERY_STRING=%s", buf);
-  sprintf(content, "Welcome to add.com: ");
-  sprintf(content, "%sTHE Internet addition portal.\r\n<p>", content);
-  sprintf(content, "%sThe answer is: %d + %d = %d\r\n<p>", content, n1, n2, n1 + n2);
-  sprintf(content, "%sThanks for visiting!\r\n", content);
-  
-  method = getenv("REQUEST_METHOD");
-  /* Generate the HTTP response */
-  printf("Connection: close\r\n");
-  printf("Content-length: %d\r\n", (int)strlen(content));
-  printf("Content-type: text/html\r\n\r\n");
-  
-  if (strcasecmp(method, "HEAD"))
-    printf("%s", content);
+
+  /* Make the response body (작업 쓰레드에서도 돌므로 content를 자기 자신에 덧붙이지 않는다) */
+  n = sprintf(content, "Welcome to add.com: ");
+  n += sprintf(content + n, "THE Internet addition portal.\r\n<p>");
+  n += sprintf(content + n, "The answer is: %d + %d = %d\r\n<p>", n1, n2, n1 + n2);
+  n += sprintf(content + n, "Thanks for visiting!\r\n");
+
+  /* Generate the HTTP response (Connection은 tiny가 정한다) */
+  return sprintf(out, "Content-length: %d\r\n"
+                 "Content-type: text/html\r\n\r\n%s",
+                 n, (method && !strcasecmp(method, "HEAD")) ? "" : content);
+}
+
+#ifdef TINY_PLUGIN
+int tiny_plugin_abi = TINY_PLUGIN_ABI;
+
+int tiny_handle(const tiny_req_t *req, tiny_writer_t *w) {
+  char out[2 * MAXLINE];
+  int n = respond(out, req->query, req->method);
+
+  return w->write(w, out, n);
+}
+#else
+/* tiny의 작업 프로세스로서 요청 틀마다 환경 변수를 바꿔 가며 응답 틀을 돌려준다 */
+void serve_loop(void) {
+  cgi_frame_t f = { CGI_MAGIC, 0 };
+  char req[2 * MAXLINE + 32], resp[sizeof(cgi_frame_t) + 2 * MAXLINE], *kv, *next, *eq;
+
+  if (rio_writen(STDIN_FILENO, &f, sizeof(f)) != sizeof(f))    // 준비됐음을 알린다
+    exit(1);
+  while (rio_readn(STDIN_FILENO, &f, sizeof(f)) == sizeof(f) && f.magic == CGI_MAGIC &&
+         f.len < sizeof(req) && rio_readn(STDIN_FILENO, req, f.len) == f.len) {
+    req[f.len] = '\0';
+    for (kv = req; kv < req + f.len; kv = next) {
+      next = kv + strlen(kv) + 1;
+      if ((eq = strchr(kv, '=')) != NULL) {
+        *eq = '\0';
+        setenv(kv, eq + 1, 1);
+      }
+    }
+    f.len = respond(resp + sizeof(f), getenv("QUERY_STRING"), getenv("REQUEST_METHOD"));
+    memcpy(resp, &f, sizeof(f));
+    if (rio_writen(STDIN_FILENO, resp, sizeof(f) + f.len) != sizeof(f) + f.len)
+      break;
+  }
+  exit(0);
+}
+
+int main(void) {
+  char out[2 * MAXLINE];
+
+  if (getenv("TINY_CGI_LOOP"))
+    serve_loop();
+  respond(out, getenv("QUERY_STRING"), getenv("REQUEST_METHOD"));
+  printf("%s", out);
   fflush(stdout);
 
   exit(0);
 }
+#endif
 /* $end adder */
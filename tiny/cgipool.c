@@ -0,0 +1,211 @@
+/*
+ * cgipool.c - tiny의 상주 CGI 작업 프로세스 풀
+ *
+ * 옆에 <프로그램>.pool 파일이 있는 프로그램만 풀로 실행한다. 모르는 프로그램을 루프 모드인지
+ * 알아보려고 한 번 더 실행하지 않도록, 표시가 없으면 띄우지 않고 호출자가 fork로 실행한다.
+ *
+ * 프로그램마다 작업 프로세스 자리 cgi_nworkers개를 두고, 요청이 오면 쉬고 있는 작업 프로세스를
+ * 잡아 요청 틀을 보내고 응답 틀을 받는다. 작업 프로세스는 처음 필요할 때 띄우며, 다 바쁘면
+ * 하나가 빌 때까지 기다린다. 주고받다 죽은 작업 프로세스는 거두고 그 자리에 새로 띄워 한 번 더
+ * 보낸다 (쉬는 동안 죽은 경우. GET과 HEAD만 오므로 다시 보내도 된다). -t초 안에 응답하지
+ * 않은 작업 프로세스는 죽이고 다시 보내지 않는다. 그 자리는 다음 요청이 새로 띄운다.
+ *
+ * 표는 뮤텍스 하나로 보호하고, 띄우기와 주고받기는 잡은 작업 프로세스에 대해 락 밖에서 한다.
+ */
+#include "cgipool.h"
+#include "cgirelay.h"
+
+typedef struct {
+  pid_t pid;
+  int fd;                       /* 작업 프로세스와 이어진 소켓 (아직 안 띄웠으면 -1) */
+  int busy;                     /* 요청을 처리 중이거나 띄우는 중이면 1 */
+} cgi_worker_t;
+
+typedef struct {
+  char path[MAXLINE];
+  cgi_worker_t *w;              /* cgi_nworkers개의 자리 */
+  pthread_cond_t idle;          /* 작업 프로세스 하나가 비었다 */
+} cgi_prog_t;
+
+int cgi_nworkers = CGI_NWORKERS;
+
+static cgi_prog_t progs[CGI_MAXPROGS];
+static int nprogs;
+static pthread_mutex_t cgi_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* path의 항목을 찾고 없으면 만든다. path.pool 표시가 없거나 표가 찼으면 NULL */
+static cgi_prog_t *find_prog(char *path)
+{
+  char marker[MAXLINE + 8];
+  cgi_prog_t *p;
+  int i;
+
+  for (i = 0; i < nprogs; i++)
+    if (!strcmp(progs[i].path, path))
+      return &progs[i];
+  if (nprogs == CGI_MAXPROGS || strlen(path) >= MAXLINE)
+    return NULL;
+  sprintf(marker, "%s.pool", path);
+  if (access(marker, F_OK) < 0)
+    return NULL;
+  p = &progs[nprogs++];
+  strcpy(p->path, path);
+  p->w = Malloc(cgi_nworkers * sizeof(cgi_worker_t));
+  for (i = 0; i < cgi_nworkers; i++) {
+    p->w[i].fd = -1;
+    p->w[i].busy = 0;
+  }
+  pthread_cond_init(&p->idle, NULL);
+  return p;
+}
+
+static void kill_worker(cgi_worker_t *w)
+{
+  kill(w->pid, SIGKILL);
+  Close(w->fd);
+  waitpid(w->pid, NULL, 0);
+  w->fd = -1;
+}
+
+/* deadline까지 fd에서 n바이트를 다 읽는다. 0이면 성공, -1이면 끊겼고, -2면 제한 시간이 지났다 */
+static int read_full(int fd, void *buf, size_t n, struct timespec *deadline)
+{
+  ssize_t rc;
+
+  while (n > 0) {
+    if (!cgi_wait(fd, deadline))
+      return -2;
+    if ((rc = read(fd, buf, n)) < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return -1;
+    buf = (char *)buf + rc;
+    n -= rc;
+  }
+  return 0;
+}
+
+/* path를 작업 프로세스로 띄우고 준비 틀을 기다린다. 실패하면 -1 */
+static int spawn(char *path, cgi_worker_t *w)
+{
+  int sv[2], devnull, fd, maxfd, n;
+  char **envp, *argv[] = { path, NULL };
+  struct timeval tv = { cgi_timeout, 0 };
+  struct timespec deadline;
+  cgi_frame_t f;
+
+  // 자식에서는 execve 전까지 락을 잡는 함수를 부르지 않도록 환경은 미리 만든다
+  for (n = 0; environ[n]; n++)
+    ;
+  envp = Malloc((n + 2) * sizeof(char *));
+  memcpy(envp, environ, n * sizeof(char *));
+  envp[n] = "TINY_CGI_LOOP=1";
+  envp[n + 1] = NULL;
+  maxfd = sysconf(_SC_OPEN_MAX);
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    Free(envp);
+    return -1;
+  }
+  devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if ((w->pid = fork()) == 0) {
+    dup2(sv[1], STDIN_FILENO);          // 요청과 응답은 표준 입력의 소켓으로
+    dup2(devnull >= 0 ? devnull : sv[1], STDOUT_FILENO);  // 틀을 모르는 프로그램의 출력은 버린다
+    for (fd = 3; fd < maxfd; fd++)      // 다른 쓰레드의 클라이언트 소켓을 물려받아 붙잡지 않도록
+      close(fd);
+    execve(path, argv, envp);
+    _exit(1);
+  }
+  Free(envp);
+  Close(sv[1]);
+  if (devnull >= 0)
+    Close(devnull);
+  if (w->pid < 0) {
+    Close(sv[0]);
+    return -1;
+  }
+  w->fd = sv[0];
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += CGI_HELLO_TIMEOUT;
+  if (read_full(w->fd, &f, sizeof(f), &deadline) < 0 || f.magic != CGI_MAGIC || f.len != 0) {
+    kill_worker(w);
+    return -1;
+  }
+  if (cgi_timeout > 0)                  // 요청 틀을 읽지 않는 작업 프로세스에 쓰다가도 막히지 않도록
+    setsockopt(w->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  return 0;
+}
+
+/* 요청 틀을 보내고 -t초 안에 응답 틀을 받는다. 작업 프로세스가 죽었으면 -1, 제한 시간이 지났으면 -2 */
+static int exchange(cgi_worker_t *w, char *method, char *cgiargs, char **out, size_t *len)
+{
+  char req[sizeof(cgi_frame_t) + 2 * MAXLINE + 32];
+  struct timespec deadline, *dl = cgi_timeout > 0 ? &deadline : NULL;
+  cgi_frame_t f;
+  int n, rc;
+
+  n = sizeof(cgi_frame_t);
+  n += sprintf(req + n, "QUERY_STRING=%s", cgiargs) + 1;
+  n += sprintf(req + n, "REQUEST_METHOD=%s", method) + 1;
+  f.magic = CGI_MAGIC;
+  f.len = n - sizeof(cgi_frame_t);
+  memcpy(req, &f, sizeof(f));
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += cgi_timeout;
+  if (rio_writen(w->fd, req, n) != n)
+    return errno == EAGAIN || errno == EWOULDBLOCK ? -2 : -1;
+
+  if ((rc = read_full(w->fd, &f, sizeof(f), dl)) < 0)
+    return rc;
+  if (f.magic != CGI_MAGIC || f.len > CGI_MAXFRAME)
+    return -1;
+  *out = Malloc(f.len + 1);
+  if ((rc = read_full(w->fd, *out, f.len, dl)) < 0) {
+    Free(*out);
+    return rc;
+  }
+  *len = f.len;
+  return 0;
+}
+
+int cgipool_run(char *filename, char *method, char *cgiargs, char **out, size_t *len)
+{
+  cgi_prog_t *p;
+  cgi_worker_t *w = NULL;
+  int i, rc = -1, tries;
+
+  if (cgi_nworkers <= 0)
+    return 0;
+  pthread_mutex_lock(&cgi_mutex);
+  if (!(p = find_prog(filename))) {
+    pthread_mutex_unlock(&cgi_mutex);
+    return 0;
+  }
+  while (1) {                           // 쉬는 작업 프로세스, 없으면 빈 자리를 잡는다
+    for (i = 0; i < cgi_nworkers && !w; i++)
+      if (!p->w[i].busy && p->w[i].fd >= 0)
+        w = &p->w[i];
+    for (i = 0; i < cgi_nworkers && !w; i++)
+      if (!p->w[i].busy)
+        w = &p->w[i];
+    if (w)
+      break;
+    pthread_cond_wait(&p->idle, &cgi_mutex);
+  }
+  w->busy = 1;
+  pthread_mutex_unlock(&cgi_mutex);
+
+  // 표시한 프로그램이 준비 틀을 보내지 못하면 fork로 다시 실행하지 않고 실패로 알린다
+  for (tries = 0; tries < 2 && rc == -1; tries++) {
+    if (w->fd < 0 && spawn(filename, w) < 0)
+      break;
+    if ((rc = exchange(w, method, cgiargs, out, len)) < 0)
+      kill_worker(w);                   // 제한 시간에 걸렸으면 (-2) 다시 보내지 않는다
+  }
+
+  pthread_mutex_lock(&cgi_mutex);
+  w->busy = 0;
+  pthread_cond_signal(&p->idle);
+  pthread_mutex_unlock(&cgi_mutex);
+  return rc < 0 ? rc : 1;
+}
@@ -0,0 +1,43 @@
+/*
+ * cgipool.h - tiny의 상주 CGI 작업 프로세스 풀
+ *
+ * 동적 요청마다 fork, execve, wait를 하던 대신 CGI 프로그램마다 작업 프로세스를 -c개까지
+ * 띄워 두고 유닉스 소켓으로 요청을 넘긴다. 작업 프로세스는 TINY_CGI_LOOP 환경 변수가 있으면
+ * 표준 입력의 소켓에서 요청 틀을 읽고 같은 소켓에 응답 틀을 쓰는 일을 되풀이한다
+ * (cgi-bin/adder.c 참고).
+ *
+ * 틀은 cgi_frame_t 머리 뒤에 len 바이트가 붙는다.
+ *   요청: "QUERY_STRING=...\0REQUEST_METHOD=...\0"처럼 NUL로 끝나는 환경 변수들
+ *   응답: CGI가 표준 출력에 쓰던 그대로 (헤더, 빈 줄, 본문)
+ * 작업 프로세스는 뜨자마자 len이 0인 틀을 보내 준비됐음을 알린다.
+ *
+ * 루프 모드를 아는 프로그램은 cgi-bin/<프로그램>.pool 파일로 표시한다. 표시가 없는 프로그램은
+ * 예전처럼 요청마다 fork+execve로 실행한다.
+ */
+#ifndef __CGIPOOL_H__
+#define __CGIPOOL_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+#define CGI_MAGIC 0x54434731u   /* "TCG1" */
+#define CGI_MAXFRAME (1 << 20)  /* 응답 틀의 최대 길이 */
+#define CGI_NWORKERS 4          /* 기본 프로그램당 작업 프로세스 수 */
+#define CGI_MAXPROGS 16         /* 풀을 둘 CGI 프로그램 수 (넘으면 fork로 실행) */
+#define CGI_HELLO_TIMEOUT 1     /* 준비 틀을 기다리는 시간(초) */
+
+typedef struct {
+  uint32_t magic;               /* CGI_MAGIC */
+  uint32_t len;                 /* 뒤따르는 바이트 수 */
+} cgi_frame_t;
+
+extern int cgi_nworkers;        /* -c: 프로그램당 작업 프로세스 수 (0이면 요청마다 fork) */
+
+/*
+ * filename을 풀의 작업 프로세스로 실행해 CGI 출력을 *out(Malloc)에, 길이를 *len에 담는다.
+ * 1이면 성공, 0이면 풀로 실행할 수 없어 호출자가 fork로 실행해야 하고, -1이면 작업 프로세스가
+ * 뜨지 못했거나 응답하지 않고 죽었고, -2면 -t초 안에 응답하지 않아 죽였다.
+ */
+int cgipool_run(char *filename, char *method, char *cgiargs, char **out, size_t *len);
+
+#endif /* __CGIPOOL_H__ */
@@ -0,0 +1,213 @@
+/*
+ * cgirelay.c - CGI 출력을 파이프에서 받아 헤더를 붙이고 큰 덩어리로 보낸다
+ *
+ * 버퍼 앞에 CGI_ROOM만큼 비워 두고 출력을 그 뒤에 읽는다. 헤더를 보낼 때는 CGI 헤더를
+ * 본문 쪽으로 붙여 옮기고 그 앞뒤에 상태 줄과 tiny가 더하는 헤더를 채워, 본문을 옮기지
+ * 않고 한 번의 쓰기로 보낸다. 버퍼를 넘는 출력은 poll로 제한 시간을 지키며 파이프에 쌓인
+ * 만큼씩 splice한다.
+ *
+ * splice와 F_SETPIPE_SZ는 glibc에서 _GNU_SOURCE로만 보이는데, 그러면 csapp.h의 gai_error가
+ * glibc의 것과 부딪친다. 그래서 syscall로 부르고 값은 리눅스 ABI의 것을 쓴다.
+ */
+#define _DEFAULT_SOURCE     /* syscall */
+#include "cgirelay.h"
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031   /* F_LINUX_SPECIFIC_BASE + 7 */
+#endif
+
+#define CGI_ROOM 256        /* 상태 줄과 tiny가 더하는 헤더를 채울 자리 */
+#define CGI_STATUS "HTTP/1.1 200 OK\r\nServer: Tiny Web Server\r\n"
+
+int cgi_timeout = CGI_TIMEOUT;
+
+int cgi_pipe(int p[2])
+{
+  if (pipe(p) < 0)
+    return -1;
+  fcntl(p[0], F_SETFD, FD_CLOEXEC);     // 자식에는 p[1]만 dup2로 표준 출력이 되어 넘어간다
+  fcntl(p[1], F_SETFD, FD_CLOEXEC);
+  fcntl(p[0], F_SETPIPE_SZ, CGI_PIPESIZE);      // 안 되면 기본 크기(64KB)로 둔다
+  return 0;
+}
+
+int cgi_wait(int fd, struct timespec *deadline)
+{
+  struct pollfd p = { fd, POLLIN, 0 };
+  struct timespec now;
+  long ms;
+  int rc;
+
+  while (1) {
+    ms = -1;
+    if (deadline) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+      if (ms <= 0)
+        return 0;
+    }
+    if ((rc = poll(&p, 1, ms)) >= 0)
+      return rc;
+    if (errno != EINTR)
+      return 1;                         // 오류는 뒤따르는 읽기가 알려 준다
+  }
+}
+
+ssize_t cgi_header_end(char *buf, size_t len, size_t *hlen)
+{
+  size_t i;
+
+  for (i = 0; i + 1 < len; i++) {
+    if (buf[i] != '\n')
+      continue;
+    *hlen = i + 1;
+    if (buf[i + 1] == '\n')
+      return i + 2;
+    if (buf[i + 1] == '\r' && i + 2 < len && buf[i + 2] == '\n')
+      return i + 3;
+  }
+  return -1;
+}
+
+int cgi_has_header(char *hdrs, size_t len, char *name)
+{
+  size_t n = strlen(name);
+  char *p = hdrs, *end = hdrs + len, *nl;
+
+  while (p < end) {
+    if ((size_t)(end - p) > n && !strncasecmp(p, name, n) && p[n] == ':')
+      return 1;
+    if (!(nl = memchr(p, '\n', end - p)))
+      break;
+    p = nl + 1;
+  }
+  return 0;
+}
+
+/* buf를 다 보낸다. 실패하면 -1 */
+static int send_all(int fd, char *buf, size_t len, int flags)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = send(fd, buf, len, flags)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* 파이프 pfd에 쌓인 n바이트를 fd로 옮긴다. 실패하면 -1 */
+static int move(int pfd, int fd, size_t n)
+{
+  char buf[MAXBUF];
+  ssize_t rc;
+
+  while (n > 0) {
+    if ((rc = syscall(SYS_splice, pfd, NULL, fd, NULL, n, 0)) < 0 && errno == EINVAL) {
+      // fd가 splice를 받지 못하면 (소켓이 아니면) 복사해서 쓴다
+      if ((rc = read(pfd, buf, n < sizeof(buf) ? n : sizeof(buf))) > 0 && rio_writen(fd, buf, rc) != rc)
+        return -1;
+    }
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return -1;
+    n -= rc;
+  }
+  return 0;
+}
+
+int cgi_relay(int fd, int pfd, pid_t pid, int chunked, int head)
+{
+  char *buf, *data, *start, extra[CGI_ROOM], line[32];
+  size_t len = 0, hlen, blen, n;
+  ssize_t rc, body;
+  int eof = 0, avail, inchunk;
+  struct timespec deadline, *dl = cgi_timeout > 0 ? &deadline : NULL;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += cgi_timeout;
+  buf = Malloc(CGI_ROOM + CGI_BUFSIZE);
+  data = buf + CGI_ROOM;
+
+  // 버퍼가 찰 때까지 (작은 출력은 CGI가 끝날 때까지) 모은다
+  while (len < CGI_BUFSIZE && !eof) {
+    if (!cgi_wait(pfd, dl)) {
+      kill(-pid, SIGKILL);
+      Free(buf);
+      return 0;
+    }
+    if ((rc = read(pfd, data + len, CGI_BUFSIZE - len)) < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      eof = 1;
+    else
+      len += rc;
+  }
+  if ((body = cgi_header_end(data, len, &hlen)) < 0) {
+    kill(-pid, SIGKILL);                // 아직 거두지 않았으므로 pid는 이 자식의 것이다
+    Free(buf);
+    return -1;
+  }
+  blen = len - body;
+
+  // CGI가 정하지 않은 길이와 연결 헤더를 채운다
+  n = 0;
+  if (cgi_has_header(data, hlen, "Content-length") || cgi_has_header(data, hlen, "Transfer-Encoding"))
+    chunked = 0;
+  else if (eof) {
+    n += sprintf(extra + n, "Content-length: %zu\r\n", blen);
+    chunked = 0;
+  }
+  chunked = chunked && !head;
+  if (chunked)
+    n += sprintf(extra + n, "Transfer-Encoding: chunked\r\n");
+  if (!cgi_has_header(data, hlen, "Connection"))
+    n += sprintf(extra + n, "Connection: close\r\n");
+  n += sprintf(extra + n, "\r\n");
+  if (chunked && blen > 0)
+    n += sprintf(extra + n, "%zx\r\n", blen);
+
+  // [상태 줄][CGI 헤더][extra]가 본문 바로 앞에서 끝나도록 채운다
+  start = data + body - (strlen(CGI_STATUS) + hlen + n);
+  memmove(start + strlen(CGI_STATUS), data, hlen);
+  memcpy(start, CGI_STATUS, strlen(CGI_STATUS));
+  memcpy(start + strlen(CGI_STATUS) + hlen, extra, n);
+  if (send_all(fd, start, data + body - start + (head ? 0 : blen), eof || head ? 0 : MSG_MORE) < 0 ||
+      eof || head) {
+    Free(buf);
+    return 1;
+  }
+  Free(buf);
+
+  // 나머지는 파이프에 쌓인 만큼씩 소켓으로 옮긴다 (chunked면 덩어리마다 길이를 앞에 붙인다)
+  inchunk = chunked && blen > 0;
+  while (1) {
+    if (!cgi_wait(pfd, dl)) {
+      kill(-pid, SIGKILL);               // 마지막 덩어리를 보내지 않으므로 클라이언트는 잘린 줄 안다
+      return 1;
+    }
+    if (ioctl(pfd, FIONREAD, &avail) < 0 || avail == 0)
+      break;                            // 읽을 수 있는데 쌓인 것이 없으면 CGI가 출력을 닫았다
+    if (chunked) {
+      n = sprintf(line, "%s%x\r\n", inchunk ? "\r\n" : "", avail);
+      if (send_all(fd, line, n, MSG_MORE) < 0)
+        return 1;
+      inchunk = 1;
+    }
+    if (move(pfd, fd, avail) < 0)
+      return 1;
+  }
+  if (chunked)
+    send_all(fd, inchunk ? "\r\n0\r\n\r\n" : "0\r\n\r\n", inchunk ? 7 : 5, 0);
+  return 1;
+}
@@ -0,0 +1,45 @@
+/*
+ * cgirelay.h - 요청마다 띄운 CGI의 출력을 파이프로 받아 클라이언트에 보낸다
+ *
+ * CGI 프로그램의 표준 출력은 클라이언트 소켓이 아니라 cgi_pipe로 만든 파이프로 잇는다.
+ * tiny는 출력을 CGI_BUFSIZE까지 모아 두고,
+ *   - 그 안에 끝나면 상태 줄, CGI 헤더, (없으면) Content-length와 Connection, 본문을
+ *     한 번에 보낸다.
+ *   - 넘치면 헤더와 모은 만큼을 보내고 나머지는 파이프에서 소켓으로 splice한다. CGI가
+ *     Content-length를 주지 않았고 HTTP/1.1 요청이면 chunked로 감싼다.
+ * 상주 작업 프로세스와 처리기 .so의 출력은 다 받은 뒤에 tiny.c가 같은 헤더 함수로 채워 보낸다.
+ * CGI가 -t초 안에 끝나지 않으면 죽인다. 응답을 보내기 전이면 tiny가 504를 보낸다.
+ */
+#ifndef __CGIRELAY_H__
+#define __CGIRELAY_H__
+
+#include "csapp.h"
+
+#define CGI_TIMEOUT 10          /* 기본 CGI 실행 제한 시간(초) */
+#define CGI_BUFSIZE 65536       /* 이 안에 끝난 출력은 Content-length를 붙여 한 번에 보낸다 */
+#define CGI_PIPESIZE (1 << 20)  /* 한 번에 splice할 만큼 파이프를 늘린다 */
+
+extern int cgi_timeout;         /* -t: CGI 실행 제한 시간(초) (0이면 제한하지 않는다) */
+
+/* fd를 읽을 수 있을 때까지 기다린다. deadline(CLOCK_MONOTONIC)이 지났으면 0. NULL이면 끝없이 기다린다 */
+int cgi_wait(int fd, struct timespec *deadline);
+
+/* 헤더와 본문 사이의 빈 줄을 찾아 헤더 길이(마지막 줄바꿈까지)를 *hlen에 담고 본문의 시작을 돌려준다. 없으면 -1 */
+ssize_t cgi_header_end(char *buf, size_t len, size_t *hlen);
+
+/* CGI 헤더 hdrs[0..len)에 name 헤더가 있으면 1 */
+int cgi_has_header(char *hdrs, size_t len, char *name);
+
+/* 읽는 쪽 p[0]와 CGI의 표준 출력이 될 p[1]. 둘 다 close-on-exec이다. 실패하면 -1 */
+int cgi_pipe(int p[2]);
+
+/*
+ * 자식 pid가 쓰는 파이프 pfd의 출력을 fd로 보낸다. pid는 자기 프로세스 그룹의 리더여야 하며
+ * 제한 시간이 지나면 그룹 전체를 죽인다. chunked가 1이면 길이를 모르는 출력을
+ * chunked로 보내고, head가 1이면 헤더만 보낸다. 1이면 응답을 보냈고 (제한 시간에 걸려
+ * 중간에 끊겼을 수 있다), 0이면 아무것도 보내기 전에 제한 시간이 지났고, -1이면 CGI가
+ * 헤더를 내지 않았다. 0과 -1일 때 에러 응답은 호출자가 보낸다. 자식은 거두지 않는다.
+ */
+int cgi_relay(int fd, int pfd, pid_t pid, int chunked, int head);
+
+#endif /* __CGIRELAY_H__ */
@@ -0,0 +1,217 @@
+/*
+ * fcache.c - tiny의 열린 파일과 stat 정보 캐시
+ *
+ * 경로 해시 버킷의 연결 리스트로 찾고, 이중 연결 리스트로 LRU 순서를 관리해 fcache_max개를
+ * 넘으면 가장 오래 안 쓴 항목을 닫는다. 모든 연산은 하나의 뮤텍스 아래에서 하되 stat과
+ * open은 락 밖에서 부른다. 확인할 때가 된 항목은 stat 결과(inode, 크기, 수정 시각)가 그대로면
+ * 확인 시각만 올리고, 달라졌거나 파일이 없어졌으면 캐시에서 떼어 낸다. 이름을 바꿔 치운
+ * 파일도 inode가 달라지므로 새 파일을 연다.
+ *
+ * 항목에는 tiny가 처음 보낼 때 만든 응답 헤더(작은 파일은 본문까지)가 달린다. 항목이
+ * 파일의 한 판에 묶여 있으므로 헤더를 따로 무효로 할 일이 없다. 읽는 쪽은 락 없이 보고,
+ * 다는 쪽은 락 아래에서 먼저 단 것이 이기게 하며 단 크기를 예산에 센다. 헤더는 프록시
+ * 캐시와 같은 슬랩 할당기(../slab.c)에서 잡으므로 -H로 휴즈 페이지에 모인다.
+ */
+#include "fcache.h"
+
+int fcache_max = FCACHE_MAX;
+int fcache_interval = FCACHE_INTERVAL;
+size_t fcache_mem_max = FCACHE_MEM_MAX;
+size_t fcache_mem_file = FCACHE_MEM_FILE;
+
+static fcache_ent_t *buckets[FCACHE_NBUCKETS];
+static fcache_ent_t *lru_head, *lru_tail;
+static int nents;
+static size_t nbytes;                   /* 캐시에 든 항목에 단 헤더 크기의 합 */
+static pthread_mutex_t fcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned hash(char *s)
+{
+  unsigned h = 2166136261u;             // FNV-1a
+
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h & (FCACHE_NBUCKETS - 1);
+}
+
+static fcache_ent_t *find(char *path)
+{
+  fcache_ent_t *e;
+
+  for (e = buckets[hash(path)]; e; e = e->hnext)
+    if (!strcmp(e->path, path))
+      return e;
+  return NULL;
+}
+
+static void lru_unlink(fcache_ent_t *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    lru_head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    lru_tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void lru_push(fcache_ent_t *e)
+{
+  e->prev = NULL;
+  e->next = lru_head;
+  if (lru_head)
+    lru_head->prev = e;
+  lru_head = e;
+  if (!lru_tail)
+    lru_tail = e;
+}
+
+static void free_ent(fcache_ent_t *e)
+{
+  if (e->fd >= 0)
+    Close(e->fd);
+  if (e->hdr)
+    slab_free(e->hdr, e->hdrcap);
+  Free(e->path);
+  Free(e);
+}
+
+/* 캐시에서 떼어 낸다. 쓰는 요청이 없으면 바로 닫고, 있으면 마지막 fcache_put이 닫는다 */
+static void remove_ent(fcache_ent_t *e)
+{
+  fcache_ent_t **pp;
+
+  for (pp = &buckets[hash(e->path)]; *pp != e; pp = &(*pp)->hnext)
+    ;
+  *pp = e->hnext;
+  lru_unlink(e);
+  e->cached = 0;
+  nents--;
+  if (e->hdr)
+    nbytes -= e->hdrcap;
+  if (!e->refcnt)
+    free_ent(e);
+}
+
+/* 파일이 바뀌지 않았으면 1 */
+static int same_file(struct stat *a, struct stat *b)
+{
+  return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+    a->st_mtime == b->st_mtime && a->st_mode == b->st_mode;
+}
+
+fcache_ent_t *fcache_get(char *path)
+{
+  fcache_ent_t *e, *old;
+  struct stat st;
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&fcache_mutex);
+  if ((e = find(path))) {
+    e->refcnt++;
+    lru_unlink(e);
+    lru_push(e);
+    if (now - e->checked < fcache_interval) {
+      pthread_mutex_unlock(&fcache_mutex);
+      return e;
+    }
+  }
+  pthread_mutex_unlock(&fcache_mutex);
+
+  // 처음 보거나 확인할 때가 된 경로: 락 밖에서 stat
+  if (stat(path, &st) < 0) {
+    if (e) {
+      pthread_mutex_lock(&fcache_mutex);
+      if (e->cached)
+        remove_ent(e);
+      pthread_mutex_unlock(&fcache_mutex);
+      fcache_put(e);
+    }
+    return NULL;
+  }
+  if (e) {
+    pthread_mutex_lock(&fcache_mutex);
+    if (same_file(&e->st, &st)) {
+      e->checked = now;
+      pthread_mutex_unlock(&fcache_mutex);
+      return e;
+    }
+    if (e->cached)
+      remove_ent(e);
+    pthread_mutex_unlock(&fcache_mutex);
+    fcache_put(e);
+  }
+
+  e = Malloc(sizeof(fcache_ent_t));
+  e->path = Malloc(strlen(path) + 1);
+  strcpy(e->path, path);
+  e->st = st;
+  e->fd = S_ISREG(st.st_mode) ? open(path, O_RDONLY | O_CLOEXEC) : -1;  // CGI 자식에 새지 않게
+  e->checked = now;
+  e->refcnt = 1;
+  e->cached = 0;
+  e->hdr = NULL;
+  e->hdrcap = 0;
+  e->prev = e->next = NULL;
+  if (fcache_max <= 0)
+    return e;
+
+  pthread_mutex_lock(&fcache_mutex);
+  if ((old = find(path)))               // 그사이 다른 쓰레드가 넣었으면 새것으로 바꾼다
+    remove_ent(old);
+  e->hnext = buckets[hash(path)];
+  buckets[hash(path)] = e;
+  lru_push(e);
+  e->cached = 1;
+  nents++;
+  while (nents > fcache_max)
+    remove_ent(lru_tail);
+  pthread_mutex_unlock(&fcache_mutex);
+  return e;
+}
+
+void fcache_put(fcache_ent_t *e)
+{
+  int last;
+
+  pthread_mutex_lock(&fcache_mutex);
+  last = (--e->refcnt == 0 && !e->cached);
+  pthread_mutex_unlock(&fcache_mutex);
+  if (last)
+    free_ent(e);
+}
+
+void *fcache_hdr(fcache_ent_t *e)
+{
+  return __atomic_load_n(&e->hdr, __ATOMIC_ACQUIRE);
+}
+
+void *fcache_alloc(size_t size, size_t *cap)
+{
+  return slab_alloc(size, cap, 0);
+}
+
+void *fcache_set_hdr(fcache_ent_t *e, void *hdr, size_t cap)
+{
+  void *old;
+
+  pthread_mutex_lock(&fcache_mutex);
+  if ((old = e->hdr)) {
+    pthread_mutex_unlock(&fcache_mutex);
+    slab_free(hdr, cap);
+    return old;
+  }
+  e->hdrcap = cap;
+  __atomic_store_n(&e->hdr, hdr, __ATOMIC_RELEASE);   // 락 없이 읽는 fcache_hdr에 다 만든 뒤 보인다
+  if (e->cached) {
+    nbytes += cap;
+    while (nbytes > fcache_mem_max && lru_tail != e)
+      remove_ent(lru_tail);
+  }
+  pthread_mutex_unlock(&fcache_mutex);
+  return hdr;
+}
@@ -0,0 +1,69 @@
+/*
+ * fcache.h - tiny의 열린 파일과 stat 정보 캐시
+ *
+ * 정적 요청마다 stat, open, close를 부르고 경로를 따라가던 일을 없앤다. 경로를 키로
+ * 파일을 열어 둔 채 stat 결과와 함께 보관하고, -v초마다 한 번 stat으로 파일이 바뀌지
+ * 않았는지 확인한다. 바뀌었으면 다시 연다.
+ *
+ * 작은 파일은 항목에 단 응답 헤더 바로 뒤에 본문까지 올려 두어, 확인 간격 안의 요청은
+ * 파일 시스템을 건드리지 않고 send 한 번으로 끝난다. 헤더와 본문은 -m 바이트 예산 안에서
+ * 항목과 함께 LRU로 밀려난다.
+ */
+#ifndef __FCACHE_H__
+#define __FCACHE_H__
+
+#include "csapp.h"
+#include "slab.h"
+
+#define FCACHE_MAX 256          /* 기본으로 열어 둘 파일 수 */
+#define FCACHE_INTERVAL 1       /* 기본 재확인 간격(초) */
+#define FCACHE_NBUCKETS 1024    /* 해시 버킷 수 (2의 거듭제곱) */
+#define FCACHE_MEM_MAX (16 * 1024 * 1024) /* 기본 헤더와 본문 메모리 예산 */
+#define FCACHE_MEM_FILE (64 * 1024)       /* 기본으로 본문을 메모리에 올릴 최대 파일 크기 */
+
+/*
+ * 캐시 항목. 요청은 fcache_get으로 참조를 잡고 다 보낸 뒤 fcache_put으로 돌려준다.
+ * 그동안 캐시에서 밀려나도 마지막 참조가 돌아올 때까지 fd는 닫히지 않는다.
+ * 여러 쓰레드가 같은 fd를 쓰므로 읽을 때는 오프셋을 직접 주는 sendfile/pread만 쓴다.
+ */
+typedef struct fcache_ent {
+  char *path;
+  int fd;                       /* 읽기 전용으로 연 fd (일반 파일이 아니거나 못 열었으면 -1) */
+  struct stat st;
+  time_t checked;               /* 마지막으로 stat으로 확인한 시각 */
+  int refcnt;                   /* 이 항목을 쓰고 있는 요청 수 */
+  int cached;                   /* 아직 캐시에 들어 있으면 1 */
+  void *hdr;                    /* 호출자가 이 판의 파일로 만들어 단 응답 헤더 (없으면 NULL) */
+  size_t hdrcap;                /* hdr 조각의 크기 (예산에 세는 값) */
+  struct fcache_ent *hnext;     /* 같은 버킷의 다음 항목 */
+  struct fcache_ent *prev, *next; /* LRU 목록 (앞이 최근) */
+} fcache_ent_t;
+
+extern int fcache_max;          /* -f: 열어 둘 파일 수 (0이면 요청마다 열고 닫는다) */
+extern int fcache_interval;     /* -v: 이 초가 지난 항목은 쓰기 전에 stat으로 확인한다 */
+extern size_t fcache_mem_max;   /* -m: 캐시에 든 항목에 단 헤더와 본문의 메모리 예산 (바이트) */
+extern size_t fcache_mem_file;  /* -s: 이 크기 이하의 파일은 본문도 메모리에 올린다 (0이면 안 올린다) */
+
+/* path의 항목을 참조를 잡아 돌려준다. stat이 실패하면 NULL (errno는 stat의 것) */
+fcache_ent_t *fcache_get(char *path);
+
+/* fcache_get으로 잡은 참조를 돌려준다 */
+void fcache_put(fcache_ent_t *e);
+
+/*
+ * 항목에 달린 응답 헤더를 돌려준다(없으면 NULL). 헤더는 파일이 바뀌면 항목과 함께
+ * 버려지므로 경로, inode, 크기, 수정 시각이 같은 동안만 쓰인다.
+ */
+void *fcache_hdr(fcache_ent_t *e);
+
+/* 항목에 달 헤더를 위해 size 바이트 이상을 잡고 실제 크기를 *cap에 담는다 */
+void *fcache_alloc(size_t size, size_t *cap);
+
+/*
+ * fcache_alloc으로 잡은 hdr을 항목에 단다. 다른 쓰레드가 먼저 달았으면 hdr을 풀고 그것을
+ * 돌려준다. 단 헤더는 예산에 세고 항목을 해제할 때 함께 푼다. 예산을 넘으면 e가 아닌
+ * 가장 오래 안 쓴 항목부터 내보낸다.
+ */
+void *fcache_set_hdr(fcache_ent_t *e, void *hdr, size_t cap);
+
+#endif /* __FCACHE_H__ */
@@ -0,0 +1,149 @@
+/*
+ * idle.c - 유휴 keep-alive 연결을 epoll로 지켜보고 오래 조용하면 닫는다
+ *
+ * 맡긴 연결은 EPOLLONESHOT으로 epoll에 올려, 요청이 오면 한 번만 알린 뒤 작업 쓰레드가
+ * 처리하는 동안에는 꺼져 있게 한다. 작업 쓰레드가 epoll_ctl로 바로 올리므로 메인 쓰레드를
+ * 깨울 필요가 없다. 다만 유휴 목록이 비어 있다 처음 채워지면 메인 쓰레드가 poll의 제한
+ * 시간을 다시 셈하도록 파이프에 한 바이트를 쓴다 (epoll에 함께 올려 둔다).
+ *
+ * 제한 시간은 모두 같으므로 맡긴 순서로 이은 목록의 앞에서부터 닫으면 된다. 목록은 뮤텍스
+ * 하나로 보호하고, 연결을 닫거나 ready를 부르는 일은 락 밖에서 한다.
+ */
+#include "idle.h"
+#include <time.h>
+#include <sys/epoll.h>
+
+#define IDLE_BATCH 64           /* epoll_wait 한 번에 꺼낼 연결 수 */
+
+static int idle_secs;
+static int epfd = -1;
+static int wakefd[2] = { -1, -1 };      /* 유휴 목록이 처음 채워졌다고 메인 쓰레드를 깨운다 */
+static conn_t *head, *tail;             /* 유휴 목록 (앞이 먼저 닫힌다) */
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void idle_init(int secs)
+{
+  struct epoll_event ev = { EPOLLIN, { NULL } };   // data.ptr이 NULL이면 깨우는 파이프
+  int i;
+
+  idle_secs = secs;
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return;                             // 맡길 수 없으니 유지할 연결도 닫는다
+  if (pipe(wakefd) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd[0], &ev) < 0) {
+    close(epfd);
+    epfd = -1;
+    return;
+  }
+  for (i = 0; i < 2; i++) {
+    fcntl(wakefd[i], F_SETFD, FD_CLOEXEC);
+    fcntl(wakefd[i], F_SETFL, O_NONBLOCK);
+  }
+}
+
+int idle_fd(void)
+{
+  return epfd;
+}
+
+/* 유휴 목록에서 c를 뺀다. idle_mutex를 쥐고 부른다 */
+static void unlink_conn(conn_t *c)
+{
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    head = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  else
+    tail = c->prev;
+  c->prev = c->next = NULL;
+}
+
+int idle_timeout(void)
+{
+  struct timespec now;
+  long ms = -1;
+
+  pthread_mutex_lock(&idle_mutex);
+  if (head) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (head->deadline.tv_sec - now.tv_sec) * 1000 + (head->deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+    if (ms < 0)
+      ms = 0;
+  }
+  pthread_mutex_unlock(&idle_mutex);
+  return ms;
+}
+
+int idle_park(conn_t *c)
+{
+  struct epoll_event ev;
+  int first;
+
+  if (epfd < 0)
+    return -1;
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  ev.data.ptr = c;
+  clock_gettime(CLOCK_MONOTONIC, &c->deadline);
+  c->deadline.tv_sec += idle_secs;
+
+  // 목록에 넣기 전에 요청이 와도 메인 쓰레드는 이 락을 기다렸다 c를 뺀다
+  pthread_mutex_lock(&idle_mutex);
+  if (epoll_ctl(epfd, c->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+    pthread_mutex_unlock(&idle_mutex);
+    return -1;
+  }
+  c->armed = 1;
+  first = !head;
+  c->prev = tail;
+  c->next = NULL;
+  if (tail)
+    tail->next = c;
+  else
+    head = c;
+  tail = c;
+  pthread_mutex_unlock(&idle_mutex);
+  if (first && write(wakefd[1], "", 1) < 0)
+    ;                                   // EAGAIN이면 메인 쓰레드가 곧 깰 참이다
+  return 0;
+}
+
+void idle_check(void (*ready)(conn_t *c))
+{
+  struct epoll_event ev[IDLE_BATCH];
+  struct timespec now;
+  conn_t *c, *expired = NULL;
+  char buf[64];
+  int i, n;
+
+  if (epfd < 0)
+    return;
+  n = epoll_wait(epfd, ev, IDLE_BATCH, 0);    // 다 꺼내지 못한 것은 다음 poll이 바로 알린다
+  for (i = 0; i < n; i++) {
+    if (!(c = ev[i].data.ptr)) {
+      while (read(wakefd[0], buf, sizeof(buf)) > 0)
+        ;
+      continue;
+    }
+    pthread_mutex_lock(&idle_mutex);
+    unlink_conn(c);
+    pthread_mutex_unlock(&idle_mutex);
+    ready(c);                           // EPOLLONESHOT이라 다시 맡길 때까지 알리지 않는다
+  }
+
+  // 닫는 fd는 epoll에서도 저절로 빠진다
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock(&idle_mutex);
+  while ((c = head) && (c->deadline.tv_sec < now.tv_sec ||
+                        (c->deadline.tv_sec == now.tv_sec && c->deadline.tv_nsec <= now.tv_nsec))) {
+    unlink_conn(c);
+    c->next = expired;
+    expired = c;
+  }
+  pthread_mutex_unlock(&idle_mutex);
+  while ((c = expired)) {
+    expired = c->next;
+    Close(c->fd);
+    Free(c);
+  }
+}
@@ -0,0 +1,38 @@
+/*
+ * idle.h - 다음 요청을 기다리는 keep-alive 연결을 메인 쓰레드가 지켜본다
+ *
+ * 작업 쓰레드는 응답을 보낸 뒤 rio 버퍼에 파이프라인으로 온 요청이 없으면 연결을 붙잡고
+ * 기다리지 않고 idle_park로 맡긴 뒤 대기열의 다음 연결로 간다. 메인 쓰레드는 reaper_wait에서
+ * 듣기 소켓과 함께 idle_fd를 poll하다가 idle_check로 요청이 온 연결을 다시 대기열에 넣고,
+ * -k초 동안 조용한 연결은 닫는다. 유휴 연결이 아무리 많아도 작업 쓰레드를 쥐지 않는다.
+ */
+#ifndef __IDLE_H__
+#define __IDLE_H__
+
+#include "csapp.h"
+
+/* 한 클라이언트 연결. 작업 쓰레드가 처리하는 동안이나 유휴 목록에 있는 동안 한쪽만 쥔다 */
+typedef struct conn {
+  int fd;
+  int nreqs;                    /* 이 연결에서 처리한 요청 수 */
+  int armed;                    /* epoll에 한 번 올렸으면 1 (다음부터는 다시 켜기만 한다) */
+  struct timespec deadline;     /* 유휴 목록에 있는 동안 이때까지 요청이 없으면 닫는다 */
+  struct conn *prev, *next;     /* 유휴 목록 (맡긴 순서 = 닫을 순서) */
+} conn_t;
+
+/* secs초 동안 조용한 연결을 닫는다 */
+void idle_init(int secs);
+
+/* 메인 쓰레드가 poll할 식별자. 유휴 연결에 요청이 오거나 첫 연결을 맡기면 읽을 수 있게 된다 */
+int idle_fd(void);
+
+/* 다음 유휴 연결을 닫을 때까지의 시간(밀리초). 유휴 연결이 없으면 -1 */
+int idle_timeout(void);
+
+/* 작업 쓰레드가 c를 맡긴다. 맡길 수 없으면 -1 (c는 호출자가 닫는다) */
+int idle_park(conn_t *c);
+
+/* 요청이 온 연결마다 ready를 부르고 제한 시간이 지난 연결은 닫는다. 메인 쓰레드에서만 부른다 */
+void idle_check(void (*ready)(conn_t *c));
+
+#endif /* __IDLE_H__ */
@@ -0,0 +1,107 @@
+/*
+ * plugin.c - cgi-bin의 공유 객체 처리기를 tiny 안에서 부른다
+ *
+ * 경로마다 처음 한 번 filename.so를 dlopen해 tiny_handle을 찾고, 찾은 결과를 (없다는 것까지)
+ * 표에 남긴다. 두 번째 요청부터는 파일 시스템을 보지 않으므로 새로 만들거나 바꾼 .so는
+ * tiny를 다시 띄워야 읽힌다. 한 번 연 .so는 닫지 않는다.
+ *
+ * 처리기의 출력은 메모리에 모아 두었다가 상태 줄과 함께 한 번에 보낸다.
+ */
+#include "csapp.h"
+#include "plugin.h"
+#include <dlfcn.h>
+
+typedef struct {
+  char path[MAXLINE];
+  tiny_handler_fn fn;           /* 없으면 NULL */
+} plugin_t;
+
+/* 처리기에 넘기는 tiny_writer_t. w가 맨 앞이라 처리기가 받은 포인터로 되돌아올 수 있다 */
+typedef struct {
+  tiny_writer_t w;
+  char *buf;
+  size_t len, cap;
+} membuf_t;
+
+int plugin_enabled = 1;
+
+static plugin_t plugins[PLUGIN_MAX];
+static int nplugins;
+static pthread_mutex_t plugin_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* filename.so를 열어 처리기를 찾는다 */
+static tiny_handler_fn load(char *filename)
+{
+  char so[MAXLINE];
+  void *h;
+  int *abi;
+  tiny_handler_fn fn;
+
+  if (snprintf(so, sizeof(so), "%s.so", filename) >= (int)sizeof(so) || access(so, R_OK) < 0)
+    return NULL;
+  if (!(h = dlopen(so, RTLD_NOW | RTLD_LOCAL))) {
+    fprintf(stderr, "tiny: %s\n", dlerror());
+    return NULL;
+  }
+  abi = dlsym(h, "tiny_plugin_abi");
+  fn = (tiny_handler_fn)dlsym(h, "tiny_handle");
+  if (!abi || *abi != TINY_PLUGIN_ABI || !fn) {
+    fprintf(stderr, "tiny: %s is not a tiny plugin (ABI %d)\n", so, TINY_PLUGIN_ABI);
+    dlclose(h);
+    return NULL;
+  }
+  return fn;
+}
+
+tiny_handler_fn plugin_find(char *filename)
+{
+  tiny_handler_fn fn;
+  int i;
+
+  if (!plugin_enabled)
+    return NULL;
+  pthread_mutex_lock(&plugin_mutex);
+  for (i = 0; i < nplugins; i++)
+    if (!strcmp(plugins[i].path, filename)) {
+      fn = plugins[i].fn;
+      pthread_mutex_unlock(&plugin_mutex);
+      return fn;
+    }
+  fn = load(filename);                  // 처음 보는 경로만 락을 쥔 채 연다 (경로마다 한 번뿐이다)
+  if (nplugins < PLUGIN_MAX && strlen(filename) < MAXLINE) {
+    strcpy(plugins[nplugins].path, filename);
+    plugins[nplugins++].fn = fn;
+  }
+  pthread_mutex_unlock(&plugin_mutex);
+  return fn;
+}
+
+static int membuf_write(tiny_writer_t *w, const void *buf, size_t len)
+{
+  membuf_t *m = (membuf_t *)w;
+
+  if (m->len + len > m->cap) {
+    while (m->len + len > m->cap)
+      m->cap *= 2;
+    m->buf = Realloc(m->buf, m->cap);
+  }
+  memcpy(m->buf + m->len, buf, len);
+  m->len += len;
+  return 0;
+}
+
+int plugin_run(tiny_handler_fn fn, char *filename, char *method, char *cgiargs, char **out,
+               size_t *len)
+{
+  tiny_req_t req = { method, cgiargs, filename };
+  membuf_t m = { { membuf_write }, NULL, 0, MAXLINE };
+
+  m.buf = Malloc(m.cap);
+  if (fn(&req, &m.w)) {
+    Free(m.buf);
+    return -1;
+  }
+  *out = m.buf;
+  *len = m.len;
+  return 1;
+}
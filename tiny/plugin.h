@@ -0,0 +1,48 @@
+/*
+ * plugin.h - tiny가 프로세스 없이 부르는 cgi-bin 처리기의 C ABI
+ *
+ * /cgi-bin/<name> 요청에 cgi-bin/<name>.so가 있으면 tiny는 그것을 dlopen해 tiny_handle을
+ * 부른다. 처리기는 CGI 프로그램이 표준 출력에 쓰던 것(헤더, 빈 줄, 본문)을 w로 쓰고 0을
+ * 돌려준다. 0이 아니면 tiny가 500을 보낸다. 처리기는 tiny의 작업 쓰레드들에서 동시에
+ * 불리므로 전역 상태나 getenv/setenv 없이 req만 보고 응답을 만들어야 한다.
+ *
+ * 처리기는 tiny_plugin_abi를 TINY_PLUGIN_ABI로 내보낸다. 없거나 값이 다르면 쓰지 않고
+ * 예전처럼 실행 파일을 CGI로 돌린다.
+ */
+#ifndef __PLUGIN_H__
+#define __PLUGIN_H__
+
+#include <stddef.h>
+
+#define TINY_PLUGIN_ABI 1
+#define PLUGIN_MAX 64           /* 찾아 본 결과를 기억할 cgi-bin 경로 수 */
+
+/* 요청 (처리기가 돌아올 때까지만 유효하다) */
+typedef struct {
+  const char *method;           /* REQUEST_METHOD */
+  const char *query;            /* QUERY_STRING ('?' 뒤, 없으면 "") */
+  const char *path;             /* 처리기 이름까지의 경로 (./cgi-bin/adder) */
+} tiny_req_t;
+
+/* 응답을 받는 쪽. write는 len 바이트를 덧붙이고 실패하면 -1 */
+typedef struct tiny_writer {
+  int (*write)(struct tiny_writer *w, const void *buf, size_t len);
+} tiny_writer_t;
+
+typedef int (*tiny_handler_fn)(const tiny_req_t *req, tiny_writer_t *w);
+
+/* 이 아래는 tiny 쪽 (plugin.c) */
+
+extern int plugin_enabled;      /* -P로 끄면 .so를 찾지 않는다 */
+
+/* filename.so의 처리기. 없거나 쓸 수 없으면 NULL */
+tiny_handler_fn plugin_find(char *filename);
+
+/*
+ * 처리기를 불러 출력을 *out(Malloc)에, 길이를 *len에 담는다. 1이면 성공, 처리기가 실패를
+ * 돌려주었으면 -1.
+ */
+int plugin_run(tiny_handler_fn fn, char *filename, char *method, char *cgiargs, char **out,
+               size_t *len);
+
+#endif /* __PLUGIN_H__ */
@@ -0,0 +1,121 @@
+/*
+ * reaper.c - CGI 자식을 pidfd로 기다렸다 거둔다
+ *
+ * 맡은 자식은 (pid, pidfd) 표에 두고, 작업 쓰레드가 새로 맡기면 파이프에 한 바이트를 써서
+ * poll 중인 메인 쓰레드를 깨운다. 자식이 끝나면 pidfd가 읽을 수 있게 되므로 그 pid만
+ * waitpid로 거둔다. pidfd_open은 이미 끝났지만 아직 거두지 않은 자식에도 되므로 맡기기 전에
+ * 끝난 자식도 놓치지 않는다.
+ */
+#define _DEFAULT_SOURCE     /* syscall */
+#include "reaper.h"
+#include <sys/syscall.h>
+
+typedef struct {
+  pid_t pid;
+  int pidfd;
+} child_t;
+
+static child_t children[REAPER_MAX];
+static int nchildren;
+static pthread_mutex_t reaper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int wakefd[2] = { -1, -1 };      /* 새로 맡긴 자식이 있다고 메인 쓰레드를 깨운다 */
+
+static int pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);       // pidfd는 늘 close-on-exec이다
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+void reaper_init(void)
+{
+  int i;
+
+  if (pipe(wakefd) < 0) {
+    wakefd[0] = wakefd[1] = -1;         // 맡길 수 없으니 띄운 쓰레드가 기다린다
+    return;
+  }
+  for (i = 0; i < 2; i++) {
+    fcntl(wakefd[i], F_SETFD, FD_CLOEXEC);
+    fcntl(wakefd[i], F_SETFL, O_NONBLOCK);      // 이미 깨울 바이트가 가득하면 더 쓰지 않아도 된다
+  }
+}
+
+int reaper_add(pid_t pid)
+{
+  int pidfd;
+
+  if (wakefd[1] < 0 || (pidfd = pidfd_open(pid)) < 0)
+    return -1;
+  pthread_mutex_lock(&reaper_mutex);
+  if (nchildren == REAPER_MAX) {
+    pthread_mutex_unlock(&reaper_mutex);
+    close(pidfd);
+    return -1;
+  }
+  children[nchildren].pid = pid;
+  children[nchildren++].pidfd = pidfd;
+  pthread_mutex_unlock(&reaper_mutex);
+  if (write(wakefd[1], "", 1) < 0)
+    ;                                   // EAGAIN이면 메인 쓰레드가 곧 깰 참이다
+  return 0;
+}
+
+/* pidfd가 읽을 수 있게 된 자식을 거두고 표에서 뺀다 */
+static void reap(int pidfd)
+{
+  pid_t pid = -1;
+  int i;
+
+  pthread_mutex_lock(&reaper_mutex);
+  for (i = 0; i < nchildren; i++)
+    if (children[i].pidfd == pidfd) {
+      pid = children[i].pid;
+      children[i] = children[--nchildren];
+      break;
+    }
+  pthread_mutex_unlock(&reaper_mutex);
+  if (pid < 0)
+    return;
+  waitpid(pid, NULL, 0);                // 이미 끝났으므로 막히지 않는다
+  close(pidfd);
+}
+
+int reaper_wait(struct pollfd *fds, int nfds, int timeout)
+{
+  struct pollfd pfd[REAPER_MAX + REAPER_MAXFDS + 1];
+  char buf[64];
+  int i, n, ready;
+
+  while (1) {
+    memcpy(pfd, fds, nfds * sizeof(struct pollfd));
+    pfd[nfds].fd = wakefd[0];           // -1이면 poll이 무시한다
+    pfd[nfds].events = POLLIN;
+    pthread_mutex_lock(&reaper_mutex);
+    for (n = 0; n < nchildren; n++) {
+      pfd[nfds + 1 + n].fd = children[n].pidfd;
+      pfd[nfds + 1 + n].events = POLLIN;
+    }
+    pthread_mutex_unlock(&reaper_mutex);
+
+    if (poll(pfd, nfds + 1 + n, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      unix_error("poll error");
+    }
+    for (i = nfds + 1; i < nfds + 1 + n; i++)
+      if (pfd[i].revents)
+        reap(pfd[i].fd);
+    if (pfd[nfds].revents)
+      while (read(wakefd[0], buf, sizeof(buf)) > 0)
+        ;
+    for (i = ready = 0; i < nfds; i++)
+      if ((fds[i].revents = pfd[i].revents))
+        ready++;
+    if (ready || timeout >= 0)          // 제한 시간이 있으면 자식만 거두고도 돌아가 호출자가 다시 셈한다
+      return ready;
+  }
+}
@@ -0,0 +1,34 @@
+/*
+ * reaper.h - 요청마다 띄운 CGI 자식을 메인 쓰레드의 accept 루프에서 거둔다
+ *
+ * 작업 쓰레드는 CGI 프로그램을 띄워 그 출력을 파이프로 받아 클라이언트에 보낸다(cgirelay.c).
+ * 출력이 닫히거나 제한 시간에 자식을 죽이면, 자식이 실제로 끝나기를 기다리지 않고
+ * reaper_add로 넘긴 뒤 연결의 다음 요청으로 간다.
+ * 메인 쓰레드는 reaper_wait에서 듣기 소켓, 유휴 연결(idle.c)과 자식들의 pidfd를 함께
+ * poll하다가, 끝난 자식을 거두고 새 연결이나 유휴 연결의 요청이 오면 돌아온다.
+ *
+ * 자식의 pid로만 거두므로 (waitpid(-1) 없이) cgipool이 자기 작업 프로세스를 거두는 것과
+ * 부딪치지 않는다.
+ */
+#ifndef __REAPER_H__
+#define __REAPER_H__
+
+#include "csapp.h"
+#include <poll.h>
+
+#define REAPER_MAX 64           /* 한꺼번에 맡아 둘 자식 수 (넘으면 띄운 쓰레드가 기다린다) */
+#define REAPER_MAXFDS 4         /* reaper_wait에 함께 넘길 수 있는 식별자 수 */
+
+void reaper_init(void);
+
+/* pid를 메인 쓰레드가 거두도록 맡긴다. 맡길 수 없으면 (pidfd가 없거나 표가 찼으면) -1 */
+int reaper_add(pid_t pid);
+
+/*
+ * fds[0..nfds) 중 하나에 일이 생길 때까지 (timeout 밀리초, -1이면 끝없이) 기다리며 그동안
+ * 끝난 자식을 거둔다. fds의 revents를 채우고 일이 생긴 식별자 수를 돌려준다. timeout이
+ * 있으면 자식을 거두느라 0으로 일찍 돌아올 수 있다.
+ */
+int reaper_wait(struct pollfd *fds, int nfds, int timeout);
+
+#endif /* __REAPER_H__ */
@@ -1,34 +1,140 @@
 /* $begin tinymain */
 /*
- * tiny.c - A simple, iterative HTTP/1.0 Web server that uses the
+ * tiny.c - A simple HTTP/1.1 Web server that uses the
  *     GET method to serve static and dynamic content.
  *
+ *     메인 쓰레드는 연결을 받아 대기열에 넣기만 하고, 미리 띄워 둔 작업 쓰레드들(-w)이
+ *     꺼내 처리한다. 느린 클라이언트나 CGI 하나가 다른 연결을 막지 않는다.
+ *     -w 0이면 예전처럼 메인 쓰레드가 한 번에 한 연결씩 처리한다.
+ *
+ *     HTTP/1.1 요청(과 Connection: keep-alive를 보낸 HTTP/1.0 요청)에는 응답 뒤에도
+ *     연결을 유지해, 같은 rio 버퍼로 다음 요청을 읽는다. 파이프라인으로 미리 와 있는
+ *     요청은 버퍼에서 바로 꺼내므로 read를 더 부르지 않는다. 다음 요청이 TINY_LINGER_MS
+ *     안에 오지 않으면 작업 쓰레드는 연결을 메인 쓰레드에 맡기고 (idle.c) 다른 연결로
+ *     가며, 요청이 오면 메인 쓰레드가 다시 대기열에 넣는다. 유휴 연결이 작업 쓰레드를
+ *     쥐지 않으므로 -w보다 많아도 정적 파일 요청이 밀리지 않는다. 연결은 -k초 동안 다음
+ *     요청이 없거나 -r번째 요청을 처리하면 닫는다.
+ *
+ *     요청마다 실행하는 CGI는 posix_spawn으로 띄우고 표준 출력을 파이프로 받아 헤더를
+ *     붙여 보낸다 (cgirelay.c). 출력이 끝나면 자식을 기다리지 않고, 끝난 자식은 메인
+ *     쓰레드가 accept를 기다리는 동안 pidfd로 알아채 거둔다 (reaper.c).
+ *
  * Updated 11/2019 droh
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
  */
+#define _XOPEN_SOURCE 700   /* strptime */
+#define _DEFAULT_SOURCE     /* timegm, syscall */
 #include "csapp.h"
-
-/* 한개의 http 트랜잭션을 처리 */
-void doit(int fd);
-
-/* 요청 헤더를 내의 정보를 읽고 무시하는 함수 */
-void read_requesthdrs(rio_t *rp);
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <spawn.h>
+#include "fcache.h"
+#include "cgipool.h"
+#include "plugin.h"
+#include "reaper.h"
+#include "idle.h"
+#include "cgirelay.h"
+
+#define TINY_NWORKERS 8     /* 기본 작업 쓰레드 수 */
+#define TINY_QSIZE 64       /* 받아 두고 아직 처리하지 않은 연결의 최대 수 */
+#define TINY_KEEPALIVE 5    /* 기본 유휴 연결 유지 시간(초) */
+#define TINY_MAXREQS 100    /* 기본 연결당 최대 요청 수 */
+#define TINY_LINGER_MS 1    /* 유휴 연결을 맡기기 전에 다음 요청을 기다려 보는 시간(밀리초) */
+
+#define CONN_KEEP "Connection: keep-alive\r\n"
+#define CONN_CLOSE "Connection: close\r\n"
+
+/* 요청 헤더 중 tiny가 사용하는 값들 */
+typedef struct {
+  char ims[MAXLINE];   /* If-Modified-Since */
+  char inm[MAXLINE];   /* If-None-Match */
+  char range[MAXLINE]; /* Range */
+  char ifrange[MAXLINE]; /* If-Range */
+  char conn[MAXLINE];  /* Connection */
+  int keepalive;       /* 응답 뒤에도 연결을 유지하면 1 */
+} reqhdrs_t;
+
+/* 정적 파일마다 한 번 만들어 fcache 항목에 달아 두는 검증자와 200 응답 (작은 파일은 본문까지) */
+typedef struct {
+  char lastmod[64];    /* Last-Modified */
+  char etag[64];       /* ETag */
+  char filetype[32];   /* Content-type */
+  size_t len;          /* data에 든 200 응답 헤더의 길이 (Connection과 끝의 빈 줄은 빼고) */
+  int inmem;           /* 헤더 바로 뒤에 본문 전체가 들어 있으면 1 */
+  char data[];
+} static_hdr_t;
+
+/* 한 연결에서 요청이 이어지는 동안 트랜잭션을 처리. 연결을 유지한 채 다음 요청을 기다려야 하면 1 */
+int serve_conn(conn_t *c);
+
+/* 연결을 처리하고, 다음 요청을 기다릴 연결은 메인 쓰레드에 맡기고 나머지는 닫는다 */
+void handle_conn(conn_t *c);
+
+/* 새 연결이나 요청이 온 유휴 연결을 작업 쓰레드에 넘긴다 (-w 0이면 메인 쓰레드가 바로 처리한다) */
+void dispatch(conn_t *c);
+
+/* 한개의 http 트랜잭션을 처리. reuse가 0이 아니고 연결을 유지할 요청이면 1 */
+int doit(int fd, rio_t *rp, int reuse);
+
+/* 쉼표로 나열된 헤더 값 list에 tok이 있는지 보는 함수 */
+int has_token(char *list, char *tok);
+
+/* 요청 헤더를 읽고 조건부 요청 헤더만 hdrs에 골라 담는 함수 */
+void read_requesthdrs(rio_t *rp, reqhdrs_t *hdrs);
 
 /* 정적, 동적 콘텐츠인지를 구분하여 맞게 처리(분석) */
 int parse_uri(char *uri, char *filename, char *cgiargs);
 
 /* 서버에서 정적 콘텐츠를 처리 */
-void serve_static(char method[MAXLINE], int fd, char *filename, int filesize);
+void serve_static(char method[MAXLINE], int fd, char *filename, fcache_ent_t *fe, reqhdrs_t *hdrs);
+
+/* 파일의 static_hdr_t를 처음 한 번 만들어 fcache 항목에 달고 돌려주는 함수 */
+static_hdr_t *static_hdr(fcache_ent_t *fe, char *filename);
+
+/* 조건부 요청에 대해 파일이 바뀌지 않았는지 판단하는 함수 */
+int not_modified(reqhdrs_t *hdrs, struct stat *sbuf, char *etag);
+
+/* Range 헤더를 파일 크기에 맞춰 해석하는 함수 */
+int parse_range(reqhdrs_t *hdrs, off_t filesize, char *etag, char *lastmod, off_t *first, off_t *last);
+
+/* 열린 파일 srcfd의 [offset, offset+len) 구간을 sendfile로 보내는 함수 */
+void send_range(int fd, int srcfd, off_t offset, size_t len);
+
+/* 응답 조각들을 sendmsg로 한꺼번에 보내는 함수 */
+void send_iov(int fd, struct iovec *iov, int iovcnt, int flags);
 
 /* 도메인을 분석해서 파일의 타입을 정의해주는 함수 */
 void get_filetype(char *filename, char *filetype);
 
-/* 서버에서 동적 콘텐츠를 처리해주는 함수 */
-void serve_dynamic(char method[MAXLINE], int fd, char *filename, char *cgiargs);
+/* 서버에서 동적 콘텐츠를 처리해주는 함수 (chunked: 길이를 모르는 CGI 출력을 chunked로 보내도 되면 1).
+   keepalive가 1이고 응답 뒤에도 연결을 유지할 수 있으면 1을 돌려준다 */
+int serve_dynamic(char method[MAXLINE], int fd, char *filename, char *cgiargs, tiny_handler_fn handler,
+                  int chunked, int keepalive);
+
+/* environ에서 CGI 변수를 빼고 요청의 값을 붙인 CGI 프로그램의 환경 (Malloc 하나) */
+char **cgi_env(char *method, char *cgiargs);
 
 /* 상황에 맞는 에러메세지를 출력해주는 함수 */
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg,
-                 char *longmsg);
+                 char *longmsg, int keepalive);
+
+/* 처음부터 close-on-exec인 연결을 받는다 */
+int accept_cloexec(int listenfd, SA *addr, socklen_t *addrlen);
+
+/* 연결 대기열에 넣고 빼는 함수 (CS:APP의 sbuf와 같은 원형 버퍼) */
+void conn_enqueue(conn_t *c);
+conn_t *conn_dequeue(void);
+
+/* 대기열에서 연결을 꺼내 처리하는 작업 쓰레드 */
+void *worker(void *vargp);
+
+static conn_t *conn_q[TINY_QSIZE];     /* 연결 대기열 */
+static int conn_front, conn_rear;
+static sem_t conn_mutex, conn_slots, conn_items;
+static int keepalive_secs = TINY_KEEPALIVE;   /* -k: 0이면 요청마다 연결을 닫는다 */
+static int max_reqs = TINY_MAXREQS;           /* -r */
+static int nworkers = TINY_NWORKERS;          /* -w */
 
 
 
@@ -37,73 +143,262 @@ int main(int argc, char **argv) {   //argc: 인자의 개수(기본이1 그리
   char hostname[MAXLINE], port[MAXLINE]; // hostname: 주소(ip로도 올 수 있고 도메인)   port: ip만으로는 부족해서 부여하는 주소
   socklen_t clientlen;                   // clientlen: 클라이언트 주소 길이
   struct sockaddr_storage clientaddr;    // 클라이언트에 있는 소켓 주소
+  int opt, i;
+  pthread_t tid;
+  struct pollfd pfd[2];
+  struct timeval tv;
+  conn_t *c;
 
   /* Check command line args */
-  if (argc != 2) {  //정상적인 주소 및 포트 입력이 아니라면(무조건 한개만 입력)
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);  //fprintf: 에러메시지를 저장한다음 출력하고 종료
+  while ((opt = getopt(argc, argv, "w:f:v:m:s:Hk:r:c:Pt:")) != -1) {
+    switch (opt) {
+    case 'w':                          // 작업 쓰레드 수 (0이면 한 번에 한 연결씩)
+      nworkers = atoi(optarg);
+      break;
+    case 'f':                          // 열어 둘 파일 수 (0이면 요청마다 열고 닫는다)
+      fcache_max = atoi(optarg);
+      break;
+    case 'v':                          // 열어 둔 파일이 바뀌었는지 stat으로 확인하는 간격(초)
+      fcache_interval = atoi(optarg);
+      break;
+    case 'm':                          // 열어 둔 파일의 헤더와 본문을 올려 둘 메모리 예산(바이트)
+      fcache_mem_max = atol(optarg);
+      break;
+    case 's':                          // 이 크기(바이트) 이하의 파일은 본문도 메모리에서 보낸다
+      fcache_mem_file = atol(optarg);
+      break;
+    case 'H':                          // 그 메모리를 2MB 휴즈 페이지로
+      slab_hugepages = 1;
+      break;
+    case 'k':                          // 다음 요청을 기다리며 연결을 유지할 시간(초) (0이면 요청마다 닫는다)
+      keepalive_secs = atoi(optarg);
+      break;
+    case 'r':                          // 한 연결에서 처리할 최대 요청 수
+      max_reqs = atoi(optarg);
+      break;
+    case 'c':                          // CGI 프로그램마다 띄워 둘 작업 프로세스 수 (0이면 요청마다 fork)
+      cgi_nworkers = atoi(optarg);
+      break;
+    case 'P':                          // cgi-bin의 처리기 .so를 쓰지 않는다
+      plugin_enabled = 0;
+      break;
+    case 't':                          // 요청마다 띄운 CGI를 죽이기까지의 시간(초) (0이면 기다린다)
+      cgi_timeout = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-w workers] [-f files] [-v secs] [-m bytes] [-s bytes] [-H]\n"
+              "       [-k secs] [-r reqs] [-c cgiworkers] [-P] [-t secs] <port>\n", argv[0]);
+      exit(1);
+    }
+  }
+  if (optind != argc - 1) {  //정상적인 주소 및 포트 입력이 아니라면(무조건 한개만 입력)
+    fprintf(stderr, "usage: %s [-w workers] [-f files] [-v secs] [-m bytes] [-s bytes] [-H]\n"
+            "       [-k secs] [-r reqs] [-c cgiworkers] [-P] [-t secs] <port>\n", argv[0]);  //fprintf: 에러메시지를 저장한다음 출력하고 종료
     exit(1);
   }
 
-  listenfd = Open_listenfd(argv[1]);                   //Open_listenfd: 듣기 식별자 생성 (추후 공부 필요)  fd는 식별자
+  slab_configure(fcache_mem_max);       // 예산에 맞춰 페이지를 줄이고, 너무 작으면 Malloc으로
+  Signal(SIGPIPE, SIG_IGN);            // 클라이언트가 먼저 끊어도 서버가 죽지 않도록
+  Sem_init(&conn_mutex, 0, 1);
+  Sem_init(&conn_slots, 0, TINY_QSIZE);
+  Sem_init(&conn_items, 0, 0);
+  for (i = 0; i < nworkers; i++)
+    Pthread_create(&tid, NULL, worker, NULL);
+
+  reaper_init();
+  idle_init(keepalive_secs);
+
+  listenfd = Open_listenfd(argv[optind]);              //Open_listenfd: 듣기 식별자 생성 (추후 공부 필요)  fd는 식별자
+  fcntl(listenfd, F_SETFD, FD_CLOEXEC);                // CGI가 듣기 소켓을 물려받지 않도록 (아직 띄운 CGI가 없다)
+  pfd[0].fd = listenfd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = idle_fd();                               // -1이면 poll이 무시한다
+  pfd[1].events = POLLIN;
   while (1) {                                          //무한 루프  서버는 항상 준비가 되어있어야 하기 때문에
+    reaper_wait(pfd, 2, idle_timeout());               // 연결이나 유휴 연결의 요청이 올 때까지 끝난 CGI 자식을 거두며 기다린다
+    idle_check(dispatch);                              // 요청이 온 유휴 연결을 넘기고 오래 조용한 연결은 닫는다
+    if (!pfd[0].revents)
+      continue;
     clientlen = sizeof(clientaddr);                    //clientaddr: 클라이언트 주소    clientaddr: Open_listenfd에서 get addrinfo에서 만들어짐 
-    connfd = Accept(listenfd, (SA *)&clientaddr,       //클라이언트로부터 연결요청을 기다리고 받아들여주는 것  연결 식별자가 리턴됨(0보다 크거나 같음)
-                    &clientlen);  // line:netp:tiny:accept
+    connfd = accept_cloexec(listenfd, (SA *)&clientaddr,   //클라이언트로부터 연결요청을 기다리고 받아들여주는 것  연결 식별자가 리턴됨(0보다 크거나 같음)
+                            &clientlen);  // line:netp:tiny:accept
     Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,    //Getnameinfo: 소켓 구조체를 주소와 포트로 바꿔주고 이들을 host와 service버퍼로 복사  출력 리턴값이 0, 에러면 에러코드
                 0);
     printf("Accepted connection from (%s, %s)\n", hostname, port);  //클라이언트 ip와 포트 출력
-    doit(connfd);   // 트랜잭션 수행
-    Close(connfd);  // 자신쪽의 연결끝을 닫는다.
+    if (keepalive_secs > 0) {   // 요청을 읽다가 -k초 넘게 멈추면 읽기가 실패해 연결을 닫는다
+      tv.tv_sec = keepalive_secs;
+      tv.tv_usec = 0;
+      setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    c = Malloc(sizeof(conn_t));
+    c->fd = connfd;
+    c->nreqs = 0;
+    c->armed = 0;
+    dispatch(c);
   }
 }
 
+void dispatch(conn_t *c)
+{
+  if (nworkers > 0)
+    conn_enqueue(c);          // 작업 쓰레드에게 넘긴다 (대기열이 차 있으면 빌 때까지 기다린다)
+  else
+    handle_conn(c);           // 트랜잭션 수행
+}
+
+/*
+ * accept_cloexec - Accept와 같지만 연결을 SOCK_CLOEXEC로 받는다. 받은 뒤에 fcntl로 걸면 그
+ *     사이에 작업 쓰레드가 띄운 CGI가 연결을 물려받아 붙잡을 수 있다. accept4는 glibc에서
+ *     _GNU_SOURCE로만 보이는데 그러면 csapp.h의 gai_error가 부딪치므로 syscall로 부른다.
+ */
+int accept_cloexec(int listenfd, SA *addr, socklen_t *addrlen)
+{
+  int rc;
+
+#ifdef SYS_accept4
+  if ((rc = syscall(SYS_accept4, listenfd, addr, addrlen, SOCK_CLOEXEC)) < 0)
+    unix_error("Accept error");
+#else
+  rc = Accept(listenfd, addr, addrlen);
+  fcntl(rc, F_SETFD, FD_CLOEXEC);
+#endif
+  return rc;
+}
+
+void conn_enqueue(conn_t *c)
+{
+  P(&conn_slots);
+  P(&conn_mutex);
+  conn_q[conn_rear] = c;
+  conn_rear = (conn_rear + 1) % TINY_QSIZE;
+  V(&conn_mutex);
+  V(&conn_items);
+}
+
+conn_t *conn_dequeue(void)
+{
+  conn_t *c;
+
+  P(&conn_items);
+  P(&conn_mutex);
+  c = conn_q[conn_front];
+  conn_front = (conn_front + 1) % TINY_QSIZE;
+  V(&conn_mutex);
+  V(&conn_slots);
+  return c;
+}
+
+void *worker(void *vargp)
+{
+  Pthread_detach(pthread_self());
+  while (1)
+    handle_conn(conn_dequeue());
+  return NULL;
+}
 
-void doit(int fd)  //이 함수에서 fd는 연결 식별자 connfd
+void handle_conn(conn_t *c)
+{
+  if (serve_conn(c) && idle_park(c) == 0)
+    return;
+  Close(c->fd);  // 자신쪽의 연결끝을 닫는다.
+  Free(c);
+}
+
+int serve_conn(conn_t *c)
+{
+  rio_t rio;
+  struct pollfd p = { c->fd, POLLIN, 0 };
+
+  Rio_readinitb(&rio, c->fd);  // connectfd와 rio 버퍼를 연결해준다. 파이프라인으로 온 다음 요청은 이 버퍼에 남는다
+  while (doit(c->fd, &rio, keepalive_secs > 0 && ++c->nreqs < max_reqs))
+    // 버퍼가 비었고 곧바로 이어지는 요청도 없으면 다음 요청은 메인 쓰레드가 기다린다
+    // (응답을 받자마자 다음 요청을 보내는 클라이언트는 메인 쓰레드를 거치지 않는다)
+    if (rio.rio_cnt == 0 && poll(&p, 1, TINY_LINGER_MS) == 0)
+      return 1;
+  return 0;
+}
+
+int doit(int fd, rio_t *rp, int reuse)  //이 함수에서 fd는 연결 식별자 connfd
 {
   int is_static;       // 동적인지 정적 콘텐츠 인지 알려주는 변수  is_static이 1이면 정적 0이라면 동적 컨텐츠 
   struct stat sbuf;   //소켓 버퍼 (임시저장 변수)
   char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];    //uri: 파일 이름과 옵션인 인자들을 포함하는 URL의 접미어  version:HTTP1.0인지 1.1인지
   char filename[MAXLINE], cgiargs[MAXLINE];  //cgiargs 는 ?뒤에 나오는 것으로 &로 구분한다.(?앞에는 파일명)
-  rio_t rio; 
+  reqhdrs_t hdrs;      // 조건부 요청 헤더
+  fcache_ent_t *fe = NULL;   // 정적 파일의 열린 fd와 stat 정보
+  tiny_handler_fn handler = NULL;   // cgi-bin/<name>.so의 처리기
+  int keep;            // 에러 응답 뒤에 연결을 유지할지 (HEAD에는 본문 없는 에러를 못 보내므로 닫는다)
 
   /* Read request line and headers */
-  Rio_readinitb(&rio, fd);  // connectfd와 rio 버퍼를 연결해준다.
-  Rio_readlineb(&rio, buf, MAXLINE);  //rio버퍼에 있는것을 읽고(maxlien -1 만큼) 우리 버퍼에 저장
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0)  //rio버퍼에 있는것을 읽고(maxlien -1 만큼) 우리 버퍼에 저장 (요청 없이 끊겼거나 유휴 시간이 지났으면 끝)
+    return 0;
   printf("Request headers:\n");
   printf("%s", buf);                               // 버퍼에는 메소드와 uri와 http버전이 띄어쓰기로 나열되어 있다.
-  sscanf(buf, "%s %s %s", method, uri, version);   // 버퍼에 있는 출력값들을 메쏘드, uri, 버전 변수에 정의
+  if (sscanf(buf, "%s %s %s", method, uri, version) != 3) {   // 버퍼에 있는 출력값들을 메쏘드, uri, 버전 변수에 정의
+    clienterror(fd, buf, "400", "Bad request", "Tiny couldn't parse the request", 0);
+    return 0;
+  }
 
   if (!((strcasecmp(method, "GET") == 0) || (strcasecmp(method, "HEAD") == 0))) {                 // 메소드의 인자 1과 인자2가 같으면 0을 리턴 
-    clienterror(fd, method, "501", "Not implemented", "Tiny does not implement this method");
-    return;
+    clienterror(fd, method, "501", "Not implemented", "Tiny does not implement this method", 0);   // 본문이 딸려 왔을 수 있어 닫는다
+    return 0;
   }
-  read_requesthdrs(&rio);                          // 메소드가 GET으로 들어오면 읽어들이고 다른 연결요청 헤더 무시
+  read_requesthdrs(rp, &hdrs);                   // 메소드가 GET으로 들어오면 읽어들이고 다른 연결요청 헤더 무시
+  if (strcasecmp(version, "HTTP/1.0"))              // HTTP/1.1은 기본이 유지, HTTP/1.0은 keep-alive를 청했을 때만
+    hdrs.keepalive = reuse && !has_token(hdrs.conn, "close");
+  else
+    hdrs.keepalive = reuse && has_token(hdrs.conn, "keep-alive");
+  keep = hdrs.keepalive && strcasecmp(method, "HEAD");
 
   /* Parse URI from GET request */
   is_static = parse_uri(uri, filename, cgiargs);    // URI를 파일 이름과 비어 있을 수도 있는 CGI인자 스트링으로 분석하고, 요청이 정적 또는 동적 컨텔츠를 위한 것인지 나타내는 플레그를 설정.
-  if (stat(filename, &sbuf) < 0) {   // stat: 파일의 정보를 가져와서 두번째 인자인 sbuf에 넣어준다.(0보다 작으면 파일이 없다.)
-    clienterror(fd, filename, "404", "Not found", "Tiny couldn't find this file");    
-    return;
+  if (is_static)                                    // 정적 파일은 열어 둔 fd와 stat 정보를 캐시에서 얻는다
+    fe = fcache_get(filename);
+  else                                              // 처리기 .so가 있으면 실행 파일 없이도 된다
+    handler = plugin_find(filename);
+  if (is_static ? !fe : !handler && stat(filename, &sbuf) < 0) {   // stat: 파일의 정보를 가져와서 두번째 인자인 sbuf에 넣어준다.(0보다 작으면 파일이 없다.)
+    clienterror(fd, filename, "404", "Not found", "Tiny couldn't find this file", keep);    
+    return keep;
   }
 
   if (is_static) { /* Serve static content */   // 정적 컨텐츠라면 
-    if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {          // 일반파일이거나 읽기권한이 없으면 에러를 띄운다     요청이 정적 컨텐츠를 위한 것이면 이 파일이 보통파일 이라는 것과 읽기 권한을 가지고 있는지 검증.
-      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't read the file");
-      return;
+    if (!(S_ISREG(fe->st.st_mode)) || !(S_IRUSR & fe->st.st_mode) || fe->fd < 0) {          // 일반파일이거나 읽기권한이 없으면 에러를 띄운다     요청이 정적 컨텐츠를 위한 것이면 이 파일이 보통파일 이라는 것과 읽기 권한을 가지고 있는지 검증.
+      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't read the file", keep);
+      fcache_put(fe);
+      return keep;
     }
-    serve_static(method, fd, filename, sbuf.st_size);     // 정적 컨텐츠 제공
+    serve_static(method, fd, filename, fe, &hdrs);     // 정적 컨텐츠 제공
+    fcache_put(fe);
+    return hdrs.keepalive;
   }
   else { /* Serve dynamic content */            // 정적 컨텐츠
-    if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {          // 앞에꺼가 일반파일 여부
-      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't run the CGI program");
-      return;
+    if (!handler && (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode))) {          // 앞에꺼가 일반파일 여부
+      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't run the CGI program", keep);
+      return keep;
     }
-    serve_dynamic(method, fd, filename, cgiargs);
+    // 요청마다 띄운 CGI 응답 뒤에는 연결을 닫고, 출력을 다 받아 길이를 아는 응답 뒤에는 유지한다
+    return serve_dynamic(method, fd, filename, cgiargs, handler, strcasecmp(version, "HTTP/1.0") != 0,
+                         hdrs.keepalive);
   }
 }
 
+int has_token(char *list, char *tok)
+{
+  size_t n = strlen(tok);
+
+  while (*list) {
+    while (*list == ' ' || *list == '\t' || *list == ',')
+      list++;
+    if (!strncasecmp(list, tok, n) && (!list[n] || strchr(" \t,", list[n])))
+      return 1;
+    while (*list && *list != ',')
+      list++;
+  }
+  return 0;
+}
+
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg,    //HTTP응답을 응답 라인에 적절한 상태 코드와 상태 메시지와 함께 클라이언트에 보내며 에러를 설명하는 응답 본체에 html파일도 함께 보낸다.
-                 char *longmsg)
+                 char *longmsg, int keepalive)
 {
   char buf[MAXLINE], body[MAXBUF];
 
@@ -115,22 +410,35 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg,    //HTTP응
   sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
 
   /* Print the HTTP response */
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
+  sprintf(buf, "HTTP/1.1 %s %s\r\n%s", errnum, shortmsg, keepalive ? CONN_KEEP : CONN_CLOSE);
+  rio_writen(fd, buf, strlen(buf));
   sprintf(buf, "Content-type: text/thml\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, buf, strlen(buf));
   sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, body, strlen(body));
 }
 
-void read_requesthdrs(rio_t *rp)  // rp는 rio버퍼
+void read_requesthdrs(rio_t *rp, reqhdrs_t *hdrs)  // rp는 rio버퍼
 {
   char buf[MAXLINE];
 
-  Rio_readlineb(rp, buf, MAXLINE);   // rb에서 택스트를 읽고 buf에 복사
+  hdrs->ims[0] = hdrs->inm[0] = hdrs->range[0] = hdrs->ifrange[0] = hdrs->conn[0] = '\0';
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0)   // rb에서 택스트를 읽고 buf에 복사
+    return;
   while (strcmp(buf, "\r\n")) {      // strcmp: 문자열 비교 
-    Rio_readlineb(rp, buf, MAXLINE);
+    if (!strncasecmp(buf, "If-Modified-Since:", 18))
+      sscanf(buf + 18, " %[^\r\n]", hdrs->ims);
+    else if (!strncasecmp(buf, "If-None-Match:", 14))
+      sscanf(buf + 14, " %[^\r\n]", hdrs->inm);
+    else if (!strncasecmp(buf, "Range:", 6))
+      sscanf(buf + 6, " %[^\r\n]", hdrs->range);
+    else if (!strncasecmp(buf, "If-Range:", 9))
+      sscanf(buf + 9, " %[^\r\n]", hdrs->ifrange);
+    else if (!strncasecmp(buf, "Connection:", 11))
+      sscanf(buf + 11, " %[^\r\n]", hdrs->conn);
+    if (rio_readlineb(rp, buf, MAXLINE) <= 0)   // 헤더 중간에 끊겼으면 그만 읽는다
+      return;
     printf("%s", buf);
   }
   return;
@@ -162,28 +470,77 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
   }
 }
 
-void serve_static(char method[MAXLINE], int fd, char *filename, int filesize)      // 정적 컨텐츠 제공 
+void serve_static(char method[MAXLINE], int fd, char *filename, fcache_ent_t *fe, reqhdrs_t *hdrs)      // 정적 컨텐츠 제공 
 {
-  int srcfd;
-  char *srcp, filetype[MAXLINE], buf[MAXBUF];
+  int filesize = fe->st.st_size, rc, n;
+  char buf[MAXBUF];
+  off_t first, last;
+  static_hdr_t *h = static_hdr(fe, filename);   // 검증자, 파일 타입, 200 헤더는 파일마다 한 번만 만든다
+  char *lastmod = h->lastmod, *etag = h->etag, *filetype = h->filetype;
+  char *conn = hdrs->keepalive ? CONN_KEEP : CONN_CLOSE;
+  int body = strcasecmp(method, "HEAD") != 0;    // HEAD에 본문을 보내면 유지한 연결의 다음 응답이 어긋난다
+  struct iovec iov[4];
+
+  if (not_modified(hdrs, &fe->st, etag)) {   // 바뀌지 않았으면 본문 없이 304
+    n = sprintf(buf, "HTTP/1.1 304 Not Modified\r\n");
+    n += sprintf(buf + n, "Server: Tiny Web Server\r\n");
+    n += sprintf(buf + n, "%s", conn);
+    n += sprintf(buf + n, "Last-Modified: %s\r\n", lastmod);
+    n += sprintf(buf + n, "ETag: %s\r\n\r\n", etag);
+    rio_writen(fd, buf, n);
+    printf("Response headers:\n");
+    printf("%s", buf);
+    return;
+  }
+
+  if ((rc = parse_range(hdrs, filesize, etag, lastmod, &first, &last)) == 0) {   // 파일 밖의 범위
+    n = sprintf(buf, "HTTP/1.1 416 Range Not Satisfiable\r\n");
+    n += sprintf(buf + n, "Server: Tiny Web Server\r\n");
+    n += sprintf(buf + n, "%s", conn);
+    n += sprintf(buf + n, "Content-Range: bytes */%d\r\n", filesize);
+    n += sprintf(buf + n, "Content-length: 0\r\n\r\n");
+    rio_writen(fd, buf, n);
+    return;
+  }
+  if (rc > 0) {                          // 범위 요청: 206과 함께 그 구간만 sendfile로
+    n = sprintf(buf, "HTTP/1.1 206 Partial Content\r\n");
+    n += sprintf(buf + n, "Server: Tiny Web Server\r\n");
+    n += sprintf(buf + n, "%s", conn);
+    n += sprintf(buf + n, "Content-length: %ld\r\n", (long)(last - first + 1));
+    n += sprintf(buf + n, "Content-Range: bytes %ld-%ld/%d\r\n", (long)first, (long)last, filesize);
+    n += sprintf(buf + n, "Content-type: %s\r\n", filetype);
+    n += sprintf(buf + n, "Last-Modified: %s\r\n", lastmod);
+    n += sprintf(buf + n, "ETag: %s\r\n\r\n", etag);
+    iov[0].iov_base = buf;
+    iov[0].iov_len = n;
+    send_iov(fd, iov, 1, body ? MSG_MORE : 0);
+    printf("Response headers:\n");
+    printf("%s", buf);
+    if (body)
+      send_range(fd, fe->fd, first, last - first + 1);
+    return;
+  }
 
   /* Send response headers to client */
-  get_filetype(filename, filetype);
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-  sprintf(buf, "%sConnection: close\r\n", buf);
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-  Rio_writen(fd, buf, strlen(buf));    // 식별자 fd로 buf내용 전송     //웹 브라우저에 전송
+  // 만들어 둔 헤더 뒤에 이 연결의 Connection과 빈 줄을 붙인다. 메모리에 올린 파일은
+  // 본문까지 sendmsg 한 번으로 보낸다
+  iov[0].iov_base = h->data;
+  iov[0].iov_len = h->len;
+  iov[1].iov_base = conn;
+  iov[1].iov_len = strlen(conn);
+  iov[2].iov_base = "\r\n";
+  iov[2].iov_len = 2;
+  iov[3].iov_base = h->data + h->len;
+  iov[3].iov_len = h->inmem && body ? filesize : 0;
+  send_iov(fd, iov, 4, body && filesize && !h->inmem ? MSG_MORE : 0);    // 식별자 fd로 만들어 둔 헤더 전송     //웹 브라우저에 전송
   printf("Response headers:\n");
-  printf("%s", buf);
-  
+  printf("%.*s%s\r\n", (int)h->len, h->data, conn);
+
   /* Send response body to client */
-  srcfd = Open(filename, O_RDONLY, 0);                            // srcfd: (임시 저장장치)   Open: 파일을 열고 성공시 파일 식별자 반환
-  srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);     // Mmap: srcp포인터에서 부터 파일 내용을 복사해서 넣는다.  각각 0은 븥여넣어질 그리고 복사할 시작 주소
-  Close(srcfd);
-  Rio_writen(fd, srcp, filesize);                                 // srcp 에서 fd로 filesize만큼 전송  (클라이언트로 전송)
-  Munmap(srcp, filesize);                                         // free랑 같은 기능
+  // 예전에는 Mmap한 파일을 Rio_writen으로 복사해 보냈다. 요청마다 매핑을 만들고 지우는
+  // 비용(페이지 테이블, TLB)과 사용자 공간 복사 없이 페이지 캐시에서 바로 보낸다
+  if (body && !h->inmem)
+    send_range(fd, fe->fd, 0, filesize);
 
   // if (!(strcasecmp(method, "GET"))){
   //   srcfd = Open(filename, O_RDONLY, 0);
@@ -195,6 +552,142 @@ void serve_static(char method[MAXLINE], int fd, char *filename, int filesize)
   // }
 }
 
+static_hdr_t *static_hdr(fcache_ent_t *fe, char *filename)
+{
+  static_hdr_t *h, v;
+  char buf[MAXBUF];
+  struct tm tm;
+  int n;
+  size_t size = fe->st.st_size, cap, off = 0;
+  ssize_t rc;
+
+  if ((h = fcache_hdr(fe)))
+    return h;
+  /* stat()한 정보로 검증자를 만든다 (gmtime은 쓰레드마다 따로 쓸 수 없다) */
+  strftime(v.lastmod, sizeof(v.lastmod), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&fe->st.st_mtime, &tm));
+  sprintf(v.etag, "\"%lx-%lx-%lx\"", (long)fe->st.st_ino, (long)fe->st.st_size, (long)fe->st.st_mtime);
+  get_filetype(filename, v.filetype);
+  n = snprintf(buf, sizeof(buf),
+               "HTTP/1.1 200 OK\r\n"
+               "Server: Tiny Web Server\r\n"
+               "Accept-Ranges: bytes\r\n"
+               "Content-length: %ld\r\n"
+               "Content-type: %s\r\n"
+               "Last-Modified: %s\r\n"
+               "ETag: %s\r\n",
+               (long)fe->st.st_size, v.filetype, v.lastmod, v.etag);
+  v.len = n;
+  v.inmem = fcache_max > 0 && size <= fcache_mem_file && size + n <= fcache_mem_max;
+  h = fcache_alloc(sizeof(static_hdr_t) + n + (v.inmem ? size : 0), &cap);
+  memcpy(h, &v, sizeof(static_hdr_t));
+  memcpy(h->data, buf, n);
+  while (h->inmem && off < size) {      // 본문은 헤더 바로 뒤에 이어 붙인다
+    if ((rc = pread(fe->fd, h->data + n + off, size - off, off)) > 0)
+      off += rc;
+    else if (!(rc < 0 && errno == EINTR))
+      h->inmem = 0;                     // 그사이 줄었거나 못 읽었으면 본문은 디스크에서 보낸다
+  }
+  return fcache_set_hdr(fe, h, cap);
+}
+
+int not_modified(reqhdrs_t *hdrs, struct stat *sbuf, char *etag)
+{
+  struct tm tm;
+
+  if (hdrs->inm[0])                  // If-None-Match가 있으면 If-Modified-Since보다 우선
+    return !strcmp(hdrs->inm, "*") || strstr(hdrs->inm, etag) != NULL;
+  if (hdrs->ims[0]) {
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(hdrs->ims, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+      return sbuf->st_mtime <= timegm(&tm);
+  }
+  return 0;
+}
+
+/*
+ * parse_range - 단일 범위 "bytes=a-b", "bytes=a-", "bytes=-n"을 해석한다.
+ *     범위가 유효하면 1, 파일 밖이면 0(416), Range가 없거나 여러 범위이거나
+ *     If-Range가 현재 파일과 맞지 않으면 -1을 돌려주어 전체를 보내게 한다.
+ */
+int parse_range(reqhdrs_t *hdrs, off_t filesize, char *etag, char *lastmod, off_t *first, off_t *last)
+{
+  long a, b;
+  char *p;
+
+  if (!hdrs->range[0] || strncasecmp(hdrs->range, "bytes=", 6) || strchr(hdrs->range, ','))
+    return -1;
+  if (hdrs->ifrange[0] && strcmp(hdrs->ifrange, etag) && strcmp(hdrs->ifrange, lastmod))
+    return -1;
+  p = hdrs->range + 6;
+  if (*p == '-') {                      // 마지막 n바이트
+    if (sscanf(p + 1, "%ld", &b) != 1 || b < 0)
+      return -1;
+    if (b == 0 || filesize == 0)
+      return 0;
+    *first = (b >= filesize) ? 0 : filesize - b;
+    *last = filesize - 1;
+    return 1;
+  }
+  if (sscanf(p, "%ld", &a) != 1 || a < 0 || !strchr(p, '-'))
+    return -1;
+  if (sscanf(p, "%ld-%ld", &a, &b) != 2)      // a-: 끝까지
+    b = filesize - 1;
+  if (b < a)
+    return -1;
+  if (a >= filesize)
+    return 0;
+  *first = a;
+  *last = (b >= filesize) ? filesize - 1 : b;
+  return 1;
+}
+
+void send_range(int fd, int srcfd, off_t offset, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {                     // sendfile이 offset을 옮겨 가며 페이지 캐시에서 바로 보낸다 (fd의 위치는 그대로라 여러 쓰레드가 같이 써도 된다)
+    if ((n = sendfile(fd, srcfd, &offset, len)) <= 0) {
+      if (n < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+    len -= n;
+  }
+}
+
+/*
+ * send_iov - 응답 조각들을 sendmsg 한 번으로 보낸다(다 못 나가면 남은 조각부터 다시).
+ *     flags에 MSG_MORE를 주면 커널이 바로 내보내지 않고 뒤따르는 sendfile의 본문과
+ *     합쳐 꽉 찬 세그먼트로 보낸다. TCP_CORK를 켜고 끄는 setsockopt 두 번 없이 같은
+ *     효과를 내며, 작은 파일은 sendmsg와 sendfile 두 번의 호출로 끝난다. iov는 보내는
+ *     동안 고쳐 쓴다.
+ */
+void send_iov(int fd, struct iovec *iov, int iovcnt, int flags)
+{
+  struct msghdr msg;
+  ssize_t n;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  while (msg.msg_iovlen > 0) {
+    if ((n = sendmsg(fd, &msg, flags)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {   // 다 나간 조각은 건너뛴다
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+}
+
 void get_filetype(char *filename, char *filetype)
 {
   if (strstr(filename, ".html"))
@@ -211,23 +704,114 @@ void get_filetype(char *filename, char *filetype)
     strcpy(filetype, "text/plain");
 }
 
-void serve_dynamic(char method[MAXLINE], int fd, char *filename, char *cgiargs)    // fd: 연결 식별자
+int serve_dynamic(char method[MAXLINE], int fd, char *filename, char *cgiargs, tiny_handler_fn handler,
+                  int chunked, int keepalive)    // fd: 연결 식별자
 {
-  char buf[MAXLINE], *emptylist[] = { NULL };
-
-  /* Return first part of HTTP response */
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Server: Tiny Web Server\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  char *emptylist[] = { NULL }, *out, **envp, extra[128];
+  pid_t pid;
+  size_t len, hlen, n;
+  ssize_t body;
+  int rc, p[2], head = !strcasecmp(method, "HEAD");
+  struct iovec iov[4];
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+
+  // 처리기 .so는 이 쓰레드에서 부르고, 루프 모드를 아는 프로그램은 상주 작업 프로세스가
+  // 처리한다. 둘 다 출력을 다 받은 뒤에 보낸다
+  if (handler)
+    rc = plugin_run(handler, filename, method, cgiargs, &out, &len);
+  else
+    rc = cgipool_run(filename, method, cgiargs, &out, &len);
+  if (rc == -2) {
+    clienterror(fd, filename, "504", "Gateway timeout", "The CGI program did not finish in time", 0);
+    return 0;
+  }
+  if (rc < 0) {
+    clienterror(fd, filename, "500", "Internal server error", "Tiny's CGI handler failed", 0);
+    return 0;
+  }
+  if (rc > 0) {
+    if ((body = cgi_header_end(out, len, &hlen)) < 0) {
+      Free(out);
+      clienterror(fd, filename, "500", "Internal server error", "The CGI program sent no header", 0);
+      return 0;
+    }
+    // 길이를 알므로 프로그램이 정하지 않은 Content-length를 채우고 연결을 유지한다.
+    // 프로그램이 Connection을 정했으면 그대로 보내고 닫는다
+    n = 0;
+    if (!head && !cgi_has_header(out, hlen, "Content-length") && !cgi_has_header(out, hlen, "Transfer-Encoding"))
+      n += sprintf(extra + n, "Content-length: %zu\r\n", len - body);
+    if (cgi_has_header(out, hlen, "Connection"))
+      keepalive = 0;
+    else
+      n += sprintf(extra + n, "%s", keepalive ? CONN_KEEP : CONN_CLOSE);
+    n += sprintf(extra + n, "\r\n");
+    iov[0].iov_base = "HTTP/1.1 200 OK\r\nServer: Tiny Web Server\r\n";
+    iov[0].iov_len = strlen(iov[0].iov_base);
+    iov[1].iov_base = out;
+    iov[1].iov_len = hlen;
+    iov[2].iov_base = extra;
+    iov[2].iov_len = n;
+    iov[3].iov_base = out + body;
+    iov[3].iov_len = head ? 0 : len - body;   // HEAD에 본문을 내는 프로그램이어도 다음 요청과 섞이지 않게
+    send_iov(fd, iov, 4, 0);
+    Free(out);
+    return keepalive;
+  }
 
-  if (Fork() == 0) { /* Child */
-    /* Real server would set all CGI vars here */
-    setenv("QUERY_STRING", cgiargs, 1);     // 환경변수 값을 설정 "QUERY_STRING"에 cgiarg를 넣어준다 1이면 덮어쓰고 0이면 덧붙인다.
-    // method를 cgi-bin/adder.c에 넘겨주기 위해 환경변수 set
-    setenv("REQUEST_METHOD", method, 1);
-    Dup2(fd, STDOUT_FILENO);            /* Redirect stdout to client */   // 자식프로세스를 fd한테 연결 STDOUT_FILENO는 표준출력
-    Execve(filename, emptylist, environ);  /* Run CGI program */           //대문자는 유닉스에서 에러까지 포함하는것
+  if (cgi_pipe(p) < 0) {
+    clienterror(fd, filename, "500", "Internal server error", "Tiny couldn't run the CGI program", 0);
+    return 0;
+  }
+  /* Real server would set all CGI vars here */
+  // 자식에서 setenv를 부르지 않도록 (다른 쓰레드가 쥐고 있던 락에 막힐 수 있다) 환경을 미리 만든다
+  envp = cgi_env(method, cgiargs);
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, p[1], STDOUT_FILENO);  // 출력은 파이프로 받아 tiny가 헤더를 붙여 보낸다
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);     // 제한 시간에 손자 프로세스까지 한꺼번에 죽이도록
+  posix_spawnattr_setpgroup(&attr, 0);
+  // vfork처럼 페이지 테이블을 복사하지 않고 띄운다. exec가 실패해도 여기서 오류로 돌아온다
+  if ((rc = posix_spawn(&pid, filename, &fa, &attr, emptylist, envp)) != 0)
+    fprintf(stderr, "tiny: posix_spawn %s: %s\n", filename, strerror(rc));
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  Free(envp);
+  Close(p[1]);
+  if (rc != 0) {
+    Close(p[0]);
+    clienterror(fd, filename, "500", "Internal server error", "Tiny couldn't run the CGI program", 0);
+    return 0;
   }
-  Wait(NULL); /* Parent waits for and reaps child */      // 자식이 끝날때 까지 기다리다 끝나면 자식 종료
+
+  rc = cgi_relay(fd, p[0], pid, chunked, head);
+  Close(p[0]);
+  if (rc == 0)
+    clienterror(fd, filename, "504", "Gateway timeout", "The CGI program did not finish in time", 0);
+  else if (rc < 0)
+    clienterror(fd, filename, "500", "Internal server error", "The CGI program sent no header", 0);
+  if (reaper_add(pid) < 0)
+    Waitpid(pid, NULL, 0);    // 메인 쓰레드에 맡길 수 없으면 예전처럼 자기 자식만 기다린다 (출력을 닫았으니 곧 끝난다)
+  return 0;
+}
+
+char **cgi_env(char *method, char *cgiargs)
+{
+  char **envp, *qs, *rm;
+  int i, n;
+
+  for (n = 0; environ[n]; n++)
+    ;
+  // 포인터 배열 뒤에 새로 만든 두 변수를 붙여 Free 한 번으로 놓는다
+  envp = Malloc((n + 3) * sizeof(char *) + strlen(cgiargs) + strlen(method) + 32);
+  qs = (char *)(envp + n + 3);
+  for (i = n = 0; environ[i]; i++)
+    if (strncmp(environ[i], "QUERY_STRING=", 13) && strncmp(environ[i], "REQUEST_METHOD=", 15))
+      envp[n++] = environ[i];
+  rm = qs + sprintf(qs, "QUERY_STRING=%s", cgiargs) + 1;
+  sprintf(rm, "REQUEST_METHOD=%s", method);
+  envp[n++] = qs;
+  envp[n++] = rm;
+  envp[n] = NULL;
+  return envp;
 }
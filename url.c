@@ -0,0 +1,242 @@
+/*
+ * url.c - 캐시 키용 URL 정규화와 해시
+ *
+ * 해시는 xxHash64처럼 8바이트 단어마다 곱셈 두 번으로 섞고 마지막에 길이를 넣어
+ * 눈사태 처리를 한다. 바이트마다 곱하던 FNV-1a보다 빠르고 64비트 모두가 고르게 섞여,
+ * 색인(hindex.c)이 쓰는 위쪽 비트와 아래 7비트 태그가 모두 쓸 만하다.
+ *
+ * url_canon은 정규화한 바이트를 out에 쓰면서, 다 찬 8바이트 단어를 부분(권한, 경로
+ * 세그먼트, 질의)이 끝날 때마다 바로 해시에 섞는다. 방금 쓴 바이트를 L1에서 다시 읽을
+ * 뿐이라 키를 만들고 나면 해시도 이미 나와 있다. 경로에 . 이나 .. 세그먼트가 있을 때만
+ * 앞서 쓴 부분이 지워지므로, 그때는 세그먼트를 정리한 뒤 url_hash로 다시 해시한다.
+ */
+#include <string.h>
+#include "url.h"
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+
+/* 정규화 중인 out과 해시 상태 */
+typedef struct {
+  char *out;
+  size_t len;                   /* out에 쓴 바이트 수 */
+  size_t hashed;                /* 그중 해시에 섞은 바이트 수 (8의 배수) */
+  uint64_t h;
+} canon_t;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mix(uint64_t h, uint64_t w)
+{
+  h ^= rotl(w * P2, 31) * P1;
+  return rotl(h, 27) * P1 + P4;
+}
+
+/* 8바이트 이하를 0으로 채운 단어로 읽는다 */
+static inline uint64_t load(const char *s, size_t n)
+{
+  uint64_t w = 0;
+
+  memcpy(&w, s, n);
+  return w;
+}
+
+/* 남은 바이트와 길이를 넣고 눈사태 처리 */
+static inline uint64_t finish(uint64_t h, const char *tail, size_t n, size_t len)
+{
+  if (n)
+    h = mix(h, load(tail, n));
+  h ^= len * P1;
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t url_hash(const char *s)
+{
+  size_t len = strlen(s), i;
+  uint64_t h = P3;
+
+  for (i = 0; i + 8 <= len; i += 8)
+    h = mix(h, load(s + i, 8));
+  return finish(h, s + i, len - i, len);
+}
+
+static inline void put(canon_t *c, int ch)
+{
+  c->out[c->len++] = ch;
+}
+
+/* out에 다 찬 단어를 해시에 섞는다 */
+static inline void feed(canon_t *c)
+{
+  for (; c->len - c->hashed >= 8; c->hashed += 8)
+    c->h = mix(c->h, load(c->out + c->hashed, 8));
+}
+
+/* 로캘과 무관한 ASCII 판별 (ctype 함수 호출을 피한다) */
+static inline int lower(int ch)
+{
+  return (ch >= 'A' && ch <= 'Z') ? ch + 32 : ch;
+}
+
+static inline int hexval(int ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  ch = lower(ch);
+  return (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1;
+}
+
+static inline int unreserved(int ch)
+{
+  ch = lower(ch);
+  return (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '.' ||
+    ch == '_' || ch == '~';
+}
+
+/*
+ * p에서 '\0'이나 '?', '#'(path면 '/'도) 앞까지 옮기고 그다음 위치를 돌려준다. 특별한
+ * 글자가 없는 구간은 한꺼번에 복사하고, %XX는 16진 숫자를 대문자로 쓰거나 비예약 문자면
+ * 그 문자로 푼다.
+ */
+static inline const char *put_part(canon_t *c, const char *p, int path)
+{
+  const char *s;
+  int hi, lo;
+
+  while (1) {
+    for (s = p; *s && *s != '%' && *s != '#' && (!path || (*s != '/' && *s != '?')); s++)
+      ;
+    memcpy(c->out + c->len, p, s - p);
+    c->len += s - p;
+    p = s;
+    if (*p != '%')
+      return p;
+    if ((hi = hexval(p[1])) >= 0 && (lo = hexval(p[2])) >= 0) {
+      if (unreserved(hi * 16 + lo))
+        put(c, hi * 16 + lo);
+      else {
+        put(c, '%');
+        put(c, "0123456789ABCDEF"[hi]);
+        put(c, "0123456789ABCDEF"[lo]);
+      }
+      p += 3;
+    }
+    else
+      put(c, *p++);
+  }
+}
+
+/* '/'로 시작하는 경로 path[0..len)에서 . 과 .. 세그먼트를 없애고 새 길이를 돌려준다 */
+static size_t remove_dots(char *path, size_t len)
+{
+  size_t i = 0, o = 0, n;
+
+  while (i < len) {                     // path[i]는 '/'
+    i++;
+    for (n = 0; i + n < len && path[i + n] != '/'; n++)
+      ;
+    if ((n == 1 && path[i] == '.') || (n == 2 && path[i] == '.' && path[i + 1] == '.')) {
+      if (n == 2)                       // 앞 세그먼트를 하나 걷어낸다
+        while (o > 0 && path[--o] != '/')
+          ;
+      if (i + n == len)                 // /a/b/.. 는 /a/ (디렉터리로 끝난다)
+        path[o++] = '/';
+    }
+    else {
+      path[o++] = '/';
+      memmove(path + o, path + i, n);
+      o += n;
+    }
+    i += n;
+  }
+  if (!o)
+    path[o++] = '/';
+  return o;
+}
+
+uint64_t url_canon(const char *url, char *out)
+{
+  const char *p = url, *s, *end, *host, *colon, *defport = NULL;
+  canon_t c = { out, 0, 0, P3 };
+  size_t seg, path, query;
+  int dots = 0;
+
+  // 스킴: 소문자로 (strstr, strcspn은 이렇게 짧은 문자열에는 준비 비용이 더 크다)
+  for (s = p; *s && *s != ':' && *s != '/'; s++)
+    ;
+  if (s[0] == ':' && s[1] == '/' && s[2] == '/') {
+    for (; p < s; p++)
+      put(&c, lower(*p));
+    if (c.len == 4 && !memcmp(out, "http", 4))
+      defport = "80";
+    else if (c.len == 5 && !memcmp(out, "https", 5))
+      defport = "443";
+    put(&c, ':');
+    put(&c, '/');
+    put(&c, '/');
+    p += 3;
+
+    // 권한: userinfo@는 그대로, 호스트는 소문자로, 기본 포트는 뺀다
+    for (end = p; *end && *end != '/' && *end != '?' && *end != '#'; end++)
+      ;
+    for (host = p, s = p; s < end; s++)
+      if (*s == '@')
+        host = s + 1;
+    for (; p < host; p++)
+      put(&c, *p);
+    for (colon = NULL, s = host; s < end; s++)   // IPv6 [::1]의 ':'는 포트가 아니다
+      if (*s == ':')
+        colon = s;
+      else if (*s == ']')
+        colon = NULL;
+    for (; p < (colon ? colon : end); p++)
+      put(&c, lower(*p));
+    if (colon && colon + 1 < end &&
+        !(defport && (size_t)(end - colon - 1) == strlen(defport) &&
+          !strncmp(colon + 1, defport, end - colon - 1)))
+      for (; p < end; p++)
+        put(&c, *p);
+    p = end;
+    feed(&c);
+  }
+
+  // 경로: 세그먼트마다 . 과 .. 인지 보고, 아직 없었으면 해시에 섞는다
+  path = c.len;
+  if (*p != '/')
+    put(&c, '/');
+  while (*p && *p != '?' && *p != '#') {
+    if (*p == '/')
+      put(&c, *p++);
+    seg = c.len;
+    p = put_part(&c, p, 1);
+    if ((c.len - seg == 1 && out[seg] == '.') ||
+        (c.len - seg == 2 && out[seg] == '.' && out[seg + 1] == '.'))
+      dots = 1;
+    if (!dots)
+      feed(&c);
+  }
+
+  // 질의: 퍼센트 인코딩만 정규화한다. #fragment는 버린다
+  query = c.len;
+  if (*p == '?')
+    put_part(&c, p, 0);
+  out[c.len] = '\0';
+
+  if (dots) {
+    seg = remove_dots(out + path, query - path);
+    memmove(out + path + seg, out + query, c.len - query + 1);
+    return url_hash(out);
+  }
+  feed(&c);
+  return finish(c.h, out + c.hashed, c.len - c.hashed, c.len);
+}
@@ -0,0 +1,29 @@
+/*
+ * url.h - 캐시 키용 URL 정규화와 해시
+ *
+ * 요청줄의 URL을 그대로 키로 쓰면 http://Localhost:80/home.html과
+ * http://localhost/home.html이 서로 다른 객체가 된다. 프록시는 요청마다 URL을 한 번
+ * 정규화하고 그 결과를 캐시 키이자 원 서버로 보낼 URL로 쓴다. 정규화는 RFC 3986에서
+ * 같은 자원을 가리킨다고 정한 변환만 한다.
+ */
+#ifndef __URL_H__
+#define __URL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * url을 정규화해 out에 쓰고, 같은 순회에서 계산한 out의 url_hash를 돌려준다.
+ *   - 스킴과 호스트를 소문자로 (userinfo는 그대로)
+ *   - 스킴의 기본 포트(http 80, https 443)와 빈 포트를 뺀다
+ *   - %XX는 16진 숫자를 대문자로, 비예약 문자(영숫자 - . _ ~)면 그 문자로 푼다
+ *   - 경로의 . 과 .. 세그먼트를 없애고, 빈 경로는 "/"로
+ *   - #fragment는 버린다
+ * out에는 strlen(url) + 2바이트가 있어야 한다.
+ */
+uint64_t url_canon(const char *url, char *out);
+
+/* 캐시 키의 64비트 해시. 8바이트씩 섞는 xxHash 방식이다 */
+uint64_t url_hash(const char *s);
+
+#endif /* __URL_H__ */